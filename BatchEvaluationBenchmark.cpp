@@ -0,0 +1,137 @@
+#include "BatchFunction.hpp"
+#include "BenchmarkUtils.hpp"
+#include "DefaultTarget.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+#include <vector>
+
+constexpr unsigned DEFAULT_ELEMENT_COUNT = 1 << 20;
+constexpr unsigned CALL_REPETITIONS = 10;
+
+using ScalarFunction = double(double);
+using BatchFunction = void(const double *, double *, int64_t);
+
+// Defines `double polynomial(double x)`, a Horner-scheme cubic that is cheap
+// enough for the call overhead to dominate when called per element.
+std::unique_ptr<llvm::Module> DefinePolynomial(llvm::LLVMContext &context) {
+    auto module = std::make_unique<llvm::Module>("polynomial", context);
+    module->setTargetTriple(GetDefaultTargetTriple().str());
+    module->setDataLayout(GetDefaultDataLayout());
+
+    llvm::Type *double_type = llvm::Type::getDoubleTy(context);
+    llvm::FunctionType *func_type = llvm::FunctionType::get(
+        double_type, {double_type}, /*isVarArg*/ false);
+    llvm::Function *polynomial_func = llvm::Function::Create(
+        func_type, llvm::Function::ExternalLinkage, "polynomial", *module);
+
+    llvm::IRBuilder<> ir_builder{context};
+    ir_builder.SetInsertPoint(
+        llvm::BasicBlock::Create(context, "", polynomial_func));
+
+    llvm::Argument *x = polynomial_func->getArg(0);
+    llvm::Value *value = llvm::ConstantFP::get(double_type, 0.5);
+    for (double coefficient : {1.5, -2.0, 3.0}) {
+        value = ir_builder.CreateFMul(value, x);
+        value = ir_builder.CreateFAdd(
+            value, llvm::ConstantFP::get(double_type, coefficient));
+    }
+    ir_builder.CreateRet(value);
+
+    assert(!llvm::verifyModule(*module, &llvm::errs()));
+    return module;
+}
+
+struct BatchResult {
+    double scalar_nanoseconds = 0.0;
+    double batch_nanoseconds = 0.0;
+};
+
+// Evaluates `polynomial` over `input`, once per element through a function
+// pointer and once with a single call of the batch variant, both compiled
+// for `cpu`.
+llvm::Expected<BatchResult> measureCPU(TargetCPU cpu,
+                                       const std::vector<double> &input) {
+    SimpleJITCompiler::Options options{};
+    options.cpu = cpu;
+    options.batch_functions = true;
+    SimpleJITCompiler compiler{options};
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = DefinePolynomial(*context);
+    if (auto err = compiler.add("polynomial", std::move(module),
+                                std::move(context), OptLevel::O3))
+        return {std::move(err)};
+
+    auto scalar_func =
+        compiler.lookupFunction<ScalarFunction>("polynomial", "polynomial");
+    if (!scalar_func)
+        return scalar_func.takeError();
+
+    auto batch_func = compiler.lookupFunction<BatchFunction>(
+        "polynomial", getBatchFunctionName("polynomial"));
+    if (!batch_func)
+        return batch_func.takeError();
+
+    std::vector<double> scalar_output(input.size());
+    std::vector<double> batch_output(input.size());
+
+    double scalar_seconds = measureBestOf(CALL_REPETITIONS, [&]() {
+        ScalarFunction *function = *scalar_func;
+        for (size_t index = 0; index < input.size(); ++index)
+            scalar_output[index] = function(input[index]);
+    });
+    double batch_seconds = measureBestOf(CALL_REPETITIONS, [&]() {
+        (*batch_func)(input.data(), batch_output.data(), input.size());
+    });
+
+    if (scalar_output != batch_output)
+        return llvm::createStringError(std::error_code{},
+                                       "Batch results differ from scalar ones");
+
+    BatchResult result;
+    result.scalar_nanoseconds = scalar_seconds * 1e9 / input.size();
+    result.batch_nanoseconds = batch_seconds * 1e9 / input.size();
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned element_count = DEFAULT_ELEMENT_COUNT;
+    if (argc > 1)
+        element_count = std::max(1, std::atoi(argv[1]));
+
+    PRINT_EXPR(element_count);
+    PRINT_EXPR(GetTargetCPUName(TargetCPU::Host));
+
+    std::vector<double> input(element_count);
+    for (unsigned index = 0; index < element_count; ++index)
+        input[index] = index % 1000 / 100.0;
+
+    llvm::outs() << "cpu       scalar(ns/elem)  batch(ns/elem)  speedup\n";
+
+    for (TargetCPU cpu : {TargetCPU::Generic, TargetCPU::Host}) {
+        EXIT_ON_ERROR(BatchResult, result, measureCPU(cpu, input));
+
+        llvm::outs() << llvm::format(
+            "%-8s %16.3f %15.3f %8.2fx\n",
+            cpu == TargetCPU::Host ? "host" : "generic",
+            result.scalar_nanoseconds, result.batch_nanoseconds,
+            result.scalar_nanoseconds / result.batch_nanoseconds);
+    }
+}
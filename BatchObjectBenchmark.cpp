@@ -0,0 +1,106 @@
+#include "BenchmarkUtils.hpp"
+#include "BenchmarkWorkloads.hpp"
+#include "CreateObjectFile.hpp"
+#include "DefaultTarget.hpp"
+#include "utils.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr unsigned DEFAULT_MODULE_COUNT = 128;
+constexpr unsigned FUNCTIONS_PER_MODULE = 8;
+
+struct BatchResult {
+    double seconds = 0.0;
+    uint64_t object_bytes = 0;
+};
+
+// Compiles freshly generated modules to objects. `thread_count` 0 compiles
+// them one by one with createObjectFileFromModule on the shared
+// TargetMachine, anything else uses the batch API with that many workers.
+llvm::Expected<BatchResult> compileBatch(unsigned thread_count,
+                                         unsigned module_count) {
+    std::vector<std::unique_ptr<llvm::LLVMContext>> contexts;
+    std::vector<std::unique_ptr<llvm::Module>> owned_modules;
+    std::vector<llvm::Module *> modules;
+
+    for (unsigned index = 0; index < module_count; ++index) {
+        contexts.push_back(std::make_unique<llvm::LLVMContext>());
+        owned_modules.push_back(DefineWorkModule(
+            *contexts.back(), "kernel_" + std::to_string(index),
+            FUNCTIONS_PER_MODULE, index));
+        modules.push_back(owned_modules.back().get());
+    }
+
+    BatchResult result;
+    llvm::Error err = llvm::Error::success();
+
+    auto consume = [&](size_t, llvm::Expected<OwningObjectFile> object_file) {
+        if (!object_file) {
+            err = llvm::joinErrors(std::move(err), object_file.takeError());
+            return;
+        }
+        result.object_bytes +=
+            object_file->getBinary()->getMemoryBufferRef().getBufferSize();
+    };
+
+    result.seconds = measureSeconds([&]() {
+        if (thread_count == 0) {
+            for (size_t index = 0; index < modules.size(); ++index)
+                consume(index, createObjectFileFromModule(*modules[index]));
+            return;
+        }
+
+        err = llvm::joinErrors(
+            std::move(err),
+            createObjectFilesFromModules(modules, consume, TargetCPU::Generic,
+                                         thread_count));
+    });
+
+    if (err)
+        return {std::move(err)};
+
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned module_count = DEFAULT_MODULE_COUNT;
+    if (argc > 1)
+        module_count = std::max(1, std::atoi(argv[1]));
+
+    unsigned core_count = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<unsigned> thread_counts{0};
+    for (unsigned threads = 1; threads < core_count; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(core_count);
+
+    PRINT_EXPR(module_count);
+    PRINT_EXPR(core_count);
+
+    llvm::outs() << "threads      seconds   objects/s    object KiB   speedup\n";
+
+    double baseline_seconds = 0.0;
+    for (unsigned threads : thread_counts) {
+        EXIT_ON_ERROR(BatchResult, result,
+                      compileBatch(threads, module_count));
+
+        if (threads == 0)
+            baseline_seconds = result.seconds;
+
+        llvm::outs() << llvm::format(
+            "%7u %12.4f %11.1f %13llu %8.2fx\n", threads, result.seconds,
+            module_count / result.seconds,
+            static_cast<unsigned long long>(result.object_bytes / 1024),
+            baseline_seconds / result.seconds);
+    }
+}
@@ -0,0 +1,571 @@
+#include "BenchmarkUtils.hpp"
+#include "BenchmarkWorkloads.hpp"
+#include "CreateObjectFile.hpp"
+#include "DefaultTarget.hpp"
+#include "DefineFactorial.hpp"
+#include "DefineSquare.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "SymbolIndex.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+constexpr unsigned DEFAULT_REPETITIONS = 5;
+constexpr unsigned FUNCTIONS_PER_MODULE = 8;
+constexpr uint64_t DEFAULT_CALL_COUNT = 10000000;
+
+using SquareFunction = double(double);
+using FactorialFunction = int64_t(int64_t);
+
+// Parameters scaled across the cases of the suite.
+struct SuiteOptions {
+    unsigned repetitions = DEFAULT_REPETITIONS;
+    uint64_t call_count = DEFAULT_CALL_COUNT;
+    std::vector<unsigned> module_counts{1, 16};
+    std::vector<unsigned> statement_counts{16, 128};
+    std::vector<unsigned> thread_counts;
+    llvm::StringRef filter;
+};
+
+// One measured case: `run` is called once to warm up and then `repetitions`
+// times, and returns the seconds spent in the measured part only, so that
+// setup such as building input modules is excluded.
+struct BenchmarkCase {
+    std::string name;
+    std::vector<std::pair<std::string, uint64_t>> parameters;
+    // Work items per run, e.g. functions compiled or calls made
+    uint64_t items = 1;
+    std::function<llvm::Expected<double>()> run;
+};
+
+struct BenchmarkResult {
+    const BenchmarkCase *benchmark = nullptr;
+    double best_seconds = 0.0;
+    double median_seconds = 0.0;
+    double mean_seconds = 0.0;
+};
+
+std::string getCaseLabel(const BenchmarkCase &benchmark) {
+    std::string label = benchmark.name;
+    for (const auto &[name, value] : benchmark.parameters)
+        label += (llvm::Twine("/") + name + "=" + llvm::Twine(value)).str();
+    return label;
+}
+
+// Modules "bench_<index>" of FUNCTIONS_PER_MODULE work functions, each in a
+// context of its own so that they can be compiled concurrently.
+struct WorkModules {
+    std::vector<std::unique_ptr<llvm::LLVMContext>> contexts;
+    std::vector<std::unique_ptr<llvm::Module>> modules;
+};
+
+WorkModules DefineWorkModules(unsigned module_count, unsigned statements) {
+    WorkModules work;
+    for (unsigned index = 0; index < module_count; ++index) {
+        work.contexts.push_back(std::make_unique<llvm::LLVMContext>());
+        work.modules.push_back(DefineWorkModule(
+            *work.contexts.back(), "bench_" + std::to_string(index),
+            FUNCTIONS_PER_MODULE, index * FUNCTIONS_PER_MODULE, statements));
+    }
+    return work;
+}
+
+std::string getWorkFunctionName(unsigned module, unsigned function) {
+    return "bench_" + std::to_string(module) + "_" + std::to_string(function);
+}
+
+llvm::Expected<double> measureSquareConstruction() {
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> module;
+    return measureSeconds([&]() { module = DefineSquare(context); });
+}
+
+llvm::Expected<double>
+measureFactorialConstruction(RecursionLowering lowering) {
+    llvm::LLVMContext context;
+    llvm::Module module{"factorial", context};
+    return measureSeconds([&]() { DefineFactorial(module, lowering); });
+}
+
+llvm::Expected<double> measureWorkModuleConstruction(unsigned statements) {
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> module;
+    return measureSeconds([&]() {
+        module = DefineWorkModule(context, "bench", FUNCTIONS_PER_MODULE,
+                                  /*seed*/ 0, statements);
+    });
+}
+
+llvm::Expected<double> measureCodegen(unsigned statements) {
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> module = DefineWorkModule(
+        context, "bench", FUNCTIONS_PER_MODULE, /*seed*/ 0, statements);
+
+    llvm::Error err = llvm::Error::success();
+    double seconds = measureSeconds([&]() {
+        auto object = createObjectFileFromModule(*module);
+        if (!object)
+            err = llvm::joinErrors(std::move(err), object.takeError());
+    });
+
+    if (err)
+        return {std::move(err)};
+    return seconds;
+}
+
+llvm::Expected<double> measureParallelCodegen(unsigned module_count,
+                                              unsigned statements,
+                                              unsigned threads) {
+    WorkModules work = DefineWorkModules(module_count, statements);
+    std::vector<llvm::Module *> modules;
+    for (const std::unique_ptr<llvm::Module> &module : work.modules)
+        modules.push_back(module.get());
+
+    llvm::Error compile_err = llvm::Error::success();
+    llvm::Error err = llvm::Error::success();
+    double seconds = measureSeconds([&]() {
+        err = llvm::joinErrors(
+            std::move(err),
+            createObjectFilesFromModules(
+                modules,
+                [&](size_t, llvm::Expected<OwningObjectFile> object) {
+                    if (!object)
+                        compile_err = llvm::joinErrors(std::move(compile_err),
+                                                       object.takeError());
+                },
+                TargetCPU::Generic, threads));
+    });
+
+    err = llvm::joinErrors(std::move(err), std::move(compile_err));
+    if (err)
+        return {std::move(err)};
+    return seconds;
+}
+
+llvm::Expected<double> measureJITAddLookup(unsigned module_count,
+                                           unsigned statements,
+                                           unsigned threads) {
+    SimpleJITCompiler::Options jit_options{};
+    jit_options.compile_threads = threads > 1 ? threads : 0;
+    SimpleJITCompiler compiler{jit_options};
+
+    WorkModules work = DefineWorkModules(module_count, statements);
+
+    std::vector<std::string> module_names;
+    std::vector<std::string> symbol_names;
+    for (unsigned module = 0; module < module_count; ++module) {
+        module_names.push_back(work.modules[module]->getName().str());
+        for (unsigned function = 0; function < FUNCTIONS_PER_MODULE;
+             ++function)
+            symbol_names.push_back(getWorkFunctionName(module, function));
+    }
+
+    std::vector<std::pair<std::string_view, std::string_view>> requests;
+    for (size_t symbol = 0; symbol < symbol_names.size(); ++symbol)
+        requests.emplace_back(module_names[symbol / FUNCTIONS_PER_MODULE],
+                              symbol_names[symbol]);
+
+    llvm::Error err = llvm::Error::success();
+    double seconds = measureSeconds([&]() {
+        for (unsigned module = 0; module < module_count && !err; ++module)
+            err = compiler.add(module_names[module],
+                               std::move(work.modules[module]),
+                               std::move(work.contexts[module]), OptLevel::O2);
+        if (err)
+            return;
+
+        auto symbols = compiler.lookup(requests);
+        if (!symbols)
+            err = symbols.takeError();
+    });
+
+    if (err)
+        return {std::move(err)};
+    return seconds;
+}
+
+llvm::Expected<double> measureObjectReading(unsigned module_count) {
+    WorkModules work =
+        DefineWorkModules(module_count, /*statements*/ STATEMENTS_PER_FUNCTION);
+
+    std::vector<OwningObjectFile> objects;
+    for (const std::unique_ptr<llvm::Module> &module : work.modules) {
+        auto object = createObjectFileFromModule(*module);
+        if (!object)
+            return object.takeError();
+        objects.push_back(std::move(*object));
+    }
+
+    llvm::Error err = llvm::Error::success();
+    double seconds = measureSeconds([&]() {
+        for (unsigned module = 0; module < module_count; ++module) {
+            auto object_file = llvm::object::ObjectFile::createObjectFile(
+                objects[module].getBinary()->getMemoryBufferRef());
+            if (!object_file) {
+                err = llvm::joinErrors(std::move(err),
+                                       object_file.takeError());
+                return;
+            }
+
+            auto symbol_index = SymbolIndex::create(**object_file);
+            if (!symbol_index) {
+                err = llvm::joinErrors(std::move(err),
+                                       symbol_index.takeError());
+                return;
+            }
+
+            for (unsigned function = 0; function < FUNCTIONS_PER_MODULE;
+                 ++function)
+                doNotOptimize(
+                    symbol_index->lookup(getWorkFunctionName(module, function))
+                        .getValueOr(0));
+        }
+    });
+
+    if (err)
+        return {std::move(err)};
+    return seconds;
+}
+
+double NativeSquare(double value) { return value * value; }
+
+double measureSquareCalls(SquareFunction *square, uint64_t call_count) {
+    return measureSeconds([&]() {
+        double sum = 0.0;
+        for (uint64_t call = 0; call < call_count; ++call)
+            sum += square(static_cast<double>(call & 0xff));
+        doNotOptimize(sum);
+    });
+}
+
+llvm::Expected<double> measureNativeSquareCalls(uint64_t call_count) {
+    // Keeps the call from being inlined
+    SquareFunction *volatile square = &NativeSquare;
+    return measureSquareCalls(square, call_count);
+}
+
+llvm::Expected<double> measureJITSquareCalls(uint64_t call_count) {
+    SimpleJITCompiler compiler{};
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    std::unique_ptr<llvm::Module> module = DefineSquare(*context);
+    if (auto err = compiler.add("square", std::move(module),
+                                std::move(context), OptLevel::O2))
+        return {std::move(err)};
+
+    auto square = compiler.lookupFunction<SquareFunction>("square", "square");
+    if (!square)
+        return square.takeError();
+
+    return measureSquareCalls(*square, call_count);
+}
+
+llvm::Expected<double> measureJITFactorialCalls(uint64_t call_count) {
+    SimpleJITCompiler compiler{};
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = std::make_unique<llvm::Module>("factorial", *context);
+    module->setTargetTriple(GetDefaultTargetTriple().str());
+    module->setDataLayout(GetDefaultDataLayout());
+    DefineFactorial(*module, RecursionLowering::Loop);
+
+    if (auto err = compiler.add("factorial", std::move(module),
+                                std::move(context), OptLevel::O2))
+        return {std::move(err)};
+
+    auto factorial =
+        compiler.lookupFunction<FactorialFunction>("factorial", "factorial");
+    if (!factorial)
+        return factorial.takeError();
+
+    return measureSeconds([&]() {
+        int64_t sum = 0;
+        for (uint64_t call = 0; call < call_count; ++call)
+            sum += (*factorial)(static_cast<int64_t>(call & 0xf));
+        doNotOptimize(sum);
+    });
+}
+
+// Every case of the suite, for the scaled parameters in `options`.
+std::vector<BenchmarkCase> createCases(const SuiteOptions &options) {
+    std::vector<BenchmarkCase> cases;
+
+    // IRBuilder cost of the square, factorial and work modules
+    cases.push_back({"ir/square", {}, 1, measureSquareConstruction});
+    for (RecursionLowering lowering :
+         {RecursionLowering::Naive, RecursionLowering::TailCall,
+          RecursionLowering::Loop}) {
+        cases.push_back(
+            {("ir/factorial_" + getRecursionLoweringName(lowering)).str(),
+             {},
+             1,
+             [=]() { return measureFactorialConstruction(lowering); }});
+    }
+    for (unsigned statements : options.statement_counts) {
+        cases.push_back(
+            {"ir/work_module",
+             {{"statements", statements}},
+             FUNCTIONS_PER_MODULE,
+             [=]() { return measureWorkModuleConstruction(statements); }});
+    }
+
+    // Instruction selection and object emission of unoptimized modules
+    for (unsigned statements : options.statement_counts) {
+        cases.push_back({"codegen/module",
+                         {{"statements", statements}},
+                         FUNCTIONS_PER_MODULE,
+                         [=]() { return measureCodegen(statements); }});
+    }
+
+    for (unsigned module_count : options.module_counts) {
+        for (unsigned statements : options.statement_counts) {
+            for (unsigned threads : options.thread_counts) {
+                std::vector<std::pair<std::string, uint64_t>> parameters{
+                    {"modules", module_count},
+                    {"statements", statements},
+                    {"threads", threads}};
+
+                cases.push_back({"codegen/parallel", parameters, module_count,
+                                 [=]() {
+                                     return measureParallelCodegen(
+                                         module_count, statements, threads);
+                                 }});
+
+                // Optimization, codegen and JIT linking of O2 modules until
+                // every function has been looked up
+                cases.push_back({"jit/add_lookup", parameters,
+                                 module_count * FUNCTIONS_PER_MODULE, [=]() {
+                                     return measureJITAddLookup(
+                                         module_count, statements, threads);
+                                 }});
+            }
+        }
+    }
+
+    // Parsing objects and indexing their symbols, as the object readers do
+    // before resolving a function
+    for (unsigned module_count : options.module_counts) {
+        cases.push_back(
+            {"object/read_index",
+             {{"modules", module_count}},
+             module_count * FUNCTIONS_PER_MODULE,
+             [=]() { return measureObjectReading(module_count); }});
+    }
+
+    // Calls through a function pointer, to JIT'd and to native code
+    uint64_t call_count = options.call_count;
+    cases.push_back({"call/native_square", {}, call_count, [=]() {
+                         return measureNativeSquareCalls(call_count);
+                     }});
+    cases.push_back({"call/jit_square", {}, call_count, [=]() {
+                         return measureJITSquareCalls(call_count);
+                     }});
+    cases.push_back({"call/jit_factorial_loop", {}, call_count, [=]() {
+                         return measureJITFactorialCalls(call_count);
+                     }});
+
+    return cases;
+}
+
+llvm::Expected<BenchmarkResult> runCase(const BenchmarkCase &benchmark,
+                                        unsigned repetitions) {
+    // Warm up caches, lazily initialized LLVM state and the allocator
+    auto warm_up = benchmark.run();
+    if (!warm_up)
+        return warm_up.takeError();
+
+    std::vector<double> samples;
+    for (unsigned run = 0; run < repetitions; ++run) {
+        auto seconds = benchmark.run();
+        if (!seconds)
+            return seconds.takeError();
+        samples.push_back(*seconds);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchmarkResult result;
+    result.benchmark = &benchmark;
+    result.best_seconds = samples.front();
+    result.median_seconds = samples[samples.size() / 2];
+    for (double seconds : samples)
+        result.mean_seconds += seconds / samples.size();
+    return result;
+}
+
+void printTextResult(llvm::raw_ostream &os, const BenchmarkResult &result) {
+    const BenchmarkCase &benchmark = *result.benchmark;
+    os << llvm::format("%-52s %12.3f %12.3f %14.1f %14.0f\n",
+                       getCaseLabel(benchmark).c_str(),
+                       result.best_seconds * 1e3, result.median_seconds * 1e3,
+                       result.best_seconds * 1e9 / benchmark.items,
+                       benchmark.items / result.best_seconds);
+}
+
+void writeJSONResult(llvm::json::OStream &json,
+                     const BenchmarkResult &result) {
+    const BenchmarkCase &benchmark = *result.benchmark;
+    json.object([&]() {
+        json.attribute("name", benchmark.name);
+        json.attributeObject("parameters", [&]() {
+            for (const auto &[name, value] : benchmark.parameters)
+                json.attribute(name, static_cast<int64_t>(value));
+        });
+        json.attribute("items", static_cast<int64_t>(benchmark.items));
+        json.attribute("best_ns", result.best_seconds * 1e9);
+        json.attribute("median_ns", result.median_seconds * 1e9);
+        json.attribute("mean_ns", result.mean_seconds * 1e9);
+        json.attribute("ns_per_item",
+                       result.best_seconds * 1e9 / benchmark.items);
+    });
+}
+
+std::vector<unsigned> parseCountList(llvm::StringRef list) {
+    llvm::SmallVector<llvm::StringRef, 4> fields;
+    list.split(fields, ',', /*MaxSplit*/ -1, /*KeepEmpty*/ false);
+
+    std::vector<unsigned> counts;
+    for (llvm::StringRef field : fields) {
+        unsigned count = 0;
+        if (!field.getAsInteger(10, count) && count > 0)
+            counts.push_back(count);
+    }
+    return counts;
+}
+
+// Usage: BenchmarkSuite [--format=text|json] [-o <file>] [--filter=<text>]
+//                       [--repetitions=<n>] [--calls=<n>]
+//                       [--modules=<n,...>] [--statements=<n,...>]
+//                       [--threads=<n,...>]
+//
+// Runs every case whose label contains the filter: IR construction, codegen,
+// JIT add and lookup, object reading and call overhead, scaled over the
+// module counts, statements per work function and thread counts given.
+// Each case runs once to warm up and then `repetitions` times on fixed
+// inputs. The JSON output records the LLVM version and host next to every
+// result, so that files of two releases can be compared case by case.
+int main(int argc, char *argv[]) {
+    SuiteOptions options;
+    bool json_output = false;
+    llvm::StringRef output_path = "-";
+
+    unsigned hardware_threads =
+        std::max(1u, std::thread::hardware_concurrency());
+    options.thread_counts = {1};
+    if (hardware_threads > 1)
+        options.thread_counts.push_back(hardware_threads);
+
+    for (int arg = 1; arg < argc; ++arg) {
+        llvm::StringRef option{argv[arg]};
+        bool valid = true;
+
+        if (option == "-o" && arg + 1 < argc) {
+            output_path = argv[++arg];
+        } else if (option == "--format=text" || option == "--format=json") {
+            json_output = option == "--format=json";
+        } else if (option.consume_front("--filter=")) {
+            options.filter = option;
+        } else if (option.consume_front("--repetitions=")) {
+            valid = !option.getAsInteger(10, options.repetitions) &&
+                    options.repetitions > 0;
+        } else if (option.consume_front("--calls=")) {
+            valid = !option.getAsInteger(10, options.call_count) &&
+                    options.call_count > 0;
+        } else if (option.consume_front("--modules=")) {
+            options.module_counts = parseCountList(option);
+            valid = !options.module_counts.empty();
+        } else if (option.consume_front("--statements=")) {
+            options.statement_counts = parseCountList(option);
+            valid = !options.statement_counts.empty();
+        } else if (option.consume_front("--threads=")) {
+            options.thread_counts = parseCountList(option);
+            valid = !options.thread_counts.empty();
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            llvm::errs() << "Invalid option " << argv[arg] << "\n";
+            return 1;
+        }
+    }
+
+    std::error_code ec;
+    llvm::raw_fd_ostream output{output_path, ec, llvm::sys::fs::OF_Text};
+    if (ec) {
+        llvm::errs() << "Failed to open " << output_path << ": "
+                     << ec.message() << "\n";
+        return 1;
+    }
+
+    std::vector<BenchmarkCase> cases = createCases(options);
+
+    // Only constructed for JSON, as it asserts that a value was written
+    std::optional<llvm::json::OStream> json;
+    if (json_output) {
+        json.emplace(output, /*IndentSize*/ 2);
+        json->objectBegin();
+        json->attribute("llvm_version", LLVM_VERSION_STRING);
+        json->attribute("target_triple", GetDefaultTargetTriple().str());
+        json->attribute("host_cpu", llvm::sys::getHostCPUName());
+        json->attribute("hardware_threads",
+                       static_cast<int64_t>(hardware_threads));
+        json->attribute("repetitions",
+                       static_cast<int64_t>(options.repetitions));
+        json->attributeBegin("results");
+        json->arrayBegin();
+    } else {
+        output << "case                                                     "
+                  "best(ms)   median(ms)        ns/item        items/s\n";
+    }
+
+    int exit_code = 0;
+
+    for (const BenchmarkCase &benchmark : cases) {
+        if (!llvm::StringRef{getCaseLabel(benchmark)}.contains(options.filter))
+            continue;
+
+        auto result = runCase(benchmark, options.repetitions);
+        if (!result) {
+            llvm::errs() << getCaseLabel(benchmark) << ": "
+                         << llvm::toString(result.takeError()) << "\n";
+            exit_code = 1;
+            continue;
+        }
+
+        if (json_output)
+            writeJSONResult(*json, *result);
+        else
+            printTextResult(output, *result);
+        output.flush();
+    }
+
+    if (json_output) {
+        json->arrayEnd();
+        json->attributeEnd();
+        json->objectEnd();
+        output << "\n";
+    }
+
+    return exit_code;
+}
@@ -0,0 +1,187 @@
+#include "BenchmarkUtils.hpp"
+#include "BenchmarkWorkloads.hpp"
+#include "BitcodeModule.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+constexpr unsigned DEFAULT_FUNCTION_COUNT = 400;
+constexpr unsigned HOT_FUNCTION_COUNT = 4;
+
+// Where the module of a startup comes from.
+enum class ModuleSource {
+    // Built with IRBuilder, as every program did so far
+    Builder,
+    // Bitcode with every function body parsed
+    Bitcode,
+    // Bitcode with only the looked up functions parsed
+    LazyBitcode,
+};
+
+const char *getModuleSourceName(ModuleSource source) {
+    switch (source) {
+    case ModuleSource::Builder:
+        return "irbuilder";
+    case ModuleSource::Bitcode:
+        return "bitcode";
+    case ModuleSource::LazyBitcode:
+        return "lazy-bitcode";
+    }
+    return "irbuilder";
+}
+
+struct StartupResult {
+    double module_seconds = 0.0;
+    double total_seconds = 0.0;
+    unsigned function_count = 0;
+    double checksum = 0.0;
+};
+
+// Obtains a module with `function_count` work functions from `source`, adds
+// it and calls the first few functions, as a program starting up with a
+// handful of hot kernels would.
+llvm::Expected<StartupResult> measureStartup(ModuleSource source,
+                                             llvm::StringRef bitcode_path,
+                                             unsigned function_count) {
+    std::vector<std::string> hot_names;
+    for (unsigned index = 0; index < HOT_FUNCTION_COUNT; ++index)
+        hot_names.push_back("reload_work_" + std::to_string(index));
+    llvm::SmallVector<llvm::StringRef, HOT_FUNCTION_COUNT> hot_name_refs(
+        hot_names.begin(), hot_names.end());
+
+    SimpleJITCompiler compiler{};
+    StartupResult result{};
+    llvm::Error err = llvm::Error::success();
+
+    result.total_seconds = measureSeconds([&]() {
+        auto context = std::make_unique<llvm::LLVMContext>();
+        std::unique_ptr<llvm::Module> module;
+
+        result.module_seconds = measureSeconds([&]() {
+            if (source == ModuleSource::Builder) {
+                module =
+                    DefineWorkModule(*context, "reload_work", function_count);
+                return;
+            }
+
+            auto loaded_module = loadBitcodeModule(
+                bitcode_path, *context,
+                source == ModuleSource::LazyBitcode
+                    ? llvm::ArrayRef<llvm::StringRef>{hot_name_refs}
+                    : llvm::ArrayRef<llvm::StringRef>{});
+            if (loaded_module)
+                module = std::move(*loaded_module);
+            else
+                err = llvm::joinErrors(std::move(err),
+                                       loaded_module.takeError());
+        });
+
+        if (err)
+            return;
+
+        result.function_count = module->getFunctionList().size();
+
+        err = compiler.add("reload_work", std::move(module),
+                           std::move(context), OptLevel::O2);
+        if (err)
+            return;
+
+        using work_func_t = double (*)(double, int64_t);
+
+        for (const std::string &hot_name : hot_names) {
+            auto symbol = compiler.lookup("reload_work", hot_name);
+            if (!symbol) {
+                err = symbol.takeError();
+                return;
+            }
+
+            auto work_func = llvm::jitTargetAddressToPointer<work_func_t>(
+                symbol->getAddress());
+            result.checksum += work_func(1.0, 16);
+        }
+    });
+
+    if (err)
+        return {std::move(err)};
+
+    return result;
+}
+
+// Usage: BitcodeReloadBenchmark [function count]
+//
+// Saves a module of work functions as bitcode once, then compares starting
+// up from IRBuilder, from the whole bitcode and from lazily loaded bitcode.
+int main(int argc, char *argv[]) {
+    unsigned function_count = DEFAULT_FUNCTION_COUNT;
+    if (argc > 1)
+        function_count = std::max(HOT_FUNCTION_COUNT,
+                                  static_cast<unsigned>(std::atoi(argv[1])));
+
+    PRINT_EXPR(function_count);
+    PRINT_EXPR(HOT_FUNCTION_COUNT);
+
+    llvm::SmallString<128> bitcode_path;
+    if (auto ec = llvm::sys::fs::createTemporaryFile("reload_work", "bc",
+                                                     bitcode_path)) {
+        llvm::errs() << "Failed to create temporary file: " << ec.message()
+                     << "\n";
+        return 1;
+    }
+    llvm::FileRemover bitcode_remover{bitcode_path};
+
+    {
+        llvm::LLVMContext context;
+        std::unique_ptr<llvm::Module> module =
+            DefineWorkModule(context, "reload_work", function_count);
+        if (auto err = saveBitcodeModule(*module, bitcode_path)) {
+            llvm::errs() << "Failed to save bitcode: "
+                         << llvm::toString(std::move(err)) << "\n";
+            return 1;
+        }
+    }
+
+    uint64_t bitcode_bytes = 0;
+    llvm::sys::fs::file_size(bitcode_path, bitcode_bytes);
+    PRINT_EXPR(bitcode_bytes);
+
+    llvm::outs() << "source        functions   module(ms)  first-call(ms)\n";
+
+    double expected_checksum = 0.0;
+    int exit_code = 0;
+
+    for (ModuleSource source : {ModuleSource::Builder, ModuleSource::Bitcode,
+                                ModuleSource::LazyBitcode}) {
+        EXIT_ON_ERROR(StartupResult, result,
+                      measureStartup(source, bitcode_path, function_count));
+
+        llvm::outs() << llvm::format(
+            "%-12s %10u %12.3f %15.3f", getModuleSourceName(source),
+            result.function_count, result.module_seconds * 1e3,
+            result.total_seconds * 1e3);
+
+        if (source == ModuleSource::Builder) {
+            expected_checksum = result.checksum;
+        } else if (result.checksum != expected_checksum) {
+            llvm::outs() << "  MISMATCH";
+            exit_code = 1;
+        }
+        llvm::outs() << '\n';
+    }
+
+    return exit_code;
+}
@@ -0,0 +1,96 @@
+#include "BenchmarkUtils.hpp"
+#include "BenchmarkWorkloads.hpp"
+#include "DefaultTarget.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+constexpr unsigned DEFAULT_MODULE_COUNT = 64;
+constexpr unsigned FUNCTIONS_PER_MODULE = 8;
+
+// Adds `module_count` modules and materializes all of them with a single
+// batched lookup. Returns the wall-clock seconds for add + lookup.
+llvm::Expected<double> compileModules(unsigned compile_threads,
+                                      unsigned module_count) {
+    SimpleJITCompiler::Options options{};
+    options.compile_threads = compile_threads;
+    SimpleJITCompiler compiler{options};
+
+    std::vector<std::string> module_names;
+    std::vector<std::string> symbol_names;
+    std::vector<std::unique_ptr<llvm::LLVMContext>> contexts;
+    std::vector<std::unique_ptr<llvm::Module>> modules;
+
+    for (unsigned index = 0; index < module_count; ++index) {
+        module_names.push_back("work_" + std::to_string(index));
+        symbol_names.push_back(module_names.back() + "_0");
+        contexts.push_back(std::make_unique<llvm::LLVMContext>());
+        modules.push_back(
+            DefineWorkModule(*contexts.back(), module_names.back(),
+                             FUNCTIONS_PER_MODULE, index));
+    }
+
+    std::vector<std::pair<std::string_view, std::string_view>> requests;
+    for (unsigned index = 0; index < module_count; ++index)
+        requests.emplace_back(module_names[index], symbol_names[index]);
+
+    llvm::Error err = llvm::Error::success();
+    double seconds = measureSeconds([&]() {
+        for (unsigned index = 0; index < module_count && !err; ++index)
+            err = compiler.add(module_names[index], std::move(modules[index]),
+                               std::move(contexts[index]), OptLevel::O2);
+        if (err)
+            return;
+
+        auto symbols = compiler.lookup(requests);
+        if (!symbols)
+            err = symbols.takeError();
+    });
+
+    if (err)
+        return {std::move(err)};
+
+    return seconds;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned module_count = DEFAULT_MODULE_COUNT;
+    if (argc > 1)
+        module_count = std::max(1, std::atoi(argv[1]));
+
+    unsigned core_count = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<unsigned> thread_counts{0};
+    for (unsigned threads = 1; threads < core_count; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(core_count);
+
+    PRINT_EXPR(module_count);
+    PRINT_EXPR(core_count);
+
+    llvm::outs() << "threads      seconds   modules/s   speedup\n";
+
+    double baseline_seconds = 0.0;
+    for (unsigned threads : thread_counts) {
+        EXIT_ON_ERROR(double, seconds, compileModules(threads, module_count));
+
+        if (threads == 0)
+            baseline_seconds = seconds;
+
+        llvm::outs() << llvm::format("%7u %12.4f %11.1f %8.2fx\n", threads,
+                                     seconds, module_count / seconds,
+                                     baseline_seconds / seconds);
+    }
+}
@@ -1,36 +1,158 @@
 #include "CreateObjectFile.hpp"
+#include "RecordWriter.hpp"
 #include "utils.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 
+void write_reloc_records(RecordWriter &writer,
+                         const llvm::object::SectionRef &section,
+                         RelocationTypeNames &type_names) {
+    llvm::StringRef section_name = get_section_name(section);
+
+    for (const auto &reloc : section.relocations()) {
+        writer.writeRelocation(section_name, reloc.getOffset(),
+                               static_cast<uint32_t>(reloc.getType()),
+                               type_names.get(reloc),
+                               get_reloc_symbol_name(reloc));
+    }
+}
+
+// Usage: ELFReader [-j<threads>] [--format=text|ndjson|binary] <object file>...
+//
+// With -j the files are mapped and the relocation sections of each file are
+// formatted in parallel on <threads> threads, or one per hardware thread if
+// <threads> is omitted.
+// The ndjson and binary formats write the records described in
+// RecordWriter.hpp to stdout.
 int main(int argc, char *argv[]) {
 
-    // Get source file
-    if (argc < 2) {
+    // Get options
+    bool parallel = false;
+    unsigned thread_count = 0;
+    OutputFormat format = OutputFormat::Text;
+
+    int first_file = 1;
+    for (; first_file < argc; ++first_file) {
+        llvm::StringRef option{argv[first_file]};
+
+        if (option.consume_front("-j")) {
+            parallel = true;
+            // A bare -j uses one thread per hardware thread
+            if (!option.empty() && option.getAsInteger(10, thread_count)) {
+                llvm::errs() << "Invalid thread count " << option << '\n';
+                return 1;
+            }
+        } else if (option.consume_front("--format=")) {
+            auto parsed_format = parseOutputFormat(option);
+            if (!parsed_format) {
+                llvm::errs() << "Unknown output format " << option << '\n';
+                return 1;
+            }
+            format = *parsed_format;
+        } else {
+            break;
+        }
+    }
+
+    // Get source files
+    if (argc <= first_file) {
         llvm::errs() << "No file path found in command line arguments\n";
         return 1;
     }
 
-    llvm::StringRef file_path{argv[1]};
-
-    // Create ObjectFile
-    OwningObjectFile owned_object_file =
-        llvm::cantFail(createObjectFileFromSource(file_path));
+    std::vector<std::string> file_paths{argv + first_file, argv + argc};
 
-    llvm::object::ObjectFile *object_file = owned_object_file.getBinary();
+    // Records go through a large buffer instead of line-buffered outs()
+    std::unique_ptr<llvm::raw_fd_ostream> record_sink;
+    llvm::Optional<RecordWriter> record_writer;
 
-    if (!object_file->isRelocatableObject()) {
-        llvm::errs() << file_path << " is not relocatable object\n";
-        return 1;
+    if (format != OutputFormat::Text) {
+        EXIT_ON_ERROR(std::unique_ptr<llvm::raw_fd_ostream>, opened_sink,
+                      openRecordSink("-"));
+        record_sink = std::move(opened_sink);
+        record_writer.emplace(*record_sink, format);
+        record_writer->writeHeader();
     }
 
-    // Print all relocatable symbols
-    for (const auto &section : object_file->sections()) {
-        if (has_reloc_symbols(section))
-            print_reloc_symbols(section);
+    // Map every file once and parse it in place. Relocations find their
+    // symbol tables through the section links, so the loader does not need
+    // to locate them up front.
+    ObjectFileLoader object_file_loader{/*init_content*/ false};
+    auto object_files =
+        object_file_loader.loadAll(file_paths, parallel ? thread_count : 1);
+
+    int exit_code = 0;
+    for (size_t index = 0; index < file_paths.size(); ++index) {
+        const std::string &file_path = file_paths[index];
+
+        if (!object_files[index]) {
+            llvm::errs() << file_path << ": "
+                         << llvm::toString(object_files[index].takeError())
+                         << '\n';
+            exit_code = 1;
+            continue;
+        }
+
+        llvm::object::ObjectFile &object_file = *object_files[index];
+
+        if (!object_file.isRelocatableObject()) {
+            llvm::errs() << file_path << " is not relocatable object\n";
+            exit_code = 1;
+            continue;
+        }
+
+        // Collect all sections with relocations
+        std::vector<llvm::object::SectionRef> reloc_sections;
+        for (const auto &section : object_file.sections()) {
+            if (has_reloc_symbols(section))
+                reloc_sections.push_back(section);
+        }
+
+        if (record_writer) {
+            record_writer->beginFile(file_path);
+
+            RelocationFormatter format_records =
+                [&](llvm::raw_ostream &os,
+                    const llvm::object::SectionRef &section,
+                    RelocationTypeNames &type_names) {
+                    RecordWriter section_writer{os, format, file_path};
+                    write_reloc_records(section_writer, section, type_names);
+                };
+
+            if (parallel) {
+                print_reloc_symbols_parallel(*record_sink, reloc_sections,
+                                             thread_count, format_records);
+                continue;
+            }
+
+            RelocationTypeNames type_names;
+            for (const auto &section : reloc_sections)
+                write_reloc_records(*record_writer, section, type_names);
+            continue;
+        }
+
+        if (file_paths.size() > 1)
+            llvm::outs() << file_path << ":\n";
+
+        // Print all relocatable symbols
+        if (parallel) {
+            print_reloc_symbols_parallel(llvm::outs(), reloc_sections,
+                                         thread_count);
+            continue;
+        }
+
+        RelocationTypeNames type_names;
+        for (const auto &section : reloc_sections)
+            write_reloc_symbols(llvm::outs(), section, type_names);
     }
+
+    return exit_code;
 }
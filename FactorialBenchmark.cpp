@@ -0,0 +1,172 @@
+#include "BenchmarkUtils.hpp"
+#include "DefaultTarget.hpp"
+#include "DefineFactorial.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+
+#if defined(__unix__)
+#include <pthread.h>
+#endif
+
+constexpr int64_t DEFAULT_DEPTH = 10000000;
+// Deep enough to measure, shallow enough for the default stack
+constexpr int64_t NAIVE_UNOPTIMIZED_DEPTH = 100000;
+// A few thousand frames at most
+constexpr size_t SMALL_STACK_BYTES = 64 * 1024;
+constexpr unsigned CALL_REPETITIONS = 5;
+// factorial(n) wraps to 0 for n >= 66, so results are checked on n = 20
+constexpr int64_t CHECK_ARGUMENT = 20;
+constexpr int64_t CHECK_RESULT = 2432902008176640000;
+
+using FactorialFunction = int64_t(int64_t);
+
+// Runs `callable` on a thread with a stack of only `stack_bytes`, so that
+// recursion growing with n overflows it. Runs `callable` directly where
+// the stack size cannot be chosen.
+template <typename Callable>
+void runOnSmallStack(size_t stack_bytes, Callable &callable) {
+#if defined(__unix__)
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, stack_bytes);
+
+    pthread_t thread;
+    auto start = [](void *argument) -> void * {
+        (*static_cast<Callable *>(argument))();
+        return nullptr;
+    };
+    if (pthread_create(&thread, &attributes, start, &callable) == 0) {
+        pthread_join(thread, nullptr);
+        pthread_attr_destroy(&attributes);
+        return;
+    }
+    pthread_attr_destroy(&attributes);
+#endif
+    (void)stack_bytes;
+    callable();
+}
+
+struct FactorialResult {
+    int64_t depth = 0;
+    int64_t check_value = 0;
+    double seconds = 0.0;
+    bool small_stack = false;
+};
+
+// JIT-compiles factorial lowered as `lowering` at `opt_level` and times
+// factorial(depth). Only unoptimized naive recursion, which needs one frame
+// per step, runs on the default stack and with a smaller depth.
+llvm::Expected<FactorialResult>
+measureFactorial(RecursionLowering lowering, OptLevel opt_level, int64_t depth,
+                 const SimpleJITCompiler::Options &options) {
+    SimpleJITCompiler compiler{options};
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = std::make_unique<llvm::Module>("factorial", *context);
+    module->setTargetTriple(GetDefaultTargetTriple().str());
+    module->setDataLayout(GetDefaultDataLayout());
+    DefineFactorial(*module, lowering);
+
+    if (auto err = compiler.add("factorial", std::move(module),
+                                std::move(context), opt_level))
+        return {std::move(err)};
+
+    auto factorial =
+        compiler.lookupFunction<FactorialFunction>("factorial", "factorial");
+    if (!factorial)
+        return factorial.takeError();
+
+    FactorialResult result;
+    result.small_stack = lowering != RecursionLowering::Naive ||
+                         opt_level != OptLevel::O0;
+    result.depth =
+        result.small_stack ? depth : std::min(depth, NAIVE_UNOPTIMIZED_DEPTH);
+
+    auto call = [&]() {
+        result.seconds = measureBestOf(CALL_REPETITIONS, [&]() {
+            doNotOptimize((*factorial)(result.depth));
+        });
+        result.check_value = (*factorial)(CHECK_ARGUMENT);
+    };
+
+    if (result.small_stack)
+        runOnSmallStack(SMALL_STACK_BYTES, call);
+    else
+        call();
+
+    return result;
+}
+
+// Usage: FactorialBenchmark [--perf-map] [--jitdump] [n]
+//
+// Calls factorial(n) compiled from each RecursionLowering at O0 and O2. All
+// but unoptimized naive recursion run on a 64 KiB stack, which proves that
+// they need constant stack. --perf-map and --jitdump describe the JIT'd code
+// to `perf`, e.g. `perf record -k 1 FactorialBenchmark --jitdump` followed
+// by `perf inject --jit` and `perf report`.
+int main(int argc, char *argv[]) {
+    int64_t depth = DEFAULT_DEPTH;
+    SimpleJITCompiler::Options options{};
+
+    for (int arg = 1; arg < argc; ++arg) {
+        llvm::StringRef option{argv[arg]};
+        if (option == "--perf-map") {
+            options.perf_map = true;
+        } else if (option == "--jitdump") {
+            options.perf_jitdump = true;
+        } else if (!option.startswith("-")) {
+            depth = std::max(1LL, std::atoll(argv[arg]));
+        } else {
+            llvm::errs() << "Unknown option " << argv[arg] << "\n";
+            return 1;
+        }
+    }
+
+    PRINT_EXPR(depth);
+    PRINT_EXPR(SMALL_STACK_BYTES);
+
+    llvm::outs() << "lowering  level           n     time(ms)   ns/step  stack"
+                    "      factorial(20)\n";
+
+    int exit_code = 0;
+
+    for (RecursionLowering lowering :
+         {RecursionLowering::Naive, RecursionLowering::TailCall,
+          RecursionLowering::Loop}) {
+        for (OptLevel opt_level : {OptLevel::O0, OptLevel::O2}) {
+            EXIT_ON_ERROR(
+                FactorialResult, result,
+                measureFactorial(lowering, opt_level, depth, options));
+
+            llvm::outs() << llvm::format(
+                "%-8s  %-5s %11lld %12.3f %9.3f  %-10s %20lld",
+                getRecursionLoweringName(lowering).str().c_str(),
+                getOptLevelName(opt_level).str().c_str(),
+                static_cast<long long>(result.depth), result.seconds * 1e3,
+                result.seconds * 1e9 / result.depth,
+                result.small_stack ? "64 KiB" : "n frames",
+                static_cast<long long>(result.check_value));
+
+            if (result.check_value != CHECK_RESULT) {
+                llvm::outs() << "  MISMATCH";
+                exit_code = 1;
+            }
+            llvm::outs() << '\n';
+        }
+    }
+
+    return exit_code;
+}
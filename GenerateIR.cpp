@@ -1,5 +1,14 @@
+#include "CreateObjectFile.hpp"
+#include "DeclareFunction.hpp"
+#include "DefaultTarget.hpp"
+#include "DefineFactorial.hpp"
+#include "KernelCodegen.hpp"
+#include "KernelParser.hpp"
+#include "OptimizationPipeline.hpp"
+#include "WriteObjectFile.hpp"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
@@ -7,22 +16,22 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/LLVMContext.h"
-#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
-#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/Error.h"
 #include "llvm/Support/FileSystem.h"
-#include "llvm/Support/Host.h"
-#include "llvm/Support/TargetRegistry.h"
-#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
-#include "llvm/Target/TargetOptions.h"
 #include <cassert>
-#include <iostream>
+#include <memory>
 #include <string>
 #include <system_error>
+#include <utility>
+#include <vector>
 
 namespace {
 
@@ -31,76 +40,6 @@ llvm::raw_fd_ostream &err_stream = llvm::errs();
 
 } // namespace
 
-constexpr unsigned SMALL_ARITY = 4;
-
-llvm::Function *
-DeclareFunction(llvm::Module &module, const llvm::Twine &func_name,
-                llvm::Type *ret_type,
-                const llvm::SmallVector<llvm::Type *, SMALL_ARITY> &arg_types) {
-    bool isVarArg = false;
-    auto func_linkage = llvm::Function::ExternalLinkage;
-
-    llvm::FunctionType *func_type =
-        llvm::FunctionType::get(ret_type, arg_types, isVarArg);
-
-    return llvm::Function::Create(func_type, func_linkage, func_name, module);
-}
-
-llvm::Function *DefineFactorial(llvm::Module &module) {
-    llvm::LLVMContext &context = module.getContext();
-
-    // Declare functions
-    llvm::Type *long_type = llvm::Type::getInt64Ty(context);
-
-    llvm::Function *factorial =
-        DeclareFunction(module, "factorial", long_type, {long_type});
-
-    // Insert instructions to function
-    llvm::IRBuilder<> inst_builder{context};
-    llvm::Argument *factorial_arg = factorial->getArg(0);
-
-    llvm::BasicBlock *entry_block =
-        llvm::BasicBlock::Create(context, "entry", factorial);
-    llvm::BasicBlock *early_ret_block =
-        llvm::BasicBlock::Create(context, "early_ret", factorial);
-    llvm::BasicBlock *recursive_block =
-        llvm::BasicBlock::Create(context, "recursive", factorial);
-
-    llvm::Constant *zero_int64 =
-        llvm::ConstantInt::get(long_type, 0, /*is_signed*/ true);
-    llvm::Constant *one_int64 =
-        llvm::ConstantInt::get(long_type, 1, /*is_signed*/ true);
-
-    { // Base case
-        inst_builder.SetInsertPoint(entry_block);
-        llvm::Value *base_condition =
-            inst_builder.CreateICmpEQ(factorial_arg, zero_int64);
-        inst_builder.CreateCondBr(base_condition, early_ret_block,
-                                  recursive_block);
-    }
-
-    { // Early Ret block
-        inst_builder.SetInsertPoint(early_ret_block);
-        llvm::Constant *one_int64 =
-            llvm::ConstantInt::get(long_type, 1, /*is_signed*/ true);
-        inst_builder.CreateRet(one_int64);
-    }
-
-    { // Recursive case
-        inst_builder.SetInsertPoint(recursive_block);
-        llvm::Value *decremented_arg =
-            inst_builder.CreateSub(factorial_arg, one_int64);
-        llvm::CallInst *recursive_call =
-            inst_builder.CreateCall(factorial, decremented_arg);
-        llvm::Value *ret_val =
-            inst_builder.CreateMul(factorial_arg, recursive_call);
-        inst_builder.CreateRet(ret_val);
-    }
-
-    assert(!llvm::verifyFunction(*factorial));
-    return factorial;
-}
-
 llvm::Function *DefineMain(llvm::Module &module, llvm::Function *factorial) {
     llvm::LLVMContext &context = module.getContext();
 
@@ -137,58 +76,184 @@ llvm::Function *DefineMain(llvm::Module &module, llvm::Function *factorial) {
     return main_func;
 }
 
-int main() {
-    // Setup the module
-    llvm::LLVMContext context{};
-    llvm::Module module{"factorial", context};
-    const auto default_triple = llvm::sys::getDefaultTargetTriple();
-    module.setTargetTriple(default_triple);
+// Factorial module, or module lowered from a kernel file, to be compiled.
+struct GeneratedModule {
+    std::unique_ptr<llvm::LLVMContext> context;
+    std::unique_ptr<llvm::Module> module;
+    // Member name in an archive
+    std::string object_name;
+};
+
+GeneratedModule GenerateFactorialModule(RecursionLowering recursion) {
+    GeneratedModule generated;
+    generated.context = std::make_unique<llvm::LLVMContext>();
+    generated.module =
+        std::make_unique<llvm::Module>("factorial", *generated.context);
+    generated.module->setTargetTriple(GetDefaultTargetTriple().str());
+    generated.module->setDataLayout(GetDefaultDataLayout());
+    generated.object_name = "factorial.o";
 
     // Define factorial function
-    llvm::Function *factorial = DefineFactorial(module);
-    DefineMain(module, factorial);
+    llvm::Function *factorial = DefineFactorial(*generated.module, recursion);
+    DefineMain(*generated.module, factorial);
+
+    return generated;
+}
+
+llvm::Expected<GeneratedModule> GenerateKernelModule(llvm::StringRef path) {
+    auto file_buffer = llvm::MemoryBuffer::getFile(path);
+    if (!file_buffer)
+        return llvm::createFileError(path, file_buffer.getError());
+
+    auto program = parseKernelProgram((*file_buffer)->getBuffer());
+    if (!program)
+        return llvm::createFileError(path, program.takeError());
+
+    llvm::StringRef stem = llvm::sys::path::stem(path);
+
+    GeneratedModule generated;
+    generated.context = std::make_unique<llvm::LLVMContext>();
+    generated.module = lowerKernelProgram(*program, *generated.context, stem);
+    generated.object_name = (stem + ".o").str();
+
+    return {std::move(generated)};
+}
+
+// Usage: GenerateIR [--recursion=naive|tail|loop] [-O0|-O1|-O2|-O3]
+//                   [--cpu=generic|host] [-j<threads>] [-o <file.o|file.a>]
+//                   [kernel files...]
+//
+// Generates the factorial module, or one module per kernel file (see
+// KernelParser.hpp), and optimizes them. Without -o the IR is printed. With
+// -o the modules are compiled ahead of time, on several threads: a path
+// ending in ".a" receives a static archive of all objects, any other path
+// the object of the only module.
+int main(int argc, char *argv[]) {
+    RecursionLowering recursion = RecursionLowering::Naive;
+    OptLevel opt_level = OptLevel::O0;
+    TargetCPU cpu = TargetCPU::Generic;
+    unsigned thread_count = 0;
+    llvm::StringRef output_path;
+    std::vector<llvm::StringRef> kernel_paths;
+
+    for (int arg = 1; arg < argc; ++arg) {
+        llvm::StringRef option{argv[arg]};
+        bool valid = true;
+
+        if (option == "-o") {
+            if (arg + 1 == argc) {
+                err_stream << "Missing output path after -o\n";
+                return 1;
+            }
+            output_path = argv[++arg];
+        } else if (option.startswith("--recursion=")) {
+            auto parsed_recursion = parseRecursionLowering(
+                option.drop_front(llvm::StringRef{"--recursion="}.size()));
+            valid = parsed_recursion.hasValue();
+            if (valid)
+                recursion = *parsed_recursion;
+        } else if (option == "--cpu=generic" || option == "--cpu=host") {
+            cpu = option == "--cpu=host" ? TargetCPU::Host
+                                         : TargetCPU::Generic;
+        } else if (option.startswith("-j")) {
+            valid = !option.drop_front(2).getAsInteger(10, thread_count);
+        } else if (option.startswith("-O")) {
+            auto parsed_opt_level = parseOptLevel(option.drop_front(1));
+            valid = parsed_opt_level.hasValue();
+            if (valid)
+                opt_level = *parsed_opt_level;
+        } else if (option.startswith("-")) {
+            valid = false;
+        } else {
+            kernel_paths.push_back(option);
+        }
+
+        if (!valid) {
+            err_stream << "Unknown option " << argv[arg] << "\n";
+            return 1;
+        }
+    }
+
+    // Setup the modules
+    std::vector<GeneratedModule> generated_modules;
+    if (kernel_paths.empty())
+        generated_modules.push_back(GenerateFactorialModule(recursion));
+
+    for (llvm::StringRef kernel_path : kernel_paths) {
+        auto generated = GenerateKernelModule(kernel_path);
+        if (!generated) {
+            err_stream << llvm::toString(generated.takeError()) << "\n";
+            return 1;
+        }
+        generated_modules.push_back(std::move(*generated));
+    }
 
     // Create target machine object
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmPrinters();
-    llvm::InitializeAllAsmParsers();
-
-    std::string error;
-    const llvm::Target *registered_target =
-        llvm::TargetRegistry::lookupTarget(default_triple, error);
-    if (registered_target == nullptr) {
-        err_stream << "Lookup error " << error << "\n";
+    llvm::TargetMachine *target_machine = GetDefaultTargetMachine(cpu);
+    if (target_machine == nullptr) {
+        err_stream << "Failed to create target machine from registry\n";
         return 1;
     }
 
-    llvm::TargetOptions opt{};
-    llvm::Optional<llvm::Reloc::Model> rm{llvm::Reloc::PIC_};
-    std::unique_ptr<llvm::TargetMachine> target_machine{
-        registered_target->createTargetMachine(default_triple, "generic", "",
-                                               opt, rm)};
-    if (!target_machine) {
-        err_stream << "Failed to create target machine from registry\n";
+    std::vector<llvm::Module *> modules;
+    for (GeneratedModule &generated : generated_modules) {
+        assert(!llvm::verifyModule(*generated.module, &err_stream));
+        optimizeModule(*generated.module, opt_level, target_machine);
+        modules.push_back(generated.module.get());
+    }
+
+    if (output_path.empty()) {
+        out_stream << "DataLayout "
+                   << GetDefaultDataLayout().getStringRepresentation() << "\n";
+        for (llvm::Module *module : modules)
+            module->print(out_stream, nullptr);
+        return 0;
+    }
+
+    bool write_archive = output_path.endswith(".a");
+    if (!write_archive && modules.size() != 1) {
+        err_stream << "Several modules need an archive (.a) output\n";
         return 1;
     }
 
-    std::cout << "DataLayout "
-              << target_machine->createDataLayout().getStringRepresentation()
-              << std::endl;
-
-    llvm::SmallString<128u> buffer;
-    llvm::raw_svector_ostream output{buffer};
-    llvm::legacy::PassManager pass;
-    bool pass_manager_err = target_machine->addPassesToEmitFile(
-        pass, output, nullptr, llvm::CGFT_ObjectFile);
-    if (pass_manager_err) {
-        err_stream << "Failed to generate object code\n";
+    // Compile ahead of time
+    std::vector<OwningObjectFile> objects(modules.size());
+    llvm::Error compile_err = llvm::Error::success();
+
+    auto err = createObjectFilesFromModules(
+        modules,
+        [&](size_t index, llvm::Expected<OwningObjectFile> object) {
+            if (object)
+                objects[index] = std::move(*object);
+            else
+                compile_err = llvm::joinErrors(std::move(compile_err),
+                                               object.takeError());
+        },
+        cpu, thread_count);
+
+    err = llvm::joinErrors(std::move(err), std::move(compile_err));
+    if (err) {
+        err_stream << "Failed to generate object code: "
+                   << llvm::toString(std::move(err)) << "\n";
+        return 1;
+    }
+
+    std::vector<llvm::MemoryBufferRef> members;
+    for (size_t index = 0; index < objects.size(); ++index) {
+        members.emplace_back(objects[index].getBinary()->getData(),
+                             generated_modules[index].object_name);
+        out_stream << llvm::format("%-24s %10zu bytes\n",
+                                   generated_modules[index].object_name.c_str(),
+                                   members.back().getBufferSize());
+    }
+
+    err = write_archive ? writeStaticArchive(output_path, members)
+                        : writeObjectFile(output_path, members.front());
+    if (err) {
+        err_stream << "Failed to write " << output_path << ": "
+                   << llvm::toString(std::move(err)) << "\n";
         return 1;
     }
 
-    module.setDataLayout(target_machine->createDataLayout());
-    assert(!llvm::verifyModule(module, &err_stream));
-    module.print(llvm::outs(), nullptr);
-    pass.run(module);
+    out_stream << "Wrote " << output_path << "\n";
 }
@@ -0,0 +1,189 @@
+#include "BenchmarkUtils.hpp"
+#include "DefaultTarget.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+constexpr unsigned VECTOR_WIDTH = 16;
+constexpr unsigned POLYNOMIAL_DEGREE = 8;
+constexpr int64_t ELEMENT_COUNT = 4096;
+constexpr unsigned CALLS_PER_RUN = 20000;
+constexpr unsigned RUNS = 5;
+
+// Defines `void poly_eval(const float *in, float *out, int64_t n)` which
+// evaluates a fixed polynomial on <16 x float> chunks. The vector width is
+// spelled out in the IR so that the generated code only depends on the vector
+// ISA the TargetMachine is allowed to use: SSE2 for the generic CPU, AVX2 or
+// AVX-512 for a host-tuned one.
+std::unique_ptr<llvm::Module> DefinePolynomial(llvm::LLVMContext &context) {
+    auto module = std::make_unique<llvm::Module>("poly_eval", context);
+    module->setTargetTriple(GetDefaultTargetTriple().str());
+    module->setDataLayout(GetDefaultDataLayout());
+
+    llvm::Type *void_type = llvm::Type::getVoidTy(context);
+    llvm::Type *float_type = llvm::Type::getFloatTy(context);
+    llvm::Type *float_ptr_type = float_type->getPointerTo();
+    llvm::Type *long_type = llvm::Type::getInt64Ty(context);
+    llvm::VectorType *vector_type =
+        llvm::FixedVectorType::get(float_type, VECTOR_WIDTH);
+
+    llvm::FunctionType *func_type = llvm::FunctionType::get(
+        void_type, {float_ptr_type, float_ptr_type, long_type},
+        /*isVarArg*/ false);
+    llvm::Function *poly_func = llvm::Function::Create(
+        func_type, llvm::Function::ExternalLinkage, "poly_eval", *module);
+
+    llvm::Argument *in_arg = poly_func->getArg(0);
+    llvm::Argument *out_arg = poly_func->getArg(1);
+    llvm::Argument *count_arg = poly_func->getArg(2);
+
+    llvm::BasicBlock *entry_block =
+        llvm::BasicBlock::Create(context, "entry", poly_func);
+    llvm::BasicBlock *loop_block =
+        llvm::BasicBlock::Create(context, "loop", poly_func);
+    llvm::BasicBlock *body_block =
+        llvm::BasicBlock::Create(context, "body", poly_func);
+    llvm::BasicBlock *exit_block =
+        llvm::BasicBlock::Create(context, "exit", poly_func);
+
+    llvm::IRBuilder<> ir_builder{context};
+
+    { // Entry
+        ir_builder.SetInsertPoint(entry_block);
+        ir_builder.CreateBr(loop_block);
+    }
+
+    llvm::PHINode *index = nullptr;
+
+    { // Loop condition
+        ir_builder.SetInsertPoint(loop_block);
+        index = ir_builder.CreatePHI(long_type, 2, "index");
+        index->addIncoming(llvm::ConstantInt::get(long_type, 0), entry_block);
+        llvm::Value *condition = ir_builder.CreateICmpSLT(index, count_arg);
+        ir_builder.CreateCondBr(condition, body_block, exit_block);
+    }
+
+    { // Horner evaluation of one vector
+        ir_builder.SetInsertPoint(body_block);
+        llvm::Value *in_ptr = ir_builder.CreateBitCast(
+            ir_builder.CreateGEP(float_type, in_arg, index),
+            vector_type->getPointerTo());
+        llvm::Value *out_ptr = ir_builder.CreateBitCast(
+            ir_builder.CreateGEP(float_type, out_arg, index),
+            vector_type->getPointerTo());
+
+        llvm::Value *x =
+            ir_builder.CreateAlignedLoad(vector_type, in_ptr, llvm::Align(4));
+
+        llvm::Value *result = llvm::ConstantFP::get(vector_type, 1.0);
+        for (unsigned degree = 1; degree <= POLYNOMIAL_DEGREE; ++degree) {
+            llvm::Constant *coefficient =
+                llvm::ConstantFP::get(vector_type, 1.0 / (degree + 1));
+            result = ir_builder.CreateFAdd(ir_builder.CreateFMul(result, x),
+                                           coefficient);
+        }
+
+        ir_builder.CreateAlignedStore(result, out_ptr, llvm::Align(4));
+
+        llvm::Value *next_index = ir_builder.CreateAdd(
+            index, llvm::ConstantInt::get(long_type, VECTOR_WIDTH));
+        index->addIncoming(next_index, body_block);
+        ir_builder.CreateBr(loop_block);
+    }
+
+    { // Exit
+        ir_builder.SetInsertPoint(exit_block);
+        ir_builder.CreateRetVoid();
+    }
+
+    assert(!llvm::verifyModule(*module, &llvm::errs()));
+    return module;
+}
+
+using poly_func_t = void (*)(const float *, float *, int64_t);
+
+llvm::Expected<poly_func_t> compilePolynomial(SimpleJITCompiler &compiler) {
+    auto context = std::make_unique<llvm::LLVMContext>();
+    std::unique_ptr<llvm::Module> module = DefinePolynomial(*context);
+    std::string module_name = module->getName().str();
+
+    llvm::Error err =
+        compiler.add(module_name, std::move(module), std::move(context));
+    if (err)
+        return {std::move(err)};
+
+    llvm::Expected<llvm::JITEvaluatedSymbol> symbol =
+        compiler.lookup(module_name, "poly_eval");
+    if (!symbol)
+        return symbol.takeError();
+
+    return llvm::jitTargetAddressToPointer<poly_func_t>(symbol->getAddress());
+}
+
+double runPolynomial(poly_func_t poly_func, const std::vector<float> &input,
+                     std::vector<float> &output) {
+    return measureBestOf(RUNS, [&]() {
+        for (unsigned call = 0; call < CALLS_PER_RUN; ++call)
+            poly_func(input.data(), output.data(), ELEMENT_COUNT);
+    });
+}
+
+int main() {
+    SimpleJITCompiler generic_compiler{TargetCPU::Generic};
+    SimpleJITCompiler host_compiler{TargetCPU::Host};
+
+    EXIT_ON_ERROR(poly_func_t, generic_poly,
+                  compilePolynomial(generic_compiler));
+    EXIT_ON_ERROR(poly_func_t, host_poly, compilePolynomial(host_compiler));
+
+    std::vector<float> input(ELEMENT_COUNT);
+    for (int64_t i = 0; i < ELEMENT_COUNT; ++i)
+        input[i] = static_cast<float>(i) / ELEMENT_COUNT;
+
+    std::vector<float> generic_output(ELEMENT_COUNT);
+    std::vector<float> host_output(ELEMENT_COUNT);
+
+    double generic_seconds = runPolynomial(generic_poly, input, generic_output);
+    double host_seconds = runPolynomial(host_poly, input, host_output);
+
+    for (int64_t i = 0; i < ELEMENT_COUNT; ++i) {
+        if (std::fabs(generic_output[i] - host_output[i]) > 1e-4f) {
+            llvm::errs() << "Generic and host results differ at index " << i
+                         << '\n';
+            return 1;
+        }
+    }
+
+    double elements = static_cast<double>(ELEMENT_COUNT) * CALLS_PER_RUN;
+
+    llvm::StringRef host_features = GetTargetCPUFeatures(TargetCPU::Host);
+
+    PRINT_EXPR(GetTargetCPUName(TargetCPU::Host));
+    PRINT_EXPR(host_features.find("+avx2") != llvm::StringRef::npos);
+    PRINT_EXPR(host_features.find("+avx512f") != llvm::StringRef::npos);
+
+    llvm::outs() << "cpu           seconds    Melements/s\n";
+    llvm::outs() << llvm::format("generic  %12.6f %14.1f\n", generic_seconds,
+                                 elements / generic_seconds / 1e6);
+    llvm::outs() << llvm::format("host     %12.6f %14.1f\n", host_seconds,
+                                 elements / host_seconds / 1e6);
+    llvm::outs() << llvm::format("speedup  %.2fx\n",
+                                 generic_seconds / host_seconds);
+}
@@ -1,5 +1,11 @@
+#include "DeclareFunction.hpp"
+#include "DefineFactorial.hpp"
+#include "DiskObjectCache.hpp"
+#include "OptimizationPipeline.hpp"
+#include "SlabMemoryManager.hpp"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
@@ -9,7 +15,6 @@
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/SymbolStringPool.h"
 #include "llvm/ExecutionEngine/Orc/TargetProcessControl.h"
-#include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
@@ -41,75 +46,6 @@ llvm::raw_fd_ostream &err_stream = llvm::errs();
 
 } // namespace
 
-constexpr unsigned SMALL_ARITY = 4;
-
-llvm::Function *
-DeclareFunction(llvm::Module &module, const llvm::Twine &func_name,
-                llvm::Type *ret_type,
-                const llvm::SmallVector<llvm::Type *, SMALL_ARITY> &arg_types) {
-  bool isVarArg = false;
-  auto func_linkage = llvm::Function::ExternalLinkage;
-
-  llvm::FunctionType *func_type =
-      llvm::FunctionType::get(ret_type, arg_types, isVarArg);
-
-  return llvm::Function::Create(func_type, func_linkage, func_name, module);
-}
-
-llvm::Function *DefineFactorial(llvm::Module &module) {
-  llvm::LLVMContext &context = module.getContext();
-
-  // Declare functions
-  llvm::Type *long_type = llvm::Type::getInt64Ty(context);
-
-  llvm::Function *factorial =
-      DeclareFunction(module, "factorial", long_type, {long_type});
-
-  // Insert instructions to function
-  llvm::IRBuilder<> inst_builder{context};
-  llvm::Argument *factorial_arg = factorial->getArg(0);
-
-  llvm::BasicBlock *entry_block =
-      llvm::BasicBlock::Create(context, "entry", factorial);
-  llvm::BasicBlock *early_ret_block =
-      llvm::BasicBlock::Create(context, "early_ret", factorial);
-  llvm::BasicBlock *recursive_block =
-      llvm::BasicBlock::Create(context, "recursive", factorial);
-
-  llvm::Constant *zero_int64 =
-      llvm::ConstantInt::get(long_type, 0, /*is_signed*/ true);
-  llvm::Constant *one_int64 =
-      llvm::ConstantInt::get(long_type, 1, /*is_signed*/ true);
-
-  { // Base case
-    inst_builder.SetInsertPoint(entry_block);
-    llvm::Value *base_condition =
-        inst_builder.CreateICmpEQ(factorial_arg, zero_int64);
-    inst_builder.CreateCondBr(base_condition, early_ret_block, recursive_block);
-  }
-
-  { // Early Ret block
-    inst_builder.SetInsertPoint(early_ret_block);
-    llvm::Constant *one_int64 =
-        llvm::ConstantInt::get(long_type, 1, /*is_signed*/ true);
-    inst_builder.CreateRet(one_int64);
-  }
-
-  { // Recursive case
-    inst_builder.SetInsertPoint(recursive_block);
-    llvm::Value *decremented_arg =
-        inst_builder.CreateSub(factorial_arg, one_int64);
-    llvm::CallInst *recursive_call =
-        inst_builder.CreateCall(factorial, decremented_arg);
-    llvm::Value *ret_val =
-        inst_builder.CreateMul(factorial_arg, recursive_call);
-    inst_builder.CreateRet(ret_val);
-  }
-
-  assert(!llvm::verifyFunction(*factorial));
-  return factorial;
-}
-
 llvm::Function *DefineMain(llvm::Module &module, llvm::Function *factorial) {
   llvm::LLVMContext &context = module.getContext();
 
@@ -158,7 +94,28 @@ void initialize_all() {
   return (void)initialized;
 }
 
-int main() {
+// Usage: JitCompile [--recursion=naive|tail|loop] [-O0|-O1|-O2|-O3]
+int main(int argc, char *argv[]) {
+  RecursionLowering recursion = RecursionLowering::Naive;
+  OptLevel opt_level = OptLevel::O0;
+
+  for (int arg = 1; arg < argc; ++arg) {
+    llvm::StringRef option{argv[arg]};
+    llvm::Optional<RecursionLowering> parsed_recursion;
+    llvm::Optional<OptLevel> parsed_opt_level;
+
+    if (option.consume_front("--recursion=") &&
+        (parsed_recursion = parseRecursionLowering(option))) {
+      recursion = *parsed_recursion;
+    } else if (option.consume_front("-") &&
+               (parsed_opt_level = parseOptLevel(option))) {
+      opt_level = *parsed_opt_level;
+    } else {
+      std::cerr << "Unknown option " << argv[arg] << std::endl;
+      return 1;
+    }
+  }
+
   // Initialize compilation targets
   initialize_all();
 
@@ -169,7 +126,7 @@ int main() {
   module->setTargetTriple(default_triple);
 
   // Define factorial function
-  llvm::Function *factorial = DefineFactorial(*module);
+  llvm::Function *factorial = DefineFactorial(*module, recursion);
   DefineMain(*module, factorial);
 
   // Setup JIT layers
@@ -187,12 +144,28 @@ int main() {
   auto execution_session =
       std::make_unique<llvm::orc::ExecutionSession>(std::move(symbol_pool));
 
+  // Pack the code and data of all objects into shared slabs
+  JITMemoryPool memory_pool;
   llvm::orc::RTDyldObjectLinkingLayer object_layer{
       *execution_session,
-      []() { return std::make_unique<llvm::SectionMemoryManager>(); }};
+      [&memory_pool]() {
+        return std::make_unique<SlabMemoryManager>(memory_pool);
+      }};
+
+  // Reuse objects compiled by earlier runs
+  auto cache_target_machine = jit_machine_builder.createTargetMachine();
+  if (!cache_target_machine) {
+    std::cerr << "Can not create target machine for object cache\n";
+    return 1;
+  }
+
+  optimizeModule(*module, opt_level, cache_target_machine->get());
+
+  DiskObjectCache object_cache{GetDefaultObjectCacheDirectory(),
+                               **cache_target_machine};
 
   auto ir_compiler = std::make_unique<llvm::orc::ConcurrentIRCompiler>(
-      std::move(jit_machine_builder));
+      std::move(jit_machine_builder), &object_cache);
 
   llvm::orc::IRCompileLayer orc_compile_layer{*execution_session, object_layer,
                                               std::move(ir_compiler)};
@@ -245,4 +218,7 @@ int main() {
     execution_session->reportError(std::move(err));
     return 1;
   }
+
+  object_cache.printStatistics(llvm::outs());
+  memory_pool.printStatistics(llvm::outs());
 }
@@ -0,0 +1,204 @@
+#include "BenchmarkUtils.hpp"
+#include "KernelCodegen.hpp"
+#include "KernelInterpreter.hpp"
+#include "KernelParser.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+constexpr unsigned CALLS_PER_FUNCTION = 20000;
+constexpr unsigned CALL_REPETITIONS = 3;
+
+constexpr const char *DEFAULT_PROGRAM = R"(
+# Horner-scheme cubic
+def poly(x) { return ((0.5 * x + 1.5) * x - 2) * x + 3; }
+
+# Escape iterations of the Mandelbrot sequence at (cx, cy)
+def mandel(cx, cy) {
+    var x = 0; var y = 0; var i = 0;
+    while i < 64 && x * x + y * y <= 4 {
+        var t = x * x - y * y + cx - 1.5;
+        y = 2 * x * y + cy - 1;
+        x = t;
+        i = i + 1;
+    }
+    return i;
+}
+
+# Error of Newton's square root after a fixed number of steps
+def newton(a) {
+    var x = max(a, 1);
+    var step = 0;
+    while step < 16 { x = 0.5 * (x + a / x); step = step + 1; }
+    return abs(x - sqrt(a));
+}
+
+# Steps of the Collatz sequence from the integer part of n + 1
+def collatz(n) {
+    n = abs(n - n % 1) + 1;
+    var steps = 0;
+    while n != 1 {
+        if n % 2 == 0 { n = n / 2; } else { n = 3 * n + 1; }
+        steps = steps + 1;
+    }
+    return steps;
+}
+
+def distance(x, y) { return sqrt(square(x) + square(y)); }
+def square(x) { return x * x; }
+)";
+
+// Argument `param` of call `call`, cycling through a small range.
+double getArgument(unsigned call, size_t param) {
+    return (call % 64) * 0.25 + param * 0.5;
+}
+
+// Calls a JIT-compiled kernel with up to SMALL_ARITY arguments.
+double callCompiled(uint64_t address, llvm::ArrayRef<double> args) {
+    switch (args.size()) {
+    case 0:
+        return llvm::jitTargetAddressToFunction<double (*)()>(address)();
+    case 1:
+        return llvm::jitTargetAddressToFunction<double (*)(double)>(address)(
+            args[0]);
+    case 2:
+        return llvm::jitTargetAddressToFunction<double (*)(double, double)>(
+            address)(args[0], args[1]);
+    case 3:
+        return llvm::jitTargetAddressToFunction<double (*)(double, double,
+                                                           double)>(address)(
+            args[0], args[1], args[2]);
+    default:
+        return llvm::jitTargetAddressToFunction<double (*)(
+            double, double, double, double)>(address)(args[0], args[1],
+                                                      args[2], args[3]);
+    }
+}
+
+// Runs `call` over CALLS_PER_FUNCTION argument lists, returns the sum of
+// the results and stores the best time per call to `nanoseconds`.
+template <typename Call>
+double measureCalls(size_t param_count, double &nanoseconds, Call &&call) {
+    double checksum = 0.0;
+    llvm::SmallVector<double, SMALL_ARITY> args(param_count);
+
+    double seconds = measureBestOf(CALL_REPETITIONS, [&]() {
+        checksum = 0.0;
+        for (unsigned index = 0; index < CALLS_PER_FUNCTION; ++index) {
+            for (size_t param = 0; param < param_count; ++param)
+                args[param] = getArgument(index, param);
+            checksum += call(args);
+        }
+    });
+
+    nanoseconds = seconds * 1e9 / CALLS_PER_FUNCTION;
+    return checksum;
+}
+
+// Usage: KernelBenchmark [file]
+//
+// Parses a kernel program (a built-in one by default), JIT-compiles it and
+// calls every function with up to four parameters through the JIT and
+// through the interpreter, checking that both agree.
+int main(int argc, char *argv[]) {
+    std::string source{DEFAULT_PROGRAM};
+    if (argc > 1) {
+        auto file_buffer = llvm::MemoryBuffer::getFile(argv[1]);
+        if (!file_buffer) {
+            llvm::errs() << "Cannot read " << argv[1] << ": "
+                         << file_buffer.getError().message() << '\n';
+            return 1;
+        }
+        source = (*file_buffer)->getBuffer().str();
+    }
+
+    KernelProgram program;
+    double parse_seconds = measureSeconds([&]() {
+        auto parsed_program = parseKernelProgram(source);
+        if (!parsed_program) {
+            llvm::errs() << "Parse error: "
+                         << llvm::toString(parsed_program.takeError()) << '\n';
+            std::exit(1);
+        }
+        program = std::move(*parsed_program);
+    });
+
+    SimpleJITCompiler compiler{TargetCPU::Host};
+    std::vector<llvm::JITEvaluatedSymbol> symbols;
+
+    double compile_seconds = measureSeconds([&]() {
+        auto context = std::make_unique<llvm::LLVMContext>();
+        auto module = lowerKernelProgram(program, *context, "kernels");
+        if (auto err = compiler.add("kernels", std::move(module),
+                                    std::move(context), OptLevel::O2)) {
+            llvm::errs() << llvm::toString(std::move(err)) << '\n';
+            std::exit(1);
+        }
+
+        for (const KernelFunction &function : program.functions) {
+            auto symbol = compiler.lookup("kernels", function.name);
+            if (!symbol) {
+                llvm::errs() << llvm::toString(symbol.takeError()) << '\n';
+                std::exit(1);
+            }
+            symbols.push_back(*symbol);
+        }
+    });
+
+    PRINT_EXPR(program.functions.size());
+    llvm::outs() << llvm::format("parse %.3f ms, lower + compile %.3f ms\n",
+                                 parse_seconds * 1e3, compile_seconds * 1e3);
+
+    llvm::outs() << "function          interpreter(ns)     jit(ns)  speedup\n";
+
+    KernelInterpreter interpreter{program};
+    int exit_code = 0;
+
+    for (size_t index = 0; index < program.functions.size(); ++index) {
+        const KernelFunction &function = program.functions[index];
+        if (function.param_count > SMALL_ARITY)
+            continue;
+
+        double interpreted_nanoseconds = 0.0;
+        double interpreted_checksum = measureCalls(
+            function.param_count, interpreted_nanoseconds,
+            [&](llvm::ArrayRef<double> args) {
+                return interpreter.call(index, args);
+            });
+
+        double compiled_nanoseconds = 0.0;
+        double compiled_checksum = measureCalls(
+            function.param_count, compiled_nanoseconds,
+            [&](llvm::ArrayRef<double> args) {
+                return callCompiled(symbols[index].getAddress(), args);
+            });
+
+        llvm::outs() << llvm::format(
+            "%-16s %16.1f %11.1f %8.1fx", function.name.c_str(),
+            interpreted_nanoseconds, compiled_nanoseconds,
+            interpreted_nanoseconds / compiled_nanoseconds);
+
+        if (interpreted_checksum != compiled_checksum) {
+            llvm::outs() << llvm::format("  MISMATCH %g != %g",
+                                         interpreted_checksum,
+                                         compiled_checksum);
+            exit_code = 1;
+        }
+        llvm::outs() << '\n';
+    }
+
+    return exit_code;
+}
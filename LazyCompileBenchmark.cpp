@@ -0,0 +1,102 @@
+#include "BenchmarkUtils.hpp"
+#include "BenchmarkWorkloads.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+
+constexpr unsigned DEFAULT_FUNCTION_COUNT = 400;
+constexpr unsigned HOT_FUNCTION_COUNT = 4;
+
+struct StartupResult {
+    double seconds = 0.0;
+    uint64_t resident_bytes = 0;
+    double checksum = 0.0;
+};
+
+// Adds one module with `function_count` functions, then looks up and calls
+// only the first few of them, as a caller with a handful of hot kernels would.
+llvm::Expected<StartupResult> measureStartup(bool lazy,
+                                             unsigned function_count) {
+    SimpleJITCompiler::Options options{};
+    options.lazy = lazy;
+    SimpleJITCompiler compiler{options};
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    std::unique_ptr<llvm::Module> module =
+        DefineWorkModule(*context, "lazy_work", function_count);
+
+    uint64_t resident_before = getResidentMemoryBytes();
+    StartupResult result{};
+    llvm::Error err = llvm::Error::success();
+
+    result.seconds = measureSeconds([&]() {
+        err = llvm::joinErrors(std::move(err),
+                               compiler.add("lazy_work", std::move(module),
+                                            std::move(context), OptLevel::O2));
+        if (err)
+            return;
+
+        using work_func_t = double (*)(double, int64_t);
+
+        for (unsigned index = 0; index < HOT_FUNCTION_COUNT; ++index) {
+            auto symbol = compiler.lookup(
+                "lazy_work", "lazy_work_" + std::to_string(index));
+            if (!symbol) {
+                err = symbol.takeError();
+                return;
+            }
+
+            auto work_func = llvm::jitTargetAddressToPointer<work_func_t>(
+                symbol->getAddress());
+            result.checksum += work_func(1.0, 16);
+        }
+    });
+
+    if (err)
+        return {std::move(err)};
+
+    result.resident_bytes = getResidentMemoryBytes() - resident_before;
+    return result;
+}
+
+// Usage: LazyCompileBenchmark [eager|lazy] [function count]
+// Running a single mode per process keeps the resident memory numbers from
+// being skewed by memory freed by the other mode.
+int main(int argc, char *argv[]) {
+    llvm::StringRef mode = argc > 1 ? argv[1] : "both";
+    unsigned function_count = DEFAULT_FUNCTION_COUNT;
+    if (argc > 2)
+        function_count = std::max(HOT_FUNCTION_COUNT,
+                                  static_cast<unsigned>(std::atoi(argv[2])));
+
+    PRINT_EXPR(function_count);
+    PRINT_EXPR(HOT_FUNCTION_COUNT);
+
+    llvm::outs() << "mode    first-call(ms)   resident(KiB)\n";
+
+    for (bool lazy : {false, true}) {
+        if ((lazy && mode == "eager") || (!lazy && mode == "lazy"))
+            continue;
+
+        EXIT_ON_ERROR(StartupResult, result,
+                      measureStartup(lazy, function_count));
+
+        doNotOptimize(result.checksum);
+        llvm::outs() << llvm::format("%-6s %15.2f %15llu\n",
+                                     lazy ? "lazy" : "eager",
+                                     result.seconds * 1e3,
+                                     static_cast<unsigned long long>(
+                                         result.resident_bytes / 1024));
+    }
+}
@@ -0,0 +1,143 @@
+#include "BenchmarkUtils.hpp"
+#include "BenchmarkWorkloads.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+constexpr unsigned DEFAULT_MODULE_COUNT = 64;
+constexpr unsigned FUNCTIONS_PER_MODULE = 8;
+constexpr unsigned CALLS_PER_FUNCTION = 100000;
+constexpr unsigned CALL_REPETITIONS = 5;
+
+using WorkFunction = double(double, int64_t);
+
+struct BackendResult {
+    double total_seconds = 0.0;
+    double link_seconds = 0.0;
+    double nanoseconds_per_call = 0.0;
+};
+
+const char *getLinkerName(SimpleJITCompiler::Linker linker) {
+    return linker == SimpleJITCompiler::Linker::JITLink ? "JITLink"
+                                                        : "RuntimeDyld";
+}
+
+// Materializes the same generated modules with `linker` and calls every
+// function in turn. Linking is not a separate stage of the compiler, so its
+// time is the wall-clock time of add + lookup minus the optimize and codegen
+// times the compiler recorded.
+llvm::Expected<BackendResult> measureBackend(SimpleJITCompiler::Linker linker,
+                                             unsigned module_count) {
+    SimpleJITCompiler::Options options{};
+    options.linker = linker;
+    SimpleJITCompiler compiler{options};
+
+    std::vector<std::string> module_names;
+    std::vector<std::string> symbol_names;
+    std::vector<std::unique_ptr<llvm::LLVMContext>> contexts;
+    std::vector<std::unique_ptr<llvm::Module>> modules;
+    std::vector<std::pair<std::string_view, std::string_view>> requests;
+
+    // Modules are built up front, so that IR construction does not count as
+    // link time
+    for (unsigned index = 0; index < module_count; ++index) {
+        module_names.push_back("work_" + std::to_string(index));
+        contexts.push_back(std::make_unique<llvm::LLVMContext>());
+        modules.push_back(DefineWorkModule(*contexts.back(),
+                                           module_names.back(),
+                                           FUNCTIONS_PER_MODULE, index));
+    }
+    for (const std::string &module_name : module_names) {
+        for (unsigned func = 0; func < FUNCTIONS_PER_MODULE; ++func)
+            symbol_names.push_back(module_name + "_" + std::to_string(func));
+    }
+    for (size_t index = 0; index < symbol_names.size(); ++index)
+        requests.emplace_back(module_names[index / FUNCTIONS_PER_MODULE],
+                              symbol_names[index]);
+
+    BackendResult result;
+    llvm::Error err = llvm::Error::success();
+    std::vector<llvm::JITEvaluatedSymbol> symbols;
+
+    result.total_seconds = measureSeconds([&]() {
+        for (unsigned index = 0; index < module_count && !err; ++index)
+            err = compiler.add(module_names[index], std::move(modules[index]),
+                               std::move(contexts[index]), OptLevel::O2);
+        if (err)
+            return;
+
+        auto looked_up = compiler.lookup(requests);
+        if (!looked_up)
+            err = looked_up.takeError();
+        else
+            symbols = std::move(*looked_up);
+    });
+
+    if (err)
+        return {std::move(err)};
+
+    std::chrono::nanoseconds compile_time{0};
+    for (const std::string &module_name : module_names) {
+        SimpleJITCompiler::StageTimings timings =
+            compiler.getStageTimings(module_name);
+        compile_time += timings.optimize + timings.codegen;
+    }
+    result.link_seconds =
+        std::max(0.0, result.total_seconds - compile_time.count() / 1e9);
+
+    std::vector<WorkFunction *> functions;
+    for (const llvm::JITEvaluatedSymbol &symbol : symbols)
+        functions.push_back(
+            llvm::jitTargetAddressToFunction<WorkFunction *>(
+                symbol.getAddress()));
+
+    double call_seconds = measureBestOf(CALL_REPETITIONS, [&]() {
+        double checksum = 0.0;
+        for (unsigned call = 0; call < CALLS_PER_FUNCTION; ++call) {
+            for (WorkFunction *function : functions)
+                checksum += function(1.0, 1);
+        }
+        doNotOptimize(checksum);
+    });
+    result.nanoseconds_per_call =
+        call_seconds * 1e9 / (double{CALLS_PER_FUNCTION} * functions.size());
+
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned module_count = DEFAULT_MODULE_COUNT;
+    if (argc > 1)
+        module_count = std::max(1, std::atoi(argv[1]));
+
+    PRINT_EXPR(module_count);
+    PRINT_EXPR(FUNCTIONS_PER_MODULE);
+
+    llvm::outs() << "linker        total(ms)   link(ms)  link/module(us)"
+                    "   call(ns)\n";
+
+    for (auto linker : {SimpleJITCompiler::Linker::RuntimeDyld,
+                        SimpleJITCompiler::Linker::JITLink}) {
+        EXIT_ON_ERROR(BackendResult, result,
+                      measureBackend(linker, module_count));
+
+        llvm::outs() << llvm::format(
+            "%-12s %10.2f %10.2f %16.2f %10.2f\n", getLinkerName(linker),
+            result.total_seconds * 1e3, result.link_seconds * 1e3,
+            result.link_seconds * 1e6 / module_count,
+            result.nanoseconds_per_call);
+    }
+}
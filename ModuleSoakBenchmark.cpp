@@ -0,0 +1,116 @@
+#include "BenchmarkUtils.hpp"
+#include "BenchmarkWorkloads.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+constexpr unsigned DEFAULT_MODULE_COUNT = 100000;
+constexpr unsigned LIVE_MODULES = 16;
+constexpr unsigned REPORT_INTERVAL = 10000;
+
+using WorkFunction = double(double, int64_t);
+
+// Keeps LIVE_MODULES modules alive while cycling `module_count` freshly
+// generated modules through them: every iteration replaces the oldest module,
+// calls into the new one and the cycle ends by removing all of them. The
+// memory pool statistics printed at the end show whether the code pages of
+// removed modules were reclaimed.
+//
+// Every module gets a name of its own, so that a lookup can never be served
+// by a module that was removed before. Each distinct name leaves an empty
+// JITDylib and an interned string in the session behind, so resident memory
+// keeps growing with the module count even when code pages are reclaimed.
+int main(int argc, char *argv[]) {
+    unsigned module_count = DEFAULT_MODULE_COUNT;
+    if (argc > 1)
+        module_count = std::max(1, std::atoi(argv[1]));
+
+    PRINT_EXPR(module_count);
+    PRINT_EXPR(LIVE_MODULES);
+
+    SimpleJITCompiler compiler{};
+
+    // Name of the module living in each slot, empty until it is first used
+    std::vector<std::string> slot_names(LIVE_MODULES);
+
+    uint64_t baseline_rss = 0;
+    double checksum = 0.0;
+
+    llvm::outs() << "   modules    seconds   modules/s      rss(KiB)\n";
+
+    auto start = BenchmarkClock::now();
+    for (unsigned index = 0; index < module_count; ++index) {
+        std::string &module_name = slot_names[index % LIVE_MODULES];
+
+        llvm::Error err = module_name.empty() ? llvm::Error::success()
+                                              : compiler.remove(module_name);
+
+        module_name = "soak_" + std::to_string(index);
+        std::string symbol_name = module_name + "_0";
+
+        if (!err) {
+            auto context = std::make_unique<llvm::LLVMContext>();
+            auto module =
+                DefineWorkModule(*context, module_name, /*function_count*/ 1,
+                                 /*seed*/ index);
+            err = compiler.add(module_name, std::move(module),
+                               std::move(context));
+        }
+        if (err) {
+            llvm::errs() << "ERROR: " << llvm::toString(std::move(err)) << '\n';
+            return 1;
+        }
+
+        EXIT_ON_ERROR(WorkFunction *, work,
+                      compiler.lookupFunction<WorkFunction>(module_name,
+                                                            symbol_name));
+        checksum += work(1.0, 1);
+
+        unsigned completed = index + 1;
+        if (completed == LIVE_MODULES)
+            baseline_rss = getResidentMemoryBytes();
+
+        if (completed % REPORT_INTERVAL == 0 || completed == module_count) {
+            std::chrono::duration<double> elapsed =
+                BenchmarkClock::now() - start;
+            llvm::outs() << llvm::format(
+                "%10u %10.2f %11.1f %13llu\n", completed, elapsed.count(),
+                completed / elapsed.count(),
+                static_cast<unsigned long long>(getResidentMemoryBytes() /
+                                                1024));
+        }
+    }
+
+    for (const std::string &module_name : slot_names) {
+        if (module_name.empty())
+            continue;
+
+        llvm::Error err = compiler.remove(module_name);
+        if (err) {
+            llvm::errs() << "ERROR: " << llvm::toString(std::move(err)) << '\n';
+            return 1;
+        }
+    }
+
+    doNotOptimize(checksum);
+    compiler.getMemoryPool().printStatistics(llvm::outs());
+
+    uint64_t final_rss = getResidentMemoryBytes();
+    llvm::outs() << llvm::format(
+        "rss after %u modules: %llu KiB, after all removed: %llu KiB, "
+        "growth: %lld KiB\n",
+        LIVE_MODULES, static_cast<unsigned long long>(baseline_rss / 1024),
+        static_cast<unsigned long long>(final_rss / 1024),
+        static_cast<long long>(final_rss / 1024) -
+            static_cast<long long>(baseline_rss / 1024));
+}
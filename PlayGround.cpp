@@ -1,11 +1,16 @@
+#include "RecordWriter.hpp"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringRef.h"
-#include "llvm/IR/LLVMContext.h"
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/Object/ObjectFile.h"
 #include "llvm/Object/SymbolicFile.h"
+#include "llvm/Support/Casting.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
+#include <cstdint>
 #include <iostream>
 #include <memory>
-#include <tuple>
 #include <utility>
 
 #define PRINT_EXPR(expr) std::cout << #expr << " = " << (expr) << std::endl;
@@ -16,29 +21,28 @@ using OwningSymbolicFile =
 llvm::Expected<OwningSymbolicFile>
 createSymbolicFileFromSource(llvm::StringRef file_path) {
 
-    llvm::LLVMContext context{};
-
-    // Create Binary File from source
-    std::unique_ptr<llvm::object::Binary> binary_file;
+    // Map the file once and parse it in place
     std::unique_ptr<llvm::MemoryBuffer> file_buffer;
 
     {
-        auto expected_binary_file = llvm::object::createBinary(
-            file_path, &context, /*initContent*/ true);
+        auto expected_file_buffer = llvm::MemoryBuffer::getFile(
+            file_path, /*FileSize*/ -1, /*RequiresNullTerminator*/ false);
 
-        if (!expected_binary_file) {
-            return {expected_binary_file.takeError()};
+        if (!expected_file_buffer) {
+            return {llvm::errorCodeToError(expected_file_buffer.getError())};
         }
 
-        std::tie(binary_file, file_buffer) = expected_binary_file->takeBinary();
+        file_buffer = std::move(expected_file_buffer.get());
     }
 
-    // Create SymbolicFile from Binary
+    // Create SymbolicFile from the mapping
     std::unique_ptr<llvm::object::SymbolicFile> symbolic_file;
 
     {
         auto expected_symbolic_file =
-            llvm::object::SymbolicFile::createSymbolicFile(*file_buffer);
+            llvm::object::SymbolicFile::createSymbolicFile(
+                file_buffer->getMemBufferRef(), llvm::file_magic::unknown,
+                /*Context*/ nullptr);
 
         if (!expected_symbolic_file) {
             return {expected_symbolic_file.takeError()};
@@ -50,14 +54,85 @@ createSymbolicFileFromSource(llvm::StringRef file_path) {
     return OwningSymbolicFile{std::move(symbolic_file), std::move(file_buffer)};
 }
 
-int main() {
+// Writes one record per symbol of `symbolic_file`. Addresses are only known
+// for object files.
+llvm::Error
+writeSymbolRecords(RecordWriter &writer,
+                   const llvm::object::SymbolicFile &symbolic_file) {
+    const auto *object_file =
+        llvm::dyn_cast<llvm::object::ObjectFile>(&symbolic_file);
+
+    llvm::SmallString<128> name;
+    for (const auto &symbol : symbolic_file.symbols()) {
+        name.clear();
+        llvm::raw_svector_ostream name_stream{name};
+        if (auto err = symbol.printName(name_stream))
+            return err;
+
+        auto flags = symbol.getFlags();
+        if (!flags)
+            return flags.takeError();
+
+        uint64_t address = 0;
+        if (object_file != nullptr) {
+            llvm::object::SymbolRef object_symbol{symbol.getRawDataRefImpl(),
+                                                  object_file};
+            if (auto symbol_address = object_symbol.getAddress())
+                address = *symbol_address;
+            else
+                llvm::consumeError(symbol_address.takeError());
+        }
+
+        writer.writeSymbol(name, address, *flags);
+    }
+
+    return llvm::Error::success();
+}
+
+// Usage: PlayGround [--format=text|ndjson|binary] [file]
+int main(int argc, char *argv[]) {
+    OutputFormat format = OutputFormat::Text;
     llvm::StringRef file_path{"build-Debug/PlayGround"};
 
+    for (int arg = 1; arg < argc; ++arg) {
+        llvm::StringRef option{argv[arg]};
+
+        if (option.consume_front("--format=")) {
+            auto parsed_format = parseOutputFormat(option);
+            if (!parsed_format) {
+                llvm::errs() << "Unknown output format " << option << '\n';
+                return 1;
+            }
+            format = *parsed_format;
+        } else {
+            file_path = option;
+        }
+    }
+
     OwningSymbolicFile owned_symbolic_file =
         llvm::cantFail(createSymbolicFileFromSource(file_path));
 
     llvm::object::SymbolicFile *symbolic_file = owned_symbolic_file.getBinary();
 
+    // Write symbol records through a large buffer
+    if (format != OutputFormat::Text) {
+        auto record_sink = openRecordSink("-");
+        if (!record_sink) {
+            llvm::errs() << llvm::toString(record_sink.takeError()) << '\n';
+            return 1;
+        }
+
+        RecordWriter record_writer{**record_sink, format};
+        record_writer.writeHeader();
+        record_writer.beginFile(file_path);
+
+        if (auto err = writeSymbolRecords(record_writer, *symbolic_file)) {
+            llvm::errs() << llvm::toString(std::move(err)) << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
     // Print all symbol
     llvm::Error err = llvm::Error::success();
 
@@ -69,7 +144,7 @@ int main() {
     }
 
     if (err) {
-        llvm::errs() << err << '\n';
+        llvm::errs() << llvm::toString(std::move(err)) << '\n';
         return 1;
     }
 }
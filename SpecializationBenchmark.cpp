@@ -0,0 +1,199 @@
+#include "BenchmarkUtils.hpp"
+#include "BenchmarkWorkloads.hpp"
+#include "DefineFactorial.hpp"
+#include "FunctionSpecializer.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+constexpr uint64_t DEFAULT_CALL_COUNT = 1000000;
+constexpr unsigned REPETITIONS = 5;
+constexpr int64_t FACTORIAL_ARGUMENT = 20;
+constexpr int64_t ITERATIONS_PER_CALL = 4;
+constexpr double WORK_ARGUMENT = 1.5;
+
+using FactorialFunction = int64_t(int64_t);
+using WorkFunction = double(double, int64_t);
+
+// A function called `call_count` times with the same bound arguments, once
+// through the generic O3 code and once through its specialization.
+struct SpecializationCase {
+    const char *name;
+    const char *function_name;
+    std::vector<ArgumentBinding> bindings;
+    // Calls the function at `address` `call_count` times and sums the results
+    std::function<double(uint64_t address, uint64_t call_count)> run;
+};
+
+std::vector<SpecializationCase> createCases() {
+    auto run_factorial = [](uint64_t address, uint64_t call_count) {
+        auto *factorial = reinterpret_cast<FactorialFunction *>(address);
+        double sum = 0.0;
+        for (uint64_t call = 0; call < call_count; ++call) {
+            int64_t n = FACTORIAL_ARGUMENT;
+            doNotOptimize(n);
+            sum += static_cast<double>(factorial(n));
+        }
+        return sum;
+    };
+
+    auto run_work = [](uint64_t address, uint64_t call_count) {
+        auto *work = reinterpret_cast<WorkFunction *>(address);
+        double sum = 0.0;
+        for (uint64_t call = 0; call < call_count; ++call) {
+            double x = WORK_ARGUMENT;
+            int64_t n = ITERATIONS_PER_CALL;
+            doNotOptimize(x);
+            doNotOptimize(n);
+            sum += work(x, n);
+        }
+        return sum;
+    };
+
+    return {
+        {"factorial(n)", "factorial", {bindInteger(0, FACTORIAL_ARGUMENT)},
+         run_factorial},
+        {"work(x, n)", "spec_work_0", {bindInteger(1, ITERATIONS_PER_CALL)},
+         run_work},
+        {"work(x, n) all",
+         "spec_work_0",
+         {bindFloatingPoint(0, WORK_ARGUMENT),
+          bindInteger(1, ITERATIONS_PER_CALL)},
+         run_work},
+    };
+}
+
+struct SpecializationResult {
+    double compile_seconds = 0.0;
+    double cached_seconds = 0.0;
+    double generic_seconds = 0.0;
+    double specialized_seconds = 0.0;
+    bool matches = false;
+};
+
+// Specializes the function of `specialization_case` in the source
+// "spec_work", which is also added to `compiler` as is, and times its calls
+// against calls of the generic function.
+llvm::Expected<SpecializationResult>
+measureCase(SimpleJITCompiler &compiler, FunctionSpecializer &specializer,
+            const SpecializationCase &specialization_case,
+            uint64_t call_count) {
+    auto generic_symbol =
+        compiler.lookup("spec_work", specialization_case.function_name);
+    if (!generic_symbol)
+        return generic_symbol.takeError();
+
+    SpecializationResult result{};
+    llvm::JITEvaluatedSymbol specialized_symbol;
+    llvm::Error err = llvm::Error::success();
+
+    result.compile_seconds = measureSeconds([&]() {
+        auto symbol = specializer.specialize(
+            "spec_work", specialization_case.function_name,
+            specialization_case.bindings);
+        if (symbol)
+            specialized_symbol = *symbol;
+        else
+            err = llvm::joinErrors(std::move(err), symbol.takeError());
+    });
+    if (err)
+        return {std::move(err)};
+
+    result.cached_seconds = measureBestOf(REPETITIONS, [&]() {
+        auto symbol = specializer.specialize(
+            "spec_work", specialization_case.function_name,
+            specialization_case.bindings);
+        if (!symbol)
+            err = llvm::joinErrors(std::move(err), symbol.takeError());
+        else
+            doNotOptimize(symbol->getAddress());
+    });
+    if (err)
+        return {std::move(err)};
+
+    double generic_sum = 0.0;
+    result.generic_seconds = measureBestOf(REPETITIONS, [&]() {
+        generic_sum =
+            specialization_case.run(generic_symbol->getAddress(), call_count);
+    });
+
+    double specialized_sum = 0.0;
+    result.specialized_seconds = measureBestOf(REPETITIONS, [&]() {
+        specialized_sum = specialization_case.run(
+            specialized_symbol.getAddress(), call_count);
+    });
+
+    result.matches = specialized_sum == generic_sum;
+    return result;
+}
+
+// Usage: SpecializationBenchmark [call count]
+//
+// Specializes the loop factorial and a work function on constant arguments
+// and compares calls of the specializations with calls of the generic code,
+// both compiled at O3. Also reports the compile time of a specialization and
+// the cost of requesting it again from the cache.
+int main(int argc, char *argv[]) {
+    uint64_t call_count = DEFAULT_CALL_COUNT;
+    if (argc > 1)
+        call_count = std::strtoull(argv[1], nullptr, 10);
+
+    PRINT_EXPR(call_count);
+    PRINT_EXPR(FACTORIAL_ARGUMENT);
+    PRINT_EXPR(ITERATIONS_PER_CALL);
+
+    SimpleJITCompiler compiler{};
+    FunctionSpecializer specializer{compiler};
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    std::unique_ptr<llvm::Module> module =
+        DefineWorkModule(*context, "spec_work", 1);
+    DefineFactorial(*module, RecursionLowering::Loop);
+
+    llvm::Error err = specializer.addSource("spec_work", *module);
+    if (!err)
+        err = compiler.add("spec_work", std::move(module), std::move(context),
+                           OptLevel::O3);
+    if (err) {
+        llvm::errs() << "ERROR: " << llvm::toString(std::move(err)) << '\n';
+        return 1;
+    }
+
+    llvm::outs() << "function          compile(ms)  cached(ns)  "
+                    "generic(ns/call)  specialized(ns/call)\n";
+
+    int exit_code = 0;
+    for (const SpecializationCase &specialization_case : createCases()) {
+        EXIT_ON_ERROR(SpecializationResult, result,
+                      measureCase(compiler, specializer, specialization_case,
+                                  call_count));
+
+        llvm::outs() << llvm::format(
+            "%-16s %12.2f %11.1f %17.2f %21.2f", specialization_case.name,
+            result.compile_seconds * 1e3, result.cached_seconds * 1e9,
+            result.generic_seconds * 1e9 / call_count,
+            result.specialized_seconds * 1e9 / call_count);
+        if (!result.matches) {
+            llvm::outs() << "  MISMATCH";
+            exit_code = 1;
+        }
+        llvm::outs() << '\n';
+    }
+
+    llvm::outs() << "cache hits: " << specializer.getCacheHits()
+                 << ", misses: " << specializer.getCacheMisses() << '\n';
+
+    return exit_code;
+}
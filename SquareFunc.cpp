@@ -1,79 +1,124 @@
+#include "BitcodeModule.hpp"
 #include "DefaultTarget.hpp"
+#include "DefineSquare.hpp"
+#include "DiskObjectCache.hpp"
 #include "SimpleJITCompiler.hpp"
-#include "llvm/IR/BasicBlock.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/IR/DataLayout.h"
-#include "llvm/IR/Function.h"
-#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
-#include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <utility>
+#include <vector>
 
-std::unique_ptr<llvm::Module> DefineSquare(llvm::LLVMContext &context) {
-    auto module = std::make_unique<llvm::Module>("square", context);
-    module->setTargetTriple(GetDefaultTargetTriple().str());
-    module->setDataLayout(GetDefaultDataLayout());
-
-    {
-        // Declare function
-        llvm::Type *double_type = llvm::Type::getDoubleTy(context);
-        llvm::FunctionType *func_type = llvm::FunctionType::get(
-            double_type, {double_type}, /*isVarArg*/ false);
-
-        llvm::Function *square_func = llvm::Function::Create(
-            func_type, llvm::Function::ExternalLinkage, "square", *module);
-
-        // Add instructions
-        llvm::IRBuilder<> ir_builder{context};
-        llvm::BasicBlock *entry_block =
-            llvm::BasicBlock::Create(context, "", square_func);
-
-        ir_builder.SetInsertPoint(entry_block);
-        llvm::Argument *func_arg = square_func->getArg(0);
-        llvm::Value *result = ir_builder.CreateFMul(func_arg, func_arg);
-        ir_builder.CreateRet(result);
-    }
-
-    return module;
-}
+// Usage: SquareFunc [--save-bitcode=<file.bc>] [--load-bitcode=<file.bc>]
+//
+// --save-bitcode writes the square module as bitcode, --load-bitcode reads
+// it back instead of building it with IRBuilder.
+int main(int argc, char *argv[]) {
+    llvm::StringRef save_path;
+    llvm::StringRef load_path;
 
-int main() {
+    for (int arg = 1; arg < argc; ++arg) {
+        llvm::StringRef option{argv[arg]};
+        if (option.consume_front("--save-bitcode=")) {
+            save_path = option;
+        } else if (option.consume_front("--load-bitcode=")) {
+            load_path = option;
+        } else {
+            std::cerr << "Unknown option " << argv[arg] << "\n";
+            return 1;
+        }
+    }
 
     // Create module
     auto context = std::make_unique<llvm::LLVMContext>();
-    std::unique_ptr<llvm::Module> square_module = DefineSquare(*context);
+    std::unique_ptr<llvm::Module> square_module;
+
+    if (load_path.empty()) {
+        square_module = DefineSquare(*context);
+    } else {
+        auto loaded_module = loadBitcodeModule(load_path, *context, {"square"});
+        if (!loaded_module) {
+            std::cerr << "Failed to load bitcode: "
+                      << llvm::toString(loaded_module.takeError()) << "\n";
+            return 1;
+        }
+        square_module = std::move(*loaded_module);
+    }
+
     llvm::verifyModule(*square_module, &llvm::errs());
     square_module->print(llvm::outs(), nullptr);
 
+    if (!save_path.empty()) {
+        if (auto err = saveBitcodeModule(*square_module, save_path)) {
+            std::cerr << "Failed to save bitcode: "
+                      << llvm::toString(std::move(err)) << "\n";
+            return 1;
+        }
+    }
+
     // Create JIT'd program
     std::string module_name = square_module->getName().str();
     const char *symbol_name = "square";
 
-    SimpleJITCompiler compiler{};
-    auto err =
-        compiler.add(module_name, std::move(square_module), std::move(context));
+    SimpleJITCompiler::Options options{};
+    options.cpu = TargetCPU::Host;
+    options.batch_functions = true;
+    options.object_cache_directory = GetDefaultObjectCacheDirectory();
+    options.verify_modules = true;
+    options.count_calls = true;
+
+    SimpleJITCompiler compiler{options};
+    auto err = compiler.add(module_name, std::move(square_module),
+                            std::move(context), OptLevel::O2);
     if (err) {
         std::cerr << "Failed to add module\n";
         return 1;
     }
 
-    llvm::Expected<llvm::JITEvaluatedSymbol> square_symbol =
-        compiler.lookup(module_name, symbol_name);
+    llvm::Expected<double (*)(double)> square_func =
+        compiler.lookupFunction<double(double)>(module_name, symbol_name);
 
-    if (!square_symbol) {
+    if (!square_func) {
         std::cerr << "Failed to get square function symbol\n";
         return 1;
     }
 
-    using square_func_t = double (*)(double);
-    square_func_t square_func = llvm::jitTargetAddressToPointer<square_func_t>(
-        square_symbol->getAddress());
+    std::cout << "square(10) = " << (*square_func)(10.0) << std::endl;
+
+    // Square a whole array with one call of the generated batch variant
+    using SquareBatchFunction = void(const double *, double *, int64_t);
+    llvm::Expected<SquareBatchFunction *> square_batch_func =
+        compiler.lookupFunction<SquareBatchFunction>(
+            module_name, getBatchFunctionName(symbol_name));
+
+    if (!square_batch_func) {
+        std::cerr << "Failed to get square_batch function symbol\n";
+        return 1;
+    }
+
+    std::vector<double> values{1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0};
+    std::vector<double> squares(values.size());
+    (*square_batch_func)(values.data(), squares.data(), values.size());
+
+    std::cout << "square_batch({1..8}) =";
+    for (double square : squares)
+        std::cout << ' ' << square;
+    std::cout << std::endl;
+
+    std::cout << "square called "
+              << compiler.getInstrumentation().getCallCount(module_name,
+                                                            symbol_name)
+              << " times" << std::endl;
 
-    std::cout << "square(10) = " << square_func(10.0) << std::endl;
+    compiler.getInstrumentation().print(llvm::outs());
+    compiler.getObjectCache()->printStatistics(llvm::outs());
+    compiler.getMemoryPool().printStatistics(llvm::outs());
 }
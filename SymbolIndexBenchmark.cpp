@@ -0,0 +1,203 @@
+#include "BenchmarkUtils.hpp"
+#include "CreateObjectFile.hpp"
+#include "DefaultTarget.hpp"
+#include "SymbolIndex.hpp"
+#include "utils.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/iterator_range.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+constexpr unsigned GENERATED_SYMBOL_COUNT = 20000;
+constexpr unsigned LOOKUP_COUNT = 1000;
+constexpr unsigned INDEX_REPETITIONS = 1000;
+
+// Defines `int64_t symbol_<index>()` returning its index for every index.
+std::unique_ptr<llvm::Module> DefineSymbols(llvm::LLVMContext &context,
+                                            unsigned symbol_count) {
+    auto module = std::make_unique<llvm::Module>("symbols", context);
+    module->setTargetTriple(GetDefaultTargetTriple().str());
+    module->setDataLayout(GetDefaultDataLayout());
+
+    llvm::Type *long_type = llvm::Type::getInt64Ty(context);
+    llvm::FunctionType *func_type =
+        llvm::FunctionType::get(long_type, /*isVarArg*/ false);
+    llvm::IRBuilder<> ir_builder{context};
+
+    for (unsigned index = 0; index < symbol_count; ++index) {
+        llvm::Function *func = llvm::Function::Create(
+            func_type, llvm::Function::ExternalLinkage,
+            "symbol_" + llvm::Twine(index), *module);
+
+        ir_builder.SetInsertPoint(
+            llvm::BasicBlock::Create(context, "", func));
+        ir_builder.CreateRet(llvm::ConstantInt::get(long_type, index));
+    }
+
+    return module;
+}
+
+using SymbolRange = llvm::object::ObjectFile::symbol_iterator_range;
+
+// The symbol tables a SymbolIndex over `object_file` covers, in lookup
+// order: the dynamic symbol table when it is read from an ELF hash section,
+// then all symbols.
+std::vector<SymbolRange>
+getIndexedSymbols(const llvm::object::ObjectFile &object_file,
+                  const SymbolIndex &symbol_index) {
+    std::vector<SymbolRange> symbol_tables;
+
+    if (symbol_index.usesHashSection()) {
+        const auto &elf_file =
+            llvm::cast<llvm::object::ELFObjectFileBase>(object_file);
+        auto dynamic_symbols = elf_file.getDynamicSymbolIterators();
+        symbol_tables.emplace_back(dynamic_symbols.begin(),
+                                   dynamic_symbols.end());
+    }
+
+    symbol_tables.push_back(object_file.symbols());
+    return symbol_tables;
+}
+
+// Lookup as done before SymbolIndex: compare the name of every symbol.
+llvm::Optional<uint64_t> scanSymbol(llvm::ArrayRef<SymbolRange> symbol_tables,
+                                    llvm::StringRef name) {
+    for (const SymbolRange &symbols : symbol_tables) {
+        for (const auto &symbol : symbols) {
+            auto symbol_name = symbol.getName();
+            if (!symbol_name) {
+                llvm::consumeError(symbol_name.takeError());
+                continue;
+            }
+
+            auto symbol_address = symbol.getAddress();
+            if (!symbol_address) {
+                llvm::consumeError(symbol_address.takeError());
+                continue;
+            }
+
+            if (*symbol_name == name)
+                return *symbol_address;
+        }
+    }
+
+    return llvm::None;
+}
+
+int main(int argc, char *argv[]) {
+
+    // Index the object file given on the command line or a generated one
+    OwningObjectFile owned_object_file;
+
+    if (argc > 1) {
+        EXIT_ON_ERROR(OwningObjectFile, loaded_object_file,
+                      createObjectFileFromSource(argv[1]));
+        owned_object_file = std::move(loaded_object_file);
+    } else {
+        llvm::LLVMContext context{};
+        auto module = DefineSymbols(context, GENERATED_SYMBOL_COUNT);
+        EXIT_ON_ERROR(OwningObjectFile, compiled_object_file,
+                      createObjectFileFromModule(*module));
+        owned_object_file = std::move(compiled_object_file);
+    }
+
+    const llvm::object::ObjectFile &object_file =
+        *owned_object_file.getBinary();
+
+    auto build_start = BenchmarkClock::now();
+    EXIT_ON_ERROR(SymbolIndex, symbol_index, SymbolIndex::create(object_file));
+    std::chrono::duration<double> build_seconds =
+        BenchmarkClock::now() - build_start;
+
+    auto symbols = getIndexedSymbols(object_file, symbol_index);
+
+    // Pick random defined names to look up
+    std::vector<std::string> names;
+    for (const SymbolRange &symbol_table : symbols) {
+        for (const auto &symbol : symbol_table) {
+            auto flags = symbol.getFlags();
+            auto name = symbol.getName();
+            if (flags && name &&
+                !(*flags & llvm::object::SymbolRef::SF_Undefined) &&
+                !name->empty())
+                names.push_back(name->str());
+            if (!flags)
+                llvm::consumeError(flags.takeError());
+            if (!name)
+                llvm::consumeError(name.takeError());
+        }
+    }
+
+    if (names.empty()) {
+        llvm::errs() << "No defined symbols to look up\n";
+        return 1;
+    }
+
+    // Every defined name must resolve, including static symbols missing from
+    // the dynamic table of a file indexed through its hash section
+    for (const std::string &name : names) {
+        if (!symbol_index.lookup(name)) {
+            llvm::errs() << "Symbol " << name << " is not in the index\n";
+            return 1;
+        }
+    }
+
+    std::mt19937 random_engine{42};
+    std::uniform_int_distribution<size_t> pick_name{0, names.size() - 1};
+
+    std::vector<std::string> lookups;
+    for (unsigned lookup = 0; lookup < LOOKUP_COUNT; ++lookup)
+        lookups.push_back(names[pick_name(random_engine)]);
+
+    PRINT_EXPR(symbol_index.size());
+    PRINT_EXPR(symbol_index.usesHashSection());
+
+    unsigned scan_found = 0;
+    double scan_seconds = measureSeconds([&]() {
+        for (const std::string &name : lookups)
+            scan_found += scanSymbol(symbols, name).hasValue();
+    });
+
+    unsigned index_found = 0;
+    double index_seconds = measureSeconds([&]() {
+        for (unsigned repetition = 0; repetition < INDEX_REPETITIONS;
+             ++repetition) {
+            for (const std::string &name : lookups)
+                index_found += symbol_index.lookup(name).hasValue();
+        }
+    });
+    index_found /= INDEX_REPETITIONS;
+
+    double scan_ns = scan_seconds * 1e9 / LOOKUP_COUNT;
+    double index_ns =
+        index_seconds * 1e9 / (double{LOOKUP_COUNT} * INDEX_REPETITIONS);
+
+    llvm::outs() << llvm::format("index build       %12.3f ms\n",
+                                 build_seconds.count() * 1e3)
+                 << llvm::format("linear scan       %12.1f ns/lookup, "
+                                 "%u/%u found\n",
+                                 scan_ns, scan_found, LOOKUP_COUNT)
+                 << llvm::format("symbol index      %12.1f ns/lookup, "
+                                 "%u/%u found\n",
+                                 index_ns, index_found, LOOKUP_COUNT)
+                 << llvm::format("speedup           %12.1fx\n",
+                                 scan_ns / index_ns);
+}
@@ -0,0 +1,312 @@
+#include "BenchmarkUtils.hpp"
+#include "RecordWriter.hpp"
+#include "WorkStealingPool.hpp"
+#include "utils.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/SymbolicFile.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// A file to scan, or a member of an archive that has been mapped already.
+struct ScanTask {
+    std::string path;
+    std::shared_ptr<llvm::MemoryBuffer> archive;
+    llvm::MemoryBufferRef member;
+};
+
+// Global symbol as seen across all scanned files.
+struct SymbolEntry {
+    uint32_t flags = 0;
+    uint32_t definitions = 0;
+    uint32_t references = 0;
+};
+
+// What one worker has found. Workers only touch their own results, which
+// are merged once scanning is done.
+struct ScanResults {
+    llvm::StringMap<SymbolEntry> symbols;
+    uint64_t files = 0;
+    uint64_t archives = 0;
+    uint64_t skipped = 0;
+    uint64_t symbol_count = 0;
+    uint64_t bytes = 0;
+
+    void merge(ScanResults &other) {
+        for (auto &entry : other.symbols) {
+            SymbolEntry &merged = symbols[entry.first()];
+            if (merged.definitions == 0 && merged.references == 0)
+                merged.flags = entry.second.flags;
+            merged.definitions += entry.second.definitions;
+            merged.references += entry.second.references;
+        }
+        files += other.files;
+        archives += other.archives;
+        skipped += other.skipped;
+        symbol_count += other.symbol_count;
+        bytes += other.bytes;
+    }
+};
+
+class SymbolScanner {
+  public:
+    explicit SymbolScanner(unsigned thread_count)
+        : pool_{thread_count}, results_(pool_.getWorkerCount()) {
+        for (unsigned worker = 0; worker < pool_.getWorkerCount(); ++worker)
+            contexts_.push_back(std::make_unique<llvm::LLVMContext>());
+    }
+
+    // Queues `path`, recursing into directories.
+    void add(llvm::StringRef path);
+
+    ScanResults scan();
+
+  private:
+    void scanTask(unsigned worker, ScanTask task);
+    void scanArchive(unsigned worker,
+                     const std::shared_ptr<llvm::MemoryBuffer> &mapping);
+    void scanSymbols(unsigned worker, llvm::MemoryBufferRef buffer);
+
+    WorkStealingPool<ScanTask> pool_;
+    std::vector<ScanResults> results_;
+    // Bitcode files are read into an LLVMContext, one per worker
+    std::vector<std::unique_ptr<llvm::LLVMContext>> contexts_;
+    unsigned next_worker_ = 0;
+};
+
+void SymbolScanner::add(llvm::StringRef path) {
+    auto queue = [this](llvm::StringRef file_path) {
+        pool_.push(next_worker_, ScanTask{file_path.str(), nullptr, {}});
+        next_worker_ = (next_worker_ + 1) % pool_.getWorkerCount();
+    };
+
+    if (!llvm::sys::fs::is_directory(path)) {
+        queue(path);
+        return;
+    }
+
+    std::error_code ec;
+    for (llvm::sys::fs::recursive_directory_iterator entry{path, ec}, end;
+         entry != end && !ec; entry.increment(ec)) {
+        if (llvm::sys::fs::is_regular_file(entry->path()))
+            queue(entry->path());
+    }
+}
+
+ScanResults SymbolScanner::scan() {
+    pool_.run([this](unsigned worker, ScanTask task) {
+        scanTask(worker, std::move(task));
+    });
+
+    ScanResults merged;
+    for (ScanResults &worker_results : results_)
+        merged.merge(worker_results);
+
+    return merged;
+}
+
+void SymbolScanner::scanTask(unsigned worker, ScanTask task) {
+    if (task.archive) {
+        scanSymbols(worker, task.member);
+        return;
+    }
+
+    auto mapping = llvm::MemoryBuffer::getFile(
+        task.path, /*FileSize*/ -1, /*RequiresNullTerminator*/ false);
+    if (!mapping) {
+        ++results_[worker].skipped;
+        return;
+    }
+
+    llvm::MemoryBufferRef buffer = (*mapping)->getMemBufferRef();
+    if (llvm::identify_magic(buffer.getBuffer()) == llvm::file_magic::archive) {
+        scanArchive(worker, std::move(*mapping));
+        return;
+    }
+
+    scanSymbols(worker, buffer);
+}
+
+void SymbolScanner::scanArchive(
+    unsigned worker, const std::shared_ptr<llvm::MemoryBuffer> &mapping) {
+    ScanResults &results = results_[worker];
+
+    auto archive = llvm::object::Archive::create(mapping->getMemBufferRef());
+    if (!archive) {
+        llvm::consumeError(archive.takeError());
+        ++results.skipped;
+        return;
+    }
+
+    ++results.archives;
+
+    // Members become tasks of their own, so that idle workers can steal
+    // them from large archives
+    llvm::Error err = llvm::Error::success();
+    for (const auto &child : (*archive)->children(err)) {
+        auto member = child.getMemoryBufferRef();
+        if (!member) {
+            llvm::consumeError(member.takeError());
+            ++results.skipped;
+            continue;
+        }
+
+        pool_.push(worker,
+                   ScanTask{mapping->getBufferIdentifier().str(), mapping,
+                            *member});
+    }
+
+    if (err) {
+        llvm::consumeError(std::move(err));
+        ++results.skipped;
+    }
+}
+
+void SymbolScanner::scanSymbols(unsigned worker,
+                                llvm::MemoryBufferRef buffer) {
+    ScanResults &results = results_[worker];
+
+    auto symbolic_file = llvm::object::SymbolicFile::createSymbolicFile(
+        buffer, llvm::file_magic::unknown, contexts_[worker].get());
+    if (!symbolic_file) {
+        llvm::consumeError(symbolic_file.takeError());
+        ++results.skipped;
+        return;
+    }
+
+    ++results.files;
+    results.bytes += buffer.getBufferSize();
+
+    llvm::SmallString<128> name;
+    for (const auto &symbol : (*symbolic_file)->symbols()) {
+        ++results.symbol_count;
+
+        auto flags = symbol.getFlags();
+        if (!flags) {
+            llvm::consumeError(flags.takeError());
+            continue;
+        }
+
+        if (!(*flags & llvm::object::SymbolRef::SF_Global) ||
+            (*flags & llvm::object::SymbolRef::SF_FormatSpecific))
+            continue;
+
+        name.clear();
+        llvm::raw_svector_ostream name_stream{name};
+        if (auto err = symbol.printName(name_stream)) {
+            llvm::consumeError(std::move(err));
+            continue;
+        }
+
+        SymbolEntry &entry = results.symbols[name];
+        if (entry.definitions == 0 && entry.references == 0)
+            entry.flags = *flags;
+
+        if (*flags & llvm::object::SymbolRef::SF_Undefined)
+            ++entry.references;
+        else
+            ++entry.definitions;
+    }
+}
+
+// Usage: SymbolScanner [-j<threads>] [--format=text|ndjson|binary] <path>...
+//
+// Scans object files, bitcode files and archives, recursing into directories,
+// and merges their global symbols into one table. The text format prints a
+// summary and the symbols defined more than once, the other formats write
+// one record per unique symbol with its flags.
+int main(int argc, char *argv[]) {
+    unsigned thread_count = 0;
+    OutputFormat format = OutputFormat::Text;
+
+    int first_path = 1;
+    for (; first_path < argc; ++first_path) {
+        llvm::StringRef option{argv[first_path]};
+
+        if (option.consume_front("-j")) {
+            // A bare -j uses one thread per hardware thread
+            if (!option.empty() && option.getAsInteger(10, thread_count)) {
+                llvm::errs() << "Invalid thread count " << option << '\n';
+                return 1;
+            }
+        } else if (option.consume_front("--format=")) {
+            auto parsed_format = parseOutputFormat(option);
+            if (!parsed_format) {
+                llvm::errs() << "Unknown output format " << option << '\n';
+                return 1;
+            }
+            format = *parsed_format;
+        } else {
+            break;
+        }
+    }
+
+    if (argc <= first_path) {
+        llvm::errs() << "No path found in command line arguments\n";
+        return 1;
+    }
+
+    SymbolScanner scanner{thread_count};
+    ScanResults results;
+
+    double seconds = measureSeconds([&]() {
+        for (int arg = first_path; arg < argc; ++arg)
+            scanner.add(argv[arg]);
+        results = scanner.scan();
+    });
+
+    if (format != OutputFormat::Text) {
+        EXIT_ON_ERROR(std::unique_ptr<llvm::raw_fd_ostream>, record_sink,
+                      openRecordSink("-"));
+
+        RecordWriter record_writer{*record_sink, format};
+        record_writer.writeHeader();
+        for (const auto &entry : results.symbols)
+            record_writer.writeSymbol(entry.first(), /*address*/ 0,
+                                      entry.second.flags);
+        return 0;
+    }
+
+    // Symbols with more than one definition, in name order
+    std::vector<const llvm::StringMapEntry<SymbolEntry> *> duplicates;
+    for (const auto &entry : results.symbols) {
+        if (entry.second.definitions > 1 &&
+            !(entry.second.flags & llvm::object::SymbolRef::SF_Weak))
+            duplicates.push_back(&entry);
+    }
+    std::sort(duplicates.begin(), duplicates.end(),
+              [](const auto *lhs, const auto *rhs) {
+                  return lhs->first() < rhs->first();
+              });
+
+    for (const auto *duplicate : duplicates)
+        llvm::outs() << llvm::format("%6u definitions: ",
+                                     duplicate->second.definitions)
+                     << duplicate->first() << '\n';
+
+    PRINT_EXPR(results.files);
+    PRINT_EXPR(results.archives);
+    PRINT_EXPR(results.skipped);
+    PRINT_EXPR(results.symbol_count);
+    PRINT_EXPR(results.symbols.size());
+    PRINT_EXPR(duplicates.size());
+
+    llvm::outs() << llvm::format(
+        "%.3f s, %.1f files/s, %.1f symbols/s, %.1f MiB/s\n", seconds,
+        results.files / seconds, results.symbol_count / seconds,
+        results.bytes / seconds / (1024 * 1024));
+}
@@ -0,0 +1,187 @@
+#include "BenchmarkUtils.hpp"
+#include "BenchmarkWorkloads.hpp"
+#include "DefineFactorial.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "utils.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+constexpr unsigned DEFAULT_FUNCTION_COUNT = 200;
+constexpr unsigned HOT_FUNCTION_COUNT = 4;
+constexpr uint64_t DEFAULT_TIER_UP_THRESHOLD = 1000;
+constexpr uint64_t CALLS_PER_WINDOW = 20000;
+constexpr int64_t ITERATIONS_PER_CALL = 16;
+constexpr int64_t FACTORIAL_ARGUMENT = 20;
+
+using WorkFunction = double(double, int64_t);
+using FactorialFunction = int64_t(int64_t);
+
+enum class CompileMode {
+    O0,
+    O3,
+    Tiered,
+};
+
+const char *getCompileModeName(CompileMode mode) {
+    switch (mode) {
+    case CompileMode::O0:
+        return "O0";
+    case CompileMode::O3:
+        return "O3";
+    case CompileMode::Tiered:
+        return "tiered";
+    }
+    return "O0";
+}
+
+struct TieredResult {
+    double startup_seconds = 0.0;
+    double warm_up_seconds = 0.0;
+    double steady_seconds = 0.0;
+    uint64_t tier_ups = 0;
+    double checksum = 0.0;
+};
+
+// Adds a module of `function_count` work functions and the naive recursive
+// factorial, and calls the factorial and the first few work functions: once
+// for startup, then for a warm-up window during which tiered functions get
+// optimized, then for a window in steady state. The work functions are one
+// long dependency chain that O0 already handles well, while O3 turns the
+// recursion of the factorial into a loop.
+llvm::Expected<TieredResult> measureRun(CompileMode mode,
+                                        unsigned function_count,
+                                        uint64_t tier_up_threshold) {
+    SimpleJITCompiler::Options options{};
+    options.tiered = mode == CompileMode::Tiered;
+    options.tier_up_threshold = tier_up_threshold;
+    SimpleJITCompiler compiler{options};
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    std::unique_ptr<llvm::Module> module =
+        DefineWorkModule(*context, "tiered_work", function_count);
+    DefineFactorial(*module, RecursionLowering::Naive);
+
+    std::vector<WorkFunction *> hot_functions;
+    FactorialFunction *factorial = nullptr;
+    TieredResult result{};
+    llvm::Error err = llvm::Error::success();
+
+    result.startup_seconds = measureSeconds([&]() {
+        err = llvm::joinErrors(
+            std::move(err),
+            compiler.add("tiered_work", std::move(module), std::move(context),
+                         mode == CompileMode::O3 ? OptLevel::O3
+                                                 : OptLevel::O0));
+        if (err)
+            return;
+
+        auto factorial_func =
+            compiler.lookupFunction<FactorialFunction>("tiered_work",
+                                                       "factorial");
+        if (!factorial_func) {
+            err = factorial_func.takeError();
+            return;
+        }
+        factorial = *factorial_func;
+        doNotOptimize(factorial(FACTORIAL_ARGUMENT));
+
+        for (unsigned index = 0; index < HOT_FUNCTION_COUNT; ++index) {
+            auto work_func = compiler.lookupFunction<WorkFunction>(
+                "tiered_work", "tiered_work_" + std::to_string(index));
+            if (!work_func) {
+                err = work_func.takeError();
+                return;
+            }
+
+            doNotOptimize((*work_func)(1.0, ITERATIONS_PER_CALL));
+            hot_functions.push_back(*work_func);
+        }
+    });
+
+    if (err)
+        return {std::move(err)};
+
+    auto call_window = [&]() {
+        double sum = 0.0;
+        for (uint64_t call = 0; call < CALLS_PER_WINDOW; ++call) {
+            sum += hot_functions[call % HOT_FUNCTION_COUNT](
+                static_cast<double>(call & 0xff), ITERATIONS_PER_CALL);
+            sum += static_cast<double>(factorial(static_cast<int64_t>(
+                FACTORIAL_ARGUMENT - call % 4)));
+        }
+        return sum;
+    };
+
+    result.warm_up_seconds = measureSeconds([&]() {
+        doNotOptimize(call_window());
+    });
+
+    compiler.waitForTierUps();
+    result.tier_ups = compiler.getTierUpCount();
+
+    result.steady_seconds = measureSeconds([&]() {
+        result.checksum = call_window();
+    });
+
+    return result;
+}
+
+// Usage: TieredCompileBenchmark [function count] [tier-up threshold]
+//
+// Compares compiling a module once at O0, once at O3 and in tiers: the
+// time to the first calls, the cost of calls while hot functions are
+// optimized in the background, and the cost of calls afterwards.
+int main(int argc, char *argv[]) {
+    unsigned function_count = DEFAULT_FUNCTION_COUNT;
+    if (argc > 1)
+        function_count = std::max(HOT_FUNCTION_COUNT,
+                                  static_cast<unsigned>(std::atoi(argv[1])));
+
+    uint64_t tier_up_threshold = DEFAULT_TIER_UP_THRESHOLD;
+    if (argc > 2)
+        tier_up_threshold = std::strtoull(argv[2], nullptr, 10);
+
+    PRINT_EXPR(function_count);
+    PRINT_EXPR(HOT_FUNCTION_COUNT);
+    PRINT_EXPR(tier_up_threshold);
+    PRINT_EXPR(CALLS_PER_WINDOW);
+
+    llvm::outs() << "mode    startup(ms)  warm-up(ns/call)  steady(ns/call)"
+                    "  tier-ups\n";
+
+    double expected_checksum = 0.0;
+    int exit_code = 0;
+
+    for (CompileMode mode :
+         {CompileMode::O0, CompileMode::O3, CompileMode::Tiered}) {
+        EXIT_ON_ERROR(TieredResult, result,
+                      measureRun(mode, function_count, tier_up_threshold));
+
+        llvm::outs() << llvm::format(
+            "%-6s %12.2f %17.1f %16.1f %9llu", getCompileModeName(mode),
+            result.startup_seconds * 1e3,
+            result.warm_up_seconds * 1e9 / CALLS_PER_WINDOW,
+            result.steady_seconds * 1e9 / CALLS_PER_WINDOW,
+            static_cast<unsigned long long>(result.tier_ups));
+
+        if (mode == CompileMode::O0) {
+            expected_checksum = result.checksum;
+        } else if (result.checksum != expected_checksum) {
+            llvm::outs() << "  MISMATCH";
+            exit_code = 1;
+        }
+        llvm::outs() << '\n';
+    }
+
+    return exit_code;
+}
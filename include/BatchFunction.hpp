@@ -0,0 +1,144 @@
+#ifndef INCLUDE_BATCH_FUNCTION_HPP_
+#define INCLUDE_BATCH_FUNCTION_HPP_
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <string>
+
+// Suffix of the batch variant of a scalar function.
+constexpr const char *BATCH_FUNCTION_SUFFIX = "_batch";
+
+std::string getBatchFunctionName(llvm::StringRef scalar_name) {
+    return (scalar_name + BATCH_FUNCTION_SUFFIX).str();
+}
+
+// Whether `function` is a scalar function `T f(T)`, with T an integer or
+// floating-point type, that a batch variant can be defined for.
+bool isBatchableFunction(const llvm::Function &function) {
+    if (function.isDeclaration() || function.isVarArg() ||
+        function.isIntrinsic() || function.hasLocalLinkage() ||
+        function.arg_size() != 1)
+        return false;
+
+    llvm::Type *type = function.getReturnType();
+    if (type != function.getArg(0)->getType())
+        return false;
+
+    return type->isIntegerTy() || type->isFloatingPointTy();
+}
+
+// Defines `void <name>_batch(const T *in, T *out, int64_t n)` next to
+// `scalar_function`, storing `<name>(in[i])` to `out[i]` for i < n.
+//
+// The scalar body is inlined into the loop right away, so that it can be
+// vectorized even where the optimizer would not inline it, e.g. across lazy
+// compilation partitions. The loop is marked for vectorization; at O2 and
+// above the loop vectorizer then uses the SIMD width of the target CPU, which
+// is the host's with TargetCPU::Host.
+llvm::Function *defineBatchFunction(llvm::Function &scalar_function) {
+    llvm::Module &module = *scalar_function.getParent();
+    llvm::LLVMContext &context = module.getContext();
+
+    llvm::Type *type = scalar_function.getReturnType();
+    llvm::Type *pointer_type = type->getPointerTo();
+    llvm::Type *long_type = llvm::Type::getInt64Ty(context);
+
+    llvm::FunctionType *batch_type = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(context), {pointer_type, pointer_type, long_type},
+        /*isVarArg*/ false);
+    llvm::Function *batch_func = llvm::Function::Create(
+        batch_type, llvm::Function::ExternalLinkage,
+        getBatchFunctionName(scalar_function.getName()), module);
+
+    // Input and output must not overlap, which spares the vectorizer its
+    // runtime alias checks
+    for (unsigned arg = 0; arg < 2; ++arg) {
+        batch_func->addParamAttr(arg, llvm::Attribute::NoAlias);
+        batch_func->addParamAttr(arg, llvm::Attribute::NoCapture);
+    }
+    batch_func->addParamAttr(0, llvm::Attribute::ReadOnly);
+
+    llvm::BasicBlock *entry_block =
+        llvm::BasicBlock::Create(context, "entry", batch_func);
+    llvm::BasicBlock *loop_block =
+        llvm::BasicBlock::Create(context, "loop", batch_func);
+    llvm::BasicBlock *exit_block =
+        llvm::BasicBlock::Create(context, "exit", batch_func);
+
+    llvm::IRBuilder<> ir_builder{context};
+    llvm::Argument *input = batch_func->getArg(0);
+    llvm::Argument *output = batch_func->getArg(1);
+    llvm::Argument *count = batch_func->getArg(2);
+
+    ir_builder.SetInsertPoint(entry_block);
+    llvm::Constant *zero = llvm::ConstantInt::get(long_type, 0);
+    ir_builder.CreateCondBr(ir_builder.CreateICmpSGT(count, zero), loop_block,
+                            exit_block);
+
+    ir_builder.SetInsertPoint(loop_block);
+    llvm::PHINode *index = ir_builder.CreatePHI(long_type, 2, "index");
+    index->addIncoming(zero, entry_block);
+
+    llvm::Value *value = ir_builder.CreateLoad(
+        type, ir_builder.CreateInBoundsGEP(type, input, index));
+    llvm::CallInst *call = ir_builder.CreateCall(&scalar_function, {value});
+    ir_builder.CreateStore(call,
+                           ir_builder.CreateInBoundsGEP(type, output, index));
+
+    llvm::Value *next_index =
+        ir_builder.CreateAdd(index, llvm::ConstantInt::get(long_type, 1));
+    index->addIncoming(next_index, loop_block);
+    llvm::BranchInst *latch = ir_builder.CreateCondBr(
+        ir_builder.CreateICmpSLT(next_index, count), loop_block, exit_block);
+
+    // Self-referential loop ID holding llvm.loop.vectorize.enable
+    llvm::Metadata *vectorize_enable[] = {
+        llvm::MDString::get(context, "llvm.loop.vectorize.enable"),
+        llvm::ConstantAsMetadata::get(llvm::ConstantInt::getTrue(context))};
+    llvm::TempMDTuple placeholder = llvm::MDNode::getTemporary(context, {});
+    llvm::Metadata *loop_properties[] = {
+        placeholder.get(), llvm::MDNode::get(context, vectorize_enable)};
+    llvm::MDNode *loop_id = llvm::MDNode::getDistinct(context, loop_properties);
+    loop_id->replaceOperandWith(0, loop_id);
+    latch->setMetadata(llvm::LLVMContext::MD_loop, loop_id);
+
+    ir_builder.SetInsertPoint(exit_block);
+    ir_builder.CreateRetVoid();
+
+    // A scalar function that cannot be inlined is still called per element
+    llvm::InlineFunctionInfo inline_info;
+    (void)llvm::InlineFunction(*call, inline_info);
+
+    return batch_func;
+}
+
+// Defines the batch variant of every batchable function of `module` that does
+// not have one yet. Returns the number of functions defined.
+unsigned defineBatchFunctions(llvm::Module &module) {
+    llvm::SmallVector<llvm::Function *, 8> scalar_functions;
+    for (llvm::Function &function : module) {
+        if (isBatchableFunction(function) &&
+            module.getFunction(getBatchFunctionName(function.getName())) ==
+                nullptr)
+            scalar_functions.push_back(&function);
+    }
+
+    for (llvm::Function *scalar_function : scalar_functions)
+        defineBatchFunction(*scalar_function);
+
+    return scalar_functions.size();
+}
+
+#endif // INCLUDE_BATCH_FUNCTION_HPP_
@@ -0,0 +1,57 @@
+#ifndef INCLUDE_BENCHMARK_UTILS_HPP_
+#define INCLUDE_BENCHMARK_UTILS_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <utility>
+
+#if defined(__unix__)
+#include <unistd.h>
+#endif
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+template <typename Callable> double measureSeconds(Callable &&callable) {
+    auto start = BenchmarkClock::now();
+    std::forward<Callable>(callable)();
+    std::chrono::duration<double> elapsed = BenchmarkClock::now() - start;
+    return elapsed.count();
+}
+
+// Runs `callable` `repetitions` times and keeps the fastest run, which is the
+// least disturbed by scheduling and frequency scaling noise.
+template <typename Callable>
+double measureBestOf(unsigned repetitions, Callable &&callable) {
+    double best_seconds = std::numeric_limits<double>::infinity();
+
+    for (unsigned run = 0; run < repetitions; ++run)
+        best_seconds = std::min(best_seconds, measureSeconds(callable));
+
+    return best_seconds;
+}
+
+// Keeps the compiler from discarding a scalar result that is only computed for
+// timing purposes.
+template <typename T> void doNotOptimize(T value) {
+    static volatile T sink;
+    sink = value;
+    (void)sink;
+}
+
+// Resident set size of the current process, or 0 where /proc is unavailable.
+uint64_t getResidentMemoryBytes() {
+#if defined(__unix__)
+    std::ifstream statm{"/proc/self/statm"};
+    uint64_t total_pages = 0;
+    uint64_t resident_pages = 0;
+
+    if (statm >> total_pages >> resident_pages)
+        return resident_pages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+    return 0;
+}
+
+#endif // INCLUDE_BENCHMARK_UTILS_HPP_
@@ -0,0 +1,104 @@
+#ifndef INCLUDE_BENCHMARK_WORKLOADS_HPP_
+#define INCLUDE_BENCHMARK_WORKLOADS_HPP_
+
+#include "DefaultTarget.hpp"
+#include "llvm/ADT/Twine.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cassert>
+#include <memory>
+#include <string>
+
+constexpr unsigned STATEMENTS_PER_FUNCTION = 64;
+
+// Defines `double <name>(double x, int64_t n)` which runs a loop over a long
+// chain of `statement_count` arithmetic operations so that the optimizer and
+// instruction selector have a realistic amount of work per function.
+llvm::Function *
+DefineWorkFunction(llvm::Module &module, const llvm::Twine &name,
+                   unsigned seed,
+                   unsigned statement_count = STATEMENTS_PER_FUNCTION) {
+    llvm::LLVMContext &context = module.getContext();
+    llvm::Type *double_type = llvm::Type::getDoubleTy(context);
+    llvm::Type *long_type = llvm::Type::getInt64Ty(context);
+
+    llvm::FunctionType *func_type = llvm::FunctionType::get(
+        double_type, {double_type, long_type}, /*isVarArg*/ false);
+    llvm::Function *work_func = llvm::Function::Create(
+        func_type, llvm::Function::ExternalLinkage, name, module);
+
+    llvm::BasicBlock *entry_block =
+        llvm::BasicBlock::Create(context, "entry", work_func);
+    llvm::BasicBlock *loop_block =
+        llvm::BasicBlock::Create(context, "loop", work_func);
+    llvm::BasicBlock *exit_block =
+        llvm::BasicBlock::Create(context, "exit", work_func);
+
+    llvm::IRBuilder<> ir_builder{context};
+    llvm::Argument *x = work_func->getArg(0);
+    llvm::Argument *count = work_func->getArg(1);
+
+    ir_builder.SetInsertPoint(entry_block);
+    ir_builder.CreateBr(loop_block);
+
+    ir_builder.SetInsertPoint(loop_block);
+    llvm::PHINode *index = ir_builder.CreatePHI(long_type, 2, "index");
+    llvm::PHINode *accumulator = ir_builder.CreatePHI(double_type, 2, "acc");
+    index->addIncoming(llvm::ConstantInt::get(long_type, 0), entry_block);
+    accumulator->addIncoming(x, entry_block);
+
+    llvm::Value *value = accumulator;
+    for (unsigned statement = 0; statement < statement_count; ++statement) {
+        llvm::Constant *constant = llvm::ConstantFP::get(
+            double_type, 1.0 + (seed + statement) % 7 / 8.0);
+        switch (statement % 3) {
+        case 0:
+            value = ir_builder.CreateFMul(value, constant);
+            break;
+        case 1:
+            value = ir_builder.CreateFAdd(value, x);
+            break;
+        default:
+            value = ir_builder.CreateFSub(value, constant);
+            break;
+        }
+    }
+
+    llvm::Value *next_index =
+        ir_builder.CreateAdd(index, llvm::ConstantInt::get(long_type, 1));
+    index->addIncoming(next_index, loop_block);
+    accumulator->addIncoming(value, loop_block);
+    ir_builder.CreateCondBr(ir_builder.CreateICmpSLT(next_index, count),
+                            loop_block, exit_block);
+
+    ir_builder.SetInsertPoint(exit_block);
+    ir_builder.CreateRet(value);
+
+    return work_func;
+}
+
+// Defines `function_count` work functions named `<name>_<index>`.
+std::unique_ptr<llvm::Module>
+DefineWorkModule(llvm::LLVMContext &context, const std::string &name,
+                 unsigned function_count, unsigned seed = 0,
+                 unsigned statement_count = STATEMENTS_PER_FUNCTION) {
+    auto module = std::make_unique<llvm::Module>(name, context);
+    module->setTargetTriple(GetDefaultTargetTriple().str());
+    module->setDataLayout(GetDefaultDataLayout());
+
+    for (unsigned func = 0; func < function_count; ++func)
+        DefineWorkFunction(*module, name + "_" + llvm::Twine(func),
+                           seed + func, statement_count);
+
+    assert(!llvm::verifyModule(*module, &llvm::errs()));
+    return module;
+}
+
+#endif // INCLUDE_BENCHMARK_WORKLOADS_HPP_
@@ -0,0 +1,174 @@
+#ifndef INCLUDE_BITCODE_MODULE_HPP_
+#define INCLUDE_BITCODE_MODULE_HPP_
+
+#include "OptimizationPipeline.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// Writes `module` to `path` as bitcode, so that later runs can load it
+// instead of building the IR again.
+llvm::Error saveBitcodeModule(const llvm::Module &module,
+                              llvm::StringRef path) {
+    std::error_code ec;
+    llvm::raw_fd_ostream output{path, ec, llvm::sys::fs::OF_None};
+    if (ec)
+        return llvm::errorCodeToError(ec);
+
+    llvm::WriteBitcodeToFile(module, output);
+    output.close();
+
+    if (output.has_error()) {
+        std::error_code write_error = output.error();
+        output.clear_error();
+        return llvm::errorCodeToError(write_error);
+    }
+
+    return llvm::Error::success();
+}
+
+// Loads the bitcode module in `buffer` into `context`.
+//
+// Function bodies are read lazily: only `function_names` and whatever their
+// bodies and the module's global initializers refer to are parsed, every
+// other function is dropped without ever being read. An empty list loads
+// all functions.
+llvm::Expected<std::unique_ptr<llvm::Module>>
+loadBitcodeModule(std::unique_ptr<llvm::MemoryBuffer> buffer,
+                  llvm::LLVMContext &context,
+                  llvm::ArrayRef<llvm::StringRef> function_names = {}) {
+    std::string name = buffer->getBufferIdentifier().str();
+
+    auto lazy_module = llvm::getOwningLazyBitcodeModule(
+        std::move(buffer), context, /*ShouldLazyLoadMetadata*/ true);
+    if (!lazy_module)
+        return llvm::createFileError(name, lazy_module.takeError());
+
+    std::unique_ptr<llvm::Module> module = std::move(*lazy_module);
+
+    if (function_names.empty()) {
+        if (auto err = module->materializeAll())
+            return {std::move(err)};
+        return {std::move(module)};
+    }
+
+    // Functions to parse, starting from the requested ones and the
+    // functions global initializers refer to
+    llvm::SmallPtrSet<llvm::Function *, 16> needed;
+    llvm::SmallVector<llvm::Function *, 16> worklist;
+    llvm::SmallVector<const llvm::Value *, 16> operands;
+
+    auto need = [&](llvm::Function *function) {
+        if (function != nullptr && needed.insert(function).second)
+            worklist.push_back(function);
+    };
+    auto need_referenced = [&](const llvm::Value *root) {
+        operands.push_back(root);
+        while (!operands.empty()) {
+            const llvm::Value *value = operands.pop_back_val();
+            if (const auto *function = llvm::dyn_cast<llvm::Function>(value))
+                need(const_cast<llvm::Function *>(function));
+            else if (const auto *constant =
+                         llvm::dyn_cast<llvm::Constant>(value))
+                operands.append(constant->op_begin(), constant->op_end());
+        }
+    };
+
+    for (llvm::StringRef function_name : function_names) {
+        llvm::Function *function = module->getFunction(function_name);
+        if (function == nullptr)
+            return llvm::createStringError(
+                std::error_code{}, "No function \"%s\" in %s",
+                function_name.str().c_str(), name.c_str());
+        need(function);
+    }
+
+    for (const llvm::GlobalVariable &global : module->globals()) {
+        if (global.hasInitializer())
+            need_referenced(global.getInitializer());
+    }
+
+    while (!worklist.empty()) {
+        llvm::Function *function = worklist.pop_back_val();
+        if (auto err = function->materialize())
+            return {std::move(err)};
+
+        for (const llvm::BasicBlock &block : *function) {
+            for (const llvm::Instruction &instruction : block) {
+                for (const llvm::Value *operand : instruction.operands())
+                    need_referenced(operand);
+            }
+        }
+    }
+
+    // Drop the bodies that were never read, as llvm-extract does
+    std::vector<llvm::Function *> unused;
+    for (llvm::Function &function : *module) {
+        if (function.isMaterializable() && needed.count(&function) == 0) {
+            function.deleteBody();
+            function.setComdat(nullptr);
+            unused.push_back(&function);
+        }
+    }
+    for (llvm::Function *function : unused) {
+        if (function->use_empty())
+            function->eraseFromParent();
+    }
+
+    if (auto err = module->materializeAll())
+        return {std::move(err)};
+
+    return {std::move(module)};
+}
+
+// Loads the bitcode module at `path` into `context`, as above.
+llvm::Expected<std::unique_ptr<llvm::Module>>
+loadBitcodeModule(llvm::StringRef path, llvm::LLVMContext &context,
+                  llvm::ArrayRef<llvm::StringRef> function_names = {}) {
+    auto file_buffer = llvm::MemoryBuffer::getFile(
+        path, /*FileSize*/ -1, /*RequiresNullTerminator*/ false);
+    if (!file_buffer)
+        return llvm::createFileError(path, file_buffer.getError());
+
+    return loadBitcodeModule(std::move(*file_buffer), context,
+                             function_names);
+}
+
+// Loads the bitcode module at `path` as loadBitcodeModule() does and adds it
+// to `compiler` as `module_name`, in a context of its own.
+llvm::Error
+addBitcodeModule(SimpleJITCompiler &compiler, std::string_view module_name,
+                 llvm::StringRef path,
+                 llvm::ArrayRef<llvm::StringRef> function_names = {},
+                 OptLevel opt_level = OptLevel::O0) {
+    auto context = std::make_unique<llvm::LLVMContext>();
+
+    auto module = loadBitcodeModule(path, *context, function_names);
+    if (!module)
+        return module.takeError();
+
+    return compiler.add(module_name, std::move(*module), std::move(context),
+                        opt_level);
+}
+
+#endif // INCLUDE_BITCODE_MODULE_HPP_
@@ -2,68 +2,185 @@
 #define INCLUDE_CREATE_OBJECT_FILE_HPP_
 
 #include "DefaultTarget.hpp"
+#include "DiskObjectCache.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/BinaryFormat/Magic.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include "llvm/Target/TargetMachine.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <system_error>
+#include <thread>
 #include <utility>
+#include <vector>
 
 using OwningObjectFile = llvm::object::OwningBinary<llvm::object::ObjectFile>;
 
+// Maps `file_path` read-only without copying it. Small files may still be
+// read into memory, which the OS does more cheaply than mapping them.
+llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+mapFile(llvm::StringRef file_path) {
+    auto file_buffer = llvm::MemoryBuffer::getFile(
+        file_path, /*FileSize*/ -1, /*RequiresNullTerminator*/ false);
+    if (!file_buffer)
+        return llvm::errorCodeToError(file_buffer.getError());
+
+    return std::move(*file_buffer);
+}
+
+// Parses the object file in `file_path` once, straight from its mapping.
+// With `init_content` false, ELF files skip locating their symbol tables:
+// symbols() is empty then, but sections, relocations and the symbols they
+// refer to are still read through the section links.
 llvm::Expected<OwningObjectFile>
-createObjectFileFromSource(llvm::StringRef file_path) {
+createObjectFileFromSource(llvm::StringRef file_path,
+                           bool init_content = true) {
 
-    llvm::LLVMContext context{};
+    auto file_buffer = mapFile(file_path);
+    if (!file_buffer)
+        return file_buffer.takeError();
 
-    // Create Binary File from source
-    std::unique_ptr<llvm::object::Binary> binary_file;
-    std::unique_ptr<llvm::MemoryBuffer> file_buffer;
+    auto object_file = llvm::object::ObjectFile::createObjectFile(
+        (*file_buffer)->getMemBufferRef(), llvm::file_magic::unknown,
+        init_content);
+    if (!object_file)
+        return object_file.takeError();
 
-    {
-        auto expected_binary_file = llvm::object::createBinary(
-            file_path, &context, /*initContent*/ true);
+    return OwningObjectFile{std::move(*object_file), std::move(*file_buffer)};
+}
 
-        if (!expected_binary_file) {
-            return {expected_binary_file.takeError()};
-        }
+// Loads many object files, mapping each path only once. The returned
+// ObjectFiles are views into mappings owned by the loader and live as long
+// as it does. load() is thread-safe, so one loader can be shared by the
+// threads scanning a build tree; loadAll() uses that to map files in
+// parallel.
+class ObjectFileLoader {
+  public:
+    explicit ObjectFileLoader(bool init_content = true)
+        : init_content_{init_content} {}
 
-        std::tie(binary_file, file_buffer) = expected_binary_file->takeBinary();
-    }
+    llvm::Expected<llvm::object::ObjectFile &> load(llvm::StringRef file_path);
 
-    // Create ObjectFile from Binary
-    std::unique_ptr<llvm::object::ObjectFile> object_file;
+    // Loads `file_paths` on `thread_count` threads (0: one per hardware
+    // thread) and returns them in order. A file that fails to load does not
+    // stop the others.
+    std::vector<llvm::Expected<llvm::object::ObjectFile &>>
+    loadAll(llvm::ArrayRef<std::string> file_paths, unsigned thread_count = 1);
 
-    {
-        auto expected_object_file =
-            llvm::object::ObjectFile::createObjectFile(*file_buffer);
+    size_t getFileCount() const;
+    uint64_t getMappedBytes() const;
 
-        if (!expected_object_file) {
-            return {expected_object_file.takeError()};
-        }
+  private:
+    bool init_content_;
 
-        object_file = std::move(expected_object_file.get());
+    mutable std::mutex mutex_;
+    llvm::StringMap<OwningObjectFile> object_files_;
+    uint64_t mapped_bytes_ = 0;
+};
+
+llvm::Expected<llvm::object::ObjectFile &>
+ObjectFileLoader::load(llvm::StringRef file_path) {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto loaded = object_files_.find(file_path);
+        if (loaded != object_files_.end())
+            return *loaded->second.getBinary();
     }
 
-    return OwningObjectFile{std::move(object_file), std::move(file_buffer)};
+    // Map and parse without holding the lock so that threads loading
+    // different files do not wait on each other.
+    auto object_file = createObjectFileFromSource(file_path, init_content_);
+    if (!object_file)
+        return object_file.takeError();
+
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto loaded = object_files_.try_emplace(file_path, std::move(*object_file));
+    if (loaded.second)
+        mapped_bytes_ += loaded.first->second.getBinary()->getData().size();
+
+    return *loaded.first->second.getBinary();
 }
 
+std::vector<llvm::Expected<llvm::object::ObjectFile &>>
+ObjectFileLoader::loadAll(llvm::ArrayRef<std::string> file_paths,
+                          unsigned thread_count) {
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::min<size_t>(thread_count, file_paths.size());
+
+    std::vector<llvm::Optional<llvm::Expected<llvm::object::ObjectFile &>>>
+        loaded(file_paths.size());
+    std::atomic<size_t> next_index{0};
+
+    auto run_worker = [&]() {
+        for (size_t index = next_index++; index < file_paths.size();
+             index = next_index++)
+            loaded[index].emplace(load(file_paths[index]));
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned worker = 1; worker < thread_count; ++worker)
+        workers.emplace_back(run_worker);
+
+    // The calling thread is the first worker
+    if (thread_count > 0)
+        run_worker();
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    std::vector<llvm::Expected<llvm::object::ObjectFile &>> object_files;
+    object_files.reserve(file_paths.size());
+    for (auto &object_file : loaded)
+        object_files.push_back(std::move(*object_file));
+
+    return object_files;
+}
+
+size_t ObjectFileLoader::getFileCount() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return object_files_.size();
+}
+
+uint64_t ObjectFileLoader::getMappedBytes() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return mapped_bytes_;
+}
+
+// Compiles `module` with `target_machine`, or loads its object from
+// `object_cache` if it has been compiled before.
 llvm::Expected<OwningObjectFile>
-createObjectFileFromModule(llvm::Module &module) {
+emitObjectFile(llvm::Module &module, llvm::TargetMachine &target_machine,
+               DiskObjectCache *object_cache) {
 
     std::unique_ptr<llvm::MemoryBuffer> object_buffer;
 
-    {
+    if (object_cache != nullptr)
+        object_buffer = object_cache->getObject(&module);
+
+    if (!object_buffer) {
         llvm::SmallVector<char> compiled_buffer;
         llvm::raw_svector_ostream output_stream{compiled_buffer};
         llvm::legacy::PassManager pass_manager;
 
-        bool pass_manager_err = GetDefaultTargetMachine()->addPassesToEmitFile(
+        bool pass_manager_err = target_machine.addPassesToEmitFile(
             pass_manager, output_stream, nullptr, llvm::CGFT_ObjectFile);
         if (pass_manager_err) {
             return llvm::make_error<llvm::StringError>(
@@ -74,6 +191,10 @@ createObjectFileFromModule(llvm::Module &module) {
 
         object_buffer = std::make_unique<llvm::SmallVectorMemoryBuffer>(
             std::move(compiled_buffer));
+
+        if (object_cache != nullptr)
+            object_cache->notifyObjectCompiled(
+                &module, object_buffer->getMemBufferRef());
     }
 
     // Create ObjectFile from Binary
@@ -93,4 +214,105 @@ createObjectFileFromModule(llvm::Module &module) {
     return OwningObjectFile{std::move(object_file), std::move(object_buffer)};
 }
 
+llvm::Error checkObjectCacheTarget(const DiskObjectCache *object_cache,
+                                   const llvm::TargetMachine &target_machine) {
+    if (object_cache != nullptr && !object_cache->matches(target_machine)) {
+        return llvm::make_error<llvm::StringError>(
+            std::error_code{}, "Object cache was created for another target");
+    }
+
+    return llvm::Error::success();
+}
+
+llvm::Expected<OwningObjectFile>
+createObjectFileFromModule(llvm::Module &module,
+                           TargetCPU cpu = TargetCPU::Generic,
+                           DiskObjectCache *object_cache = nullptr) {
+
+    llvm::TargetMachine &target_machine = *GetDefaultTargetMachine(cpu);
+
+    if (auto err = checkObjectCacheTarget(object_cache, target_machine))
+        return {std::move(err)};
+
+    return emitObjectFile(module, target_machine, object_cache);
+}
+
+// Receives the object of `modules[index]` as soon as it has been compiled.
+// Calls come from the worker threads but never overlap.
+using ObjectFileConsumer =
+    std::function<void(size_t index, llvm::Expected<OwningObjectFile>)>;
+
+// Compiles `modules` on `thread_count` worker threads (0: one per hardware
+// thread), each with its own TargetMachine, and streams the objects to
+// `consumer` in completion order. Modules sharing an LLVMContext are compiled
+// one after another on the same worker, since a context must not be used by
+// two threads at once. Returns once every module has been consumed.
+llvm::Error createObjectFilesFromModules(
+    llvm::ArrayRef<llvm::Module *> modules, ObjectFileConsumer consumer,
+    TargetCPU cpu = TargetCPU::Generic, unsigned thread_count = 0,
+    DiskObjectCache *object_cache = nullptr) {
+
+    // Group module indices by context
+    std::vector<std::vector<size_t>> work_items;
+    {
+        llvm::DenseMap<llvm::LLVMContext *, size_t> context_items;
+        for (size_t index = 0; index < modules.size(); ++index) {
+            auto item = context_items.try_emplace(&modules[index]->getContext(),
+                                                  work_items.size());
+            if (item.second)
+                work_items.emplace_back();
+            work_items[item.first->second].push_back(index);
+        }
+    }
+
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::min<size_t>(thread_count, work_items.size());
+
+    // TargetMachines are created up front so that a target error is
+    // reported before any work starts
+    std::vector<std::unique_ptr<llvm::TargetMachine>> target_machines;
+    for (unsigned worker = 0; worker < thread_count; ++worker) {
+        target_machines.push_back(CreateTargetMachine(cpu));
+        if (!target_machines.back()) {
+            return llvm::make_error<llvm::StringError>(
+                std::error_code{}, "Failed to create target machine");
+        }
+
+        if (auto err =
+                checkObjectCacheTarget(object_cache, *target_machines.back()))
+            return err;
+    }
+
+    std::atomic<size_t> next_item{0};
+    std::mutex consumer_mutex;
+
+    auto run_worker = [&](llvm::TargetMachine &target_machine) {
+        for (size_t item = next_item++; item < work_items.size();
+             item = next_item++) {
+            for (size_t index : work_items[item]) {
+                auto object_file =
+                    emitObjectFile(*modules[index], target_machine,
+                                   object_cache);
+
+                std::lock_guard<std::mutex> lock{consumer_mutex};
+                consumer(index, std::move(object_file));
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned worker = 1; worker < thread_count; ++worker)
+        workers.emplace_back(run_worker, std::ref(*target_machines[worker]));
+
+    // The calling thread is the first worker
+    if (thread_count > 0)
+        run_worker(*target_machines[0]);
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    return llvm::Error::success();
+}
+
 #endif // INCLUDE_CREATE_OBJECT_FILE_HPP_
@@ -0,0 +1,26 @@
+#ifndef INCLUDE_DECLARE_FUNCTION_HPP_
+#define INCLUDE_DECLARE_FUNCTION_HPP_
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+
+constexpr unsigned SMALL_ARITY = 4;
+
+llvm::Function *
+DeclareFunction(llvm::Module &module, const llvm::Twine &func_name,
+                llvm::Type *ret_type,
+                const llvm::SmallVector<llvm::Type *, SMALL_ARITY> &arg_types) {
+    bool isVarArg = false;
+    auto func_linkage = llvm::Function::ExternalLinkage;
+
+    llvm::FunctionType *func_type =
+        llvm::FunctionType::get(ret_type, arg_types, isVarArg);
+
+    return llvm::Function::Create(func_type, func_linkage, func_name, module);
+}
+
+#endif // INCLUDE_DECLARE_FUNCTION_HPP_
@@ -1,18 +1,30 @@
 #ifndef DEFAULT_TARGETS_HPP_
 #define DEFAULT_TARGETS_HPP_
 
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/MC/SubtargetFeature.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
+#include <memory>
+#include <string>
 
-void InitializeAllTargets() {
+// CPU a TargetMachine generates code for. Generic objects run on any machine
+// of the default triple, Host objects use the CPU name and feature set (e.g.
+// AVX2/AVX-512) detected on the running machine.
+enum class TargetCPU { Generic, Host };
+
+// Registers the target code is generated for, once per process. Only the
+// native target is initialized; registering every built target costs
+// startup time for targets that are never used.
+void InitializeDefaultTarget() {
     static const bool initialized = []() {
-        llvm::InitializeAllTargets();
-        llvm::InitializeAllTargetMCs();
-        llvm::InitializeAllAsmPrinters();
-        llvm::InitializeAllAsmParsers();
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
         return true;
     }();
 
@@ -25,29 +37,78 @@ const llvm::Triple &GetDefaultTargetTriple() {
     return default_triple;
 }
 
-llvm::TargetMachine *GetDefaultTargetMachine() {
-    using OwnedTargetMachine = std::unique_ptr<llvm::TargetMachine>;
-
-    static OwnedTargetMachine default_target_machine = []() {
-        InitializeAllTargets();
+const std::string &GetTargetCPUName(TargetCPU cpu) {
+    static const std::string generic_cpu_name{"generic"};
+    static const std::string host_cpu_name{llvm::sys::getHostCPUName()};
 
-        const llvm::Triple &default_triple = GetDefaultTargetTriple();
+    return cpu == TargetCPU::Host ? host_cpu_name : generic_cpu_name;
+}
 
-        std::string lookup_error;
-        const llvm::Target *registered_target =
-            llvm::TargetRegistry::lookupTarget(default_triple.str(),
-                                               lookup_error);
-        if (registered_target == nullptr)
-            return OwnedTargetMachine{};
+const std::string &GetTargetCPUFeatures(TargetCPU cpu) {
+    static const std::string generic_cpu_features{};
+    static const std::string host_cpu_features = []() {
+        llvm::SubtargetFeatures features;
+        llvm::StringMap<bool> host_features;
 
-        llvm::TargetOptions opt{};
-        llvm::Optional<llvm::Reloc::Model> reloc_model{llvm::Reloc::PIC_};
+        if (llvm::sys::getHostCPUFeatures(host_features)) {
+            for (const auto &feature : host_features)
+                features.AddFeature(feature.first(), feature.second);
+        }
 
-        return OwnedTargetMachine{registered_target->createTargetMachine(
-            default_triple.str(), "generic", "", opt, reloc_model)};
+        return features.getString();
     }();
 
-    return default_target_machine.get();
+    return cpu == TargetCPU::Host ? host_cpu_features : generic_cpu_features;
+}
+
+std::unique_ptr<llvm::TargetMachine>
+CreateTargetMachine(TargetCPU cpu = TargetCPU::Generic) {
+    InitializeDefaultTarget();
+
+    const llvm::Triple &default_triple = GetDefaultTargetTriple();
+
+    std::string lookup_error;
+    const llvm::Target *registered_target =
+        llvm::TargetRegistry::lookupTarget(default_triple.str(), lookup_error);
+    if (registered_target == nullptr)
+        return nullptr;
+
+    llvm::TargetOptions opt{};
+    llvm::Optional<llvm::Reloc::Model> reloc_model{llvm::Reloc::PIC_};
+
+    return std::unique_ptr<llvm::TargetMachine>{
+        registered_target->createTargetMachine(
+            default_triple.str(), GetTargetCPUName(cpu),
+            GetTargetCPUFeatures(cpu), opt, reloc_model)};
+}
+
+llvm::TargetMachine *
+GetDefaultTargetMachine(TargetCPU cpu = TargetCPU::Generic) {
+    using OwnedTargetMachine = std::unique_ptr<llvm::TargetMachine>;
+
+    if (cpu == TargetCPU::Host) {
+        static OwnedTargetMachine host_target_machine =
+            CreateTargetMachine(TargetCPU::Host);
+        return host_target_machine.get();
+    }
+
+    static OwnedTargetMachine generic_target_machine =
+        CreateTargetMachine(TargetCPU::Generic);
+    return generic_target_machine.get();
+}
+
+// Describes the same target as CreateTargetMachine() for ORC components that
+// build their own TargetMachine, e.g. one per compile thread.
+llvm::orc::JITTargetMachineBuilder
+CreateJITTargetMachineBuilder(TargetCPU cpu = TargetCPU::Generic) {
+    InitializeDefaultTarget();
+
+    llvm::orc::JITTargetMachineBuilder builder{GetDefaultTargetTriple()};
+    builder.setCPU(GetTargetCPUName(cpu));
+    builder.getFeatures() = llvm::SubtargetFeatures{GetTargetCPUFeatures(cpu)};
+    builder.setRelocationModel(llvm::Reloc::PIC_);
+
+    return builder;
 }
 
 const llvm::DataLayout &GetDefaultDataLayout() {
@@ -0,0 +1,236 @@
+#ifndef INCLUDE_DEFINE_FACTORIAL_HPP_
+#define INCLUDE_DEFINE_FACTORIAL_HPP_
+
+#include "DeclareFunction.hpp"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Verifier.h"
+#include <cassert>
+
+// How DefineFactorial expresses the recursion of `int64_t factorial(int64_t)`.
+enum class RecursionLowering {
+    // n * factorial(n - 1): one stack frame per step unless the optimizer
+    // turns it into a loop.
+    Naive,
+    // An accumulator helper calling itself with `musttail`, which runs in
+    // constant stack even without optimization.
+    TailCall,
+    // A loop over an accumulator.
+    Loop,
+};
+
+llvm::Optional<RecursionLowering> parseRecursionLowering(llvm::StringRef name) {
+    return llvm::StringSwitch<llvm::Optional<RecursionLowering>>(name)
+        .Case("naive", RecursionLowering::Naive)
+        .Case("tail", RecursionLowering::TailCall)
+        .Case("loop", RecursionLowering::Loop)
+        .Default(llvm::None);
+}
+
+llvm::StringRef getRecursionLoweringName(RecursionLowering lowering) {
+    switch (lowering) {
+    case RecursionLowering::Naive:
+        return "naive";
+    case RecursionLowering::TailCall:
+        return "tail";
+    case RecursionLowering::Loop:
+        return "loop";
+    }
+    return "naive";
+}
+
+llvm::Function *DefineNaiveFactorial(llvm::Module &module) {
+    llvm::LLVMContext &context = module.getContext();
+
+    // Declare functions
+    llvm::Type *long_type = llvm::Type::getInt64Ty(context);
+
+    llvm::Function *factorial =
+        DeclareFunction(module, "factorial", long_type, {long_type});
+
+    // Insert instructions to function
+    llvm::IRBuilder<> inst_builder{context};
+    llvm::Argument *factorial_arg = factorial->getArg(0);
+
+    llvm::BasicBlock *entry_block =
+        llvm::BasicBlock::Create(context, "entry", factorial);
+    llvm::BasicBlock *early_ret_block =
+        llvm::BasicBlock::Create(context, "early_ret", factorial);
+    llvm::BasicBlock *recursive_block =
+        llvm::BasicBlock::Create(context, "recursive", factorial);
+
+    llvm::Constant *zero_int64 =
+        llvm::ConstantInt::get(long_type, 0, /*is_signed*/ true);
+    llvm::Constant *one_int64 =
+        llvm::ConstantInt::get(long_type, 1, /*is_signed*/ true);
+
+    { // Base case
+        inst_builder.SetInsertPoint(entry_block);
+        llvm::Value *base_condition =
+            inst_builder.CreateICmpEQ(factorial_arg, zero_int64);
+        inst_builder.CreateCondBr(base_condition, early_ret_block,
+                                  recursive_block);
+    }
+
+    { // Early Ret block
+        inst_builder.SetInsertPoint(early_ret_block);
+        inst_builder.CreateRet(one_int64);
+    }
+
+    { // Recursive case
+        inst_builder.SetInsertPoint(recursive_block);
+        llvm::Value *decremented_arg =
+            inst_builder.CreateSub(factorial_arg, one_int64);
+        llvm::CallInst *recursive_call =
+            inst_builder.CreateCall(factorial, decremented_arg);
+        llvm::Value *ret_val =
+            inst_builder.CreateMul(factorial_arg, recursive_call);
+        inst_builder.CreateRet(ret_val);
+    }
+
+    assert(!llvm::verifyFunction(*factorial));
+    return factorial;
+}
+
+llvm::Function *DefineTailCallFactorial(llvm::Module &module) {
+    llvm::LLVMContext &context = module.getContext();
+
+    // Declare functions
+    llvm::Type *long_type = llvm::Type::getInt64Ty(context);
+
+    llvm::Function *factorial =
+        DeclareFunction(module, "factorial", long_type, {long_type});
+    llvm::Function *factorial_acc = DeclareFunction(
+        module, "factorial_acc", long_type, {long_type, long_type});
+    factorial_acc->setLinkage(llvm::Function::InternalLinkage);
+
+    llvm::IRBuilder<> inst_builder{context};
+    llvm::Constant *zero_int64 =
+        llvm::ConstantInt::get(long_type, 0, /*is_signed*/ true);
+    llvm::Constant *one_int64 =
+        llvm::ConstantInt::get(long_type, 1, /*is_signed*/ true);
+
+    { // factorial(n) = factorial_acc(n, 1)
+        inst_builder.SetInsertPoint(
+            llvm::BasicBlock::Create(context, "entry", factorial));
+        llvm::CallInst *acc_call = inst_builder.CreateCall(
+            factorial_acc, {factorial->getArg(0), one_int64});
+        acc_call->setTailCallKind(llvm::CallInst::TCK_Tail);
+        inst_builder.CreateRet(acc_call);
+    }
+
+    llvm::Argument *counter_arg = factorial_acc->getArg(0);
+    llvm::Argument *product_arg = factorial_acc->getArg(1);
+
+    llvm::BasicBlock *entry_block =
+        llvm::BasicBlock::Create(context, "entry", factorial_acc);
+    llvm::BasicBlock *early_ret_block =
+        llvm::BasicBlock::Create(context, "early_ret", factorial_acc);
+    llvm::BasicBlock *recursive_block =
+        llvm::BasicBlock::Create(context, "recursive", factorial_acc);
+
+    { // Base case
+        inst_builder.SetInsertPoint(entry_block);
+        llvm::Value *base_condition =
+            inst_builder.CreateICmpEQ(counter_arg, zero_int64);
+        inst_builder.CreateCondBr(base_condition, early_ret_block,
+                                  recursive_block);
+    }
+
+    { // Early Ret block
+        inst_builder.SetInsertPoint(early_ret_block);
+        inst_builder.CreateRet(product_arg);
+    }
+
+    { // Recursive case, guaranteed to reuse the caller's frame
+        inst_builder.SetInsertPoint(recursive_block);
+        llvm::Value *decremented_arg =
+            inst_builder.CreateSub(counter_arg, one_int64);
+        llvm::Value *next_product =
+            inst_builder.CreateMul(counter_arg, product_arg);
+        llvm::CallInst *recursive_call = inst_builder.CreateCall(
+            factorial_acc, {decremented_arg, next_product});
+        recursive_call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+        inst_builder.CreateRet(recursive_call);
+    }
+
+    assert(!llvm::verifyFunction(*factorial_acc));
+    assert(!llvm::verifyFunction(*factorial));
+    return factorial;
+}
+
+llvm::Function *DefineLoopFactorial(llvm::Module &module) {
+    llvm::LLVMContext &context = module.getContext();
+
+    // Declare functions
+    llvm::Type *long_type = llvm::Type::getInt64Ty(context);
+
+    llvm::Function *factorial =
+        DeclareFunction(module, "factorial", long_type, {long_type});
+
+    llvm::IRBuilder<> inst_builder{context};
+    llvm::Argument *factorial_arg = factorial->getArg(0);
+
+    llvm::BasicBlock *entry_block =
+        llvm::BasicBlock::Create(context, "entry", factorial);
+    llvm::BasicBlock *loop_block =
+        llvm::BasicBlock::Create(context, "loop", factorial);
+    llvm::BasicBlock *body_block =
+        llvm::BasicBlock::Create(context, "body", factorial);
+    llvm::BasicBlock *exit_block =
+        llvm::BasicBlock::Create(context, "exit", factorial);
+
+    llvm::Constant *zero_int64 =
+        llvm::ConstantInt::get(long_type, 0, /*is_signed*/ true);
+    llvm::Constant *one_int64 =
+        llvm::ConstantInt::get(long_type, 1, /*is_signed*/ true);
+
+    inst_builder.SetInsertPoint(entry_block);
+    inst_builder.CreateBr(loop_block);
+
+    // Counts n down to 0, multiplying the product by each value
+    inst_builder.SetInsertPoint(loop_block);
+    llvm::PHINode *counter = inst_builder.CreatePHI(long_type, 2, "counter");
+    llvm::PHINode *product = inst_builder.CreatePHI(long_type, 2, "product");
+    counter->addIncoming(factorial_arg, entry_block);
+    product->addIncoming(one_int64, entry_block);
+    inst_builder.CreateCondBr(inst_builder.CreateICmpEQ(counter, zero_int64),
+                              exit_block, body_block);
+
+    inst_builder.SetInsertPoint(body_block);
+    counter->addIncoming(inst_builder.CreateSub(counter, one_int64),
+                         body_block);
+    product->addIncoming(inst_builder.CreateMul(counter, product), body_block);
+    inst_builder.CreateBr(loop_block);
+
+    inst_builder.SetInsertPoint(exit_block);
+    inst_builder.CreateRet(product);
+
+    assert(!llvm::verifyFunction(*factorial));
+    return factorial;
+}
+
+// Defines `int64_t factorial(int64_t n)` in `module`.
+llvm::Function *
+DefineFactorial(llvm::Module &module,
+                RecursionLowering lowering = RecursionLowering::Naive) {
+    switch (lowering) {
+    case RecursionLowering::TailCall:
+        return DefineTailCallFactorial(module);
+    case RecursionLowering::Loop:
+        return DefineLoopFactorial(module);
+    default:
+        return DefineNaiveFactorial(module);
+    }
+}
+
+#endif // INCLUDE_DEFINE_FACTORIAL_HPP_
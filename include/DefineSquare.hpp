@@ -0,0 +1,47 @@
+#ifndef INCLUDE_DEFINE_SQUARE_HPP_
+#define INCLUDE_DEFINE_SQUARE_HPP_
+
+#include "DefaultTarget.hpp"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cassert>
+#include <memory>
+
+// Module "square" defining `double square(double)`.
+std::unique_ptr<llvm::Module> DefineSquare(llvm::LLVMContext &context) {
+    auto module = std::make_unique<llvm::Module>("square", context);
+    module->setTargetTriple(GetDefaultTargetTriple().str());
+    module->setDataLayout(GetDefaultDataLayout());
+
+    {
+        // Declare function
+        llvm::Type *double_type = llvm::Type::getDoubleTy(context);
+        llvm::FunctionType *func_type = llvm::FunctionType::get(
+            double_type, {double_type}, /*isVarArg*/ false);
+
+        llvm::Function *square_func = llvm::Function::Create(
+            func_type, llvm::Function::ExternalLinkage, "square", *module);
+
+        // Add instructions
+        llvm::IRBuilder<> ir_builder{context};
+        llvm::BasicBlock *entry_block =
+            llvm::BasicBlock::Create(context, "", square_func);
+
+        ir_builder.SetInsertPoint(entry_block);
+        llvm::Argument *func_arg = square_func->getArg(0);
+        llvm::Value *result = ir_builder.CreateFMul(func_arg, func_arg);
+        ir_builder.CreateRet(result);
+    }
+
+    assert(!llvm::verifyModule(*module, &llvm::errs()));
+    return module;
+}
+
+#endif // INCLUDE_DEFINE_SQUARE_HPP_
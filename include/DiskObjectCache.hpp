@@ -0,0 +1,316 @@
+#ifndef INCLUDE_DISK_OBJECT_CACHE_HPP_
+#define INCLUDE_DISK_OBJECT_CACHE_HPP_
+
+#include "OptimizationPipeline.hpp"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// Directory the demos keep their cached objects in, e.g.
+// ~/.cache/llvm-example/objects.
+std::string GetDefaultObjectCacheDirectory() {
+    llvm::SmallString<128> directory;
+    if (!llvm::sys::path::cache_directory(directory))
+        llvm::sys::path::system_temp_directory(/*ErasedOnReboot*/ false,
+                                               directory);
+
+    llvm::sys::path::append(directory, "llvm-example", "objects");
+    return directory.str().str();
+}
+
+// Persistent llvm::ObjectCache storing one object file per module on disk.
+//
+// Objects are keyed by a SHA1 over the module bitcode, its OptLevel and the
+// triple, CPU, feature string and codegen level of the TargetMachine the
+// cache was created for, so it must only be handed to compilers using an
+// equivalent TargetMachine (see matches()). Cached objects are memory-mapped
+// back in on a hit.
+//
+// A module can be tagged with its key before it is optimized. The object is
+// then filed under the key of the unoptimized IR, which lets a JIT skip the
+// optimization pipeline as well as codegen on a warm start. Tagging also
+// lets a JIT that compiles some modules at another codegen level than the
+// TargetMachine's, such as tier-0 modules, keep their objects apart.
+class DiskObjectCache : public llvm::ObjectCache {
+  public:
+    struct Statistics {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t stores = 0;
+        std::chrono::nanoseconds time_saved{0};
+    };
+
+    DiskObjectCache(std::string directory,
+                    const llvm::TargetMachine &target_machine);
+
+    void notifyObjectCompiled(const llvm::Module *module,
+                              llvm::MemoryBufferRef object) override;
+
+    std::unique_ptr<llvm::MemoryBuffer>
+    getObject(const llvm::Module *module) override;
+
+    // Records the key of `module`, to be compiled at `codegen_level`, in its
+    // named metadata and starts timing its compilation. Later changes to the
+    // module do not change its key.
+    void tagModule(llvm::Module &module, llvm::CodeGenOpt::Level codegen_level);
+
+    // Loads the object of `module` ahead of its compilation and hands the
+    // outcome to the next getObject() for this very module, so that whether
+    // to skip optimization is decided on the object the compiler will get.
+    // True on a hit.
+    bool prefetchObject(const llvm::Module &module);
+
+    bool matches(const llvm::TargetMachine &target_machine) const;
+
+    Statistics getStatistics() const;
+    void printStatistics(llvm::raw_ostream &os) const;
+
+  private:
+    static constexpr const char *KEY_METADATA = "disk-object-cache.key";
+
+    static std::string
+    describeTarget(const llvm::TargetMachine &target_machine);
+
+    std::string getKey(const llvm::Module &module) const;
+    std::string getKey(const llvm::Module &module,
+                       llvm::CodeGenOpt::Level codegen_level) const;
+    std::unique_ptr<llvm::MemoryBuffer> loadObject(llvm::StringRef key);
+    std::string getObjectPath(llvm::StringRef key) const;
+    std::string getCompileTimePath(llvm::StringRef key) const;
+
+    struct PrefetchedObject {
+        std::string key;
+        // Null for a miss
+        std::unique_ptr<llvm::MemoryBuffer> object;
+    };
+
+    std::string directory_;
+    // Triple, CPU and features
+    std::string target_description_;
+    llvm::CodeGenOpt::Level codegen_level_;
+
+    mutable std::mutex mutex_;
+    Statistics statistics_;
+    llvm::StringMap<std::chrono::steady_clock::time_point> compile_starts_;
+    // By module rather than key, so that identical modules compiled at the
+    // same time each get their own
+    llvm::DenseMap<const llvm::Module *, PrefetchedObject> prefetched_objects_;
+};
+
+DiskObjectCache::DiskObjectCache(std::string directory,
+                                 const llvm::TargetMachine &target_machine)
+    : directory_{std::move(directory)},
+      target_description_{describeTarget(target_machine)},
+      codegen_level_{target_machine.getOptLevel()} {
+    // A cache that cannot create its directory simply never hits.
+    llvm::consumeError(
+        llvm::errorCodeToError(llvm::sys::fs::create_directories(directory_)));
+}
+
+void DiskObjectCache::notifyObjectCompiled(const llvm::Module *module,
+                                           llvm::MemoryBufferRef object) {
+    std::string key = getKey(*module);
+    auto now = std::chrono::steady_clock::now();
+
+    std::chrono::nanoseconds compile_time{0};
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto start = compile_starts_.find(key);
+        if (start != compile_starts_.end()) {
+            compile_time = now - start->second;
+            compile_starts_.erase(start);
+        }
+    }
+
+    // Write to a temporary file and rename, so that concurrent processes
+    // never map a partially written object.
+    std::string object_path = getObjectPath(key);
+    llvm::Error err = llvm::writeFileAtomically(
+        object_path + "-%%%%%%.tmp", object_path, object.getBuffer());
+    if (err) {
+        llvm::consumeError(std::move(err));
+        return;
+    }
+
+    std::string compile_time_path = getCompileTimePath(key);
+    llvm::consumeError(llvm::writeFileAtomically(
+        compile_time_path + "-%%%%%%.tmp", compile_time_path,
+        std::to_string(compile_time.count())));
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    ++statistics_.stores;
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+DiskObjectCache::getObject(const llvm::Module *module) {
+    std::string key = getKey(*module);
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto prefetched = prefetched_objects_.find(module);
+        if (prefetched != prefetched_objects_.end()) {
+            PrefetchedObject prefetched_object = std::move(prefetched->second);
+            prefetched_objects_.erase(prefetched);
+            // A stale entry would be of an earlier module at this address
+            if (prefetched_object.key == key)
+                return std::move(prefetched_object.object);
+        }
+    }
+
+    return loadObject(key);
+}
+
+void DiskObjectCache::tagModule(llvm::Module &module,
+                                llvm::CodeGenOpt::Level codegen_level) {
+    if (module.getNamedMetadata(KEY_METADATA) != nullptr)
+        return;
+
+    std::string key = getKey(module, codegen_level);
+
+    llvm::LLVMContext &context = module.getContext();
+    llvm::NamedMDNode *node = module.getOrInsertNamedMetadata(KEY_METADATA);
+    node->addOperand(
+        llvm::MDNode::get(context, {llvm::MDString::get(context, key)}));
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    compile_starts_.try_emplace(key, std::chrono::steady_clock::now());
+}
+
+bool DiskObjectCache::prefetchObject(const llvm::Module &module) {
+    std::string key = getKey(module);
+    std::unique_ptr<llvm::MemoryBuffer> object = loadObject(key);
+    bool hit = object != nullptr;
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    prefetched_objects_[&module] = {std::move(key), std::move(object)};
+    return hit;
+}
+
+bool DiskObjectCache::matches(
+    const llvm::TargetMachine &target_machine) const {
+    return describeTarget(target_machine) == target_description_ &&
+           target_machine.getOptLevel() == codegen_level_;
+}
+
+DiskObjectCache::Statistics DiskObjectCache::getStatistics() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return statistics_;
+}
+
+void DiskObjectCache::printStatistics(llvm::raw_ostream &os) const {
+    Statistics statistics = getStatistics();
+
+    os << "Object cache " << directory_ << '\n'
+       << llvm::format("  hits %llu, misses %llu, stores %llu, saved %.3f ms\n",
+                       static_cast<unsigned long long>(statistics.hits),
+                       static_cast<unsigned long long>(statistics.misses),
+                       static_cast<unsigned long long>(statistics.stores),
+                       statistics.time_saved.count() / 1e6);
+}
+
+std::string
+DiskObjectCache::describeTarget(const llvm::TargetMachine &target_machine) {
+    std::string description;
+    llvm::raw_string_ostream description_stream{description};
+    description_stream << target_machine.getTargetTriple().str() << '\n'
+                       << target_machine.getTargetCPU() << '\n'
+                       << target_machine.getTargetFeatureString() << '\n';
+    return description_stream.str();
+}
+
+std::string DiskObjectCache::getKey(const llvm::Module &module) const {
+    if (llvm::NamedMDNode *node = module.getNamedMetadata(KEY_METADATA)) {
+        if (node->getNumOperands() > 0) {
+            if (auto *key = llvm::dyn_cast<llvm::MDString>(
+                    node->getOperand(0)->getOperand(0)))
+                return key->getString().str();
+        }
+    }
+
+    return getKey(module, codegen_level_);
+}
+
+std::string
+DiskObjectCache::getKey(const llvm::Module &module,
+                        llvm::CodeGenOpt::Level codegen_level) const {
+    llvm::SmallVector<char, 0> key_material;
+    llvm::raw_svector_ostream key_stream{key_material};
+    key_stream << target_description_ << static_cast<int>(codegen_level)
+               << '\n' << getOptLevelName(getModuleOptLevel(module)) << '\n';
+    llvm::WriteBitcodeToFile(module, key_stream);
+
+    auto digest = llvm::SHA1::hash(llvm::ArrayRef<uint8_t>{
+        reinterpret_cast<const uint8_t *>(key_material.data()),
+        key_material.size()});
+
+    return llvm::toHex(digest, /*LowerCase*/ true);
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+DiskObjectCache::loadObject(llvm::StringRef key) {
+    auto start = std::chrono::steady_clock::now();
+
+    auto object = llvm::MemoryBuffer::getFile(getObjectPath(key),
+                                              /*FileSize*/ -1,
+                                              /*RequiresNullTerminator*/ false);
+    if (!object) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        ++statistics_.misses;
+        compile_starts_.try_emplace(key, start);
+        return nullptr;
+    }
+
+    auto load_time = std::chrono::steady_clock::now() - start;
+
+    std::chrono::nanoseconds compile_time{0};
+    if (auto compile_time_file =
+            llvm::MemoryBuffer::getFile(getCompileTimePath(key))) {
+        long long nanoseconds = 0;
+        if (!(*compile_time_file)->getBuffer().getAsInteger(10, nanoseconds))
+            compile_time = std::chrono::nanoseconds{nanoseconds};
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    ++statistics_.hits;
+    compile_starts_.erase(key);
+    if (compile_time > load_time)
+        statistics_.time_saved += compile_time - load_time;
+
+    return std::move(*object);
+}
+
+std::string DiskObjectCache::getObjectPath(llvm::StringRef key) const {
+    llvm::SmallString<128> path{directory_};
+    llvm::sys::path::append(path, key + ".o");
+    return path.str().str();
+}
+
+std::string DiskObjectCache::getCompileTimePath(llvm::StringRef key) const {
+    llvm::SmallString<128> path{directory_};
+    llvm::sys::path::append(path, key + ".compile-ns");
+    return path.str().str();
+}
+
+#endif // INCLUDE_DISK_OBJECT_CACHE_HPP_
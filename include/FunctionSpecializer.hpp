@@ -0,0 +1,376 @@
+#ifndef INCLUDE_FUNCTION_SPECIALIZER_HPP_
+#define INCLUDE_FUNCTION_SPECIALIZER_HPP_
+
+#include "BitcodeModule.hpp"
+#include "OptimizationPipeline.hpp"
+#include "SimpleJITCompiler.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Suffix of the specialization of a function in its specialization module.
+constexpr const char *SPECIALIZED_FUNCTION_SUFFIX = ".spec";
+
+// An argument of a function bound to a constant. Integer bindings apply to
+// integer arguments of any width, truncating the value, floating-point
+// bindings to floating-point arguments of any precision.
+struct ArgumentBinding {
+    enum class Kind {
+        Integer,
+        FloatingPoint,
+    };
+
+    unsigned index = 0;
+    Kind kind = Kind::Integer;
+    int64_t integer = 0;
+    double floating_point = 0.0;
+};
+
+ArgumentBinding bindInteger(unsigned index, int64_t value) {
+    ArgumentBinding binding{};
+    binding.index = index;
+    binding.kind = ArgumentBinding::Kind::Integer;
+    binding.integer = value;
+    return binding;
+}
+
+ArgumentBinding bindFloatingPoint(unsigned index, double value) {
+    ArgumentBinding binding{};
+    binding.index = index;
+    binding.kind = ArgumentBinding::Kind::FloatingPoint;
+    binding.floating_point = value;
+    return binding;
+}
+
+// Identifies `function_name` with `bindings` regardless of their order, e.g.
+// `work(1=i0x10)`. Floating-point values are keyed by their bits, so that
+// 0.0 and -0.0 get different specializations.
+std::string getSpecializationKey(llvm::StringRef function_name,
+                                 llvm::ArrayRef<ArgumentBinding> bindings) {
+    std::vector<ArgumentBinding> sorted_bindings{bindings.begin(),
+                                                 bindings.end()};
+    std::sort(sorted_bindings.begin(), sorted_bindings.end(),
+              [](const ArgumentBinding &lhs, const ArgumentBinding &rhs) {
+                  return lhs.index < rhs.index;
+              });
+
+    std::string key;
+    llvm::raw_string_ostream key_stream{key};
+    key_stream << function_name << '(';
+    for (size_t position = 0; position < sorted_bindings.size(); ++position) {
+        const ArgumentBinding &binding = sorted_bindings[position];
+        if (position > 0)
+            key_stream << ',';
+
+        key_stream << binding.index << '=';
+        if (binding.kind == ArgumentBinding::Kind::Integer)
+            key_stream << 'i'
+                       << llvm::format_hex(
+                              static_cast<uint64_t>(binding.integer), 2);
+        else
+            key_stream << 'f'
+                       << llvm::format_hex(
+                              llvm::DoubleToBits(binding.floating_point), 2);
+    }
+    key_stream << ')';
+
+    return key_stream.str();
+}
+
+// Defines `name` next to `function`, with the same signature, calling
+// `function` with the arguments in `bindings` replaced by their constants;
+// the passed values of those arguments are ignored.
+//
+// The body of `function` is inlined right away, so that the optimizer sees
+// the constants in it: branches on bound arguments fold, loops with a bound
+// trip count can be unrolled and a recursion on a bound argument can be
+// evaluated entirely.
+llvm::Expected<llvm::Function *>
+defineSpecializedFunction(llvm::Function &function,
+                          llvm::ArrayRef<ArgumentBinding> bindings,
+                          const llvm::Twine &name) {
+    if (function.isDeclaration() || function.isVarArg())
+        return llvm::createStringError(
+            std::error_code{}, "Cannot specialize function \"%s\"",
+            function.getName().str().c_str());
+
+    std::vector<llvm::Constant *> constants(function.arg_size(), nullptr);
+    for (const ArgumentBinding &binding : bindings) {
+        if (binding.index >= function.arg_size() ||
+            constants[binding.index] != nullptr)
+            return llvm::createStringError(
+                std::error_code{}, "Invalid argument %u of \"%s\"",
+                binding.index, function.getName().str().c_str());
+
+        llvm::Type *type = function.getArg(binding.index)->getType();
+        if (binding.kind == ArgumentBinding::Kind::Integer &&
+            type->isIntegerTy()) {
+            constants[binding.index] = llvm::ConstantInt::get(
+                type, static_cast<uint64_t>(binding.integer),
+                /*isSigned*/ true);
+        } else if (binding.kind == ArgumentBinding::Kind::FloatingPoint &&
+                   type->isFloatingPointTy()) {
+            constants[binding.index] =
+                llvm::ConstantFP::get(type, binding.floating_point);
+        } else {
+            return llvm::createStringError(
+                std::error_code{}, "Argument %u of \"%s\" has another type",
+                binding.index, function.getName().str().c_str());
+        }
+    }
+
+    llvm::Function *specialized_func = llvm::Function::Create(
+        function.getFunctionType(), llvm::Function::ExternalLinkage, name,
+        *function.getParent());
+    specialized_func->setCallingConv(function.getCallingConv());
+    specialized_func->setAttributes(function.getAttributes());
+
+    llvm::BasicBlock *entry_block = llvm::BasicBlock::Create(
+        function.getContext(), "entry", specialized_func);
+    llvm::IRBuilder<> ir_builder{entry_block};
+
+    std::vector<llvm::Value *> args;
+    args.reserve(function.arg_size());
+    for (unsigned arg = 0; arg < function.arg_size(); ++arg) {
+        if (constants[arg] != nullptr)
+            args.push_back(constants[arg]);
+        else
+            args.push_back(specialized_func->getArg(arg));
+    }
+
+    llvm::CallInst *call = ir_builder.CreateCall(&function, args);
+    call->setCallingConv(function.getCallingConv());
+    if (function.getReturnType()->isVoidTy())
+        ir_builder.CreateRetVoid();
+    else
+        ir_builder.CreateRet(call);
+
+    llvm::InlineFunctionInfo inline_info;
+    (void)llvm::InlineFunction(*call, inline_info);
+
+    return specialized_func;
+}
+
+// Compiles specializations of functions for constant arguments and caches
+// them by the bound values, so that each set of values is compiled once.
+//
+// Sources are kept as bitcode and are not added to the compiler: every
+// specialization is a module of its own, holding the specialized function
+// and internal copies of whatever the source function refers to. Functions
+// that keep state in mutable global variables therefore should not be
+// specialized, as each specialization has its own copy of them.
+// Thread-safe.
+class FunctionSpecializer {
+  public:
+    explicit FunctionSpecializer(SimpleJITCompiler &compiler,
+                                 OptLevel opt_level = OptLevel::O3)
+        : compiler_(compiler), opt_level_(opt_level) {}
+
+    // Removes all specializations.
+    ~FunctionSpecializer();
+
+    // Keeps `module` to specialize its functions from. The module is left
+    // untouched and can be added to the compiler as well.
+    llvm::Error addSource(std::string_view source_name,
+                          const llvm::Module &module);
+
+    // Address of the specialization of `function_name` in `source_name` for
+    // `bindings`, compiled on the first request for these values. It takes
+    // the same arguments as the function; bound ones are ignored.
+    llvm::Expected<llvm::JITEvaluatedSymbol>
+    specialize(std::string_view source_name, std::string_view function_name,
+               llvm::ArrayRef<ArgumentBinding> bindings);
+
+    // Typed specialize(), e.g. specializeFunction<double(double, int64_t)>().
+    template <typename FunctionT>
+    llvm::Expected<FunctionT *>
+    specializeFunction(std::string_view source_name,
+                       std::string_view function_name,
+                       llvm::ArrayRef<ArgumentBinding> bindings);
+
+    // Removes all specializations. Pointers previously returned must no
+    // longer be called.
+    llvm::Error clear();
+
+    uint64_t getCacheHits() const {
+        return cache_hits_.load(std::memory_order_relaxed);
+    }
+    uint64_t getCacheMisses() const {
+        return cache_misses_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    llvm::Expected<std::string>
+    addSpecialization(std::string_view source_name,
+                      std::string_view function_name,
+                      llvm::ArrayRef<ArgumentBinding> bindings);
+
+    SimpleJITCompiler &compiler_;
+    OptLevel opt_level_;
+
+    std::mutex mutex_;
+    llvm::StringMap<llvm::SmallVector<char, 0>> sources_;
+    // Names of the modules of all specializations, which are the source name
+    // and the specialization key.
+    llvm::StringSet<> specializations_;
+    std::atomic<uint64_t> cache_hits_{0};
+    std::atomic<uint64_t> cache_misses_{0};
+};
+
+FunctionSpecializer::~FunctionSpecializer() {
+    llvm::Error err = clear();
+    if (err)
+        llvm::errs() << "Error removing specializations: "
+                     << llvm::toString(std::move(err)) << '\n';
+}
+
+llvm::Error FunctionSpecializer::addSource(std::string_view source_name,
+                                           const llvm::Module &module) {
+    llvm::SmallVector<char, 0> bitcode;
+    {
+        llvm::raw_svector_ostream bitcode_stream{bitcode};
+        llvm::WriteBitcodeToFile(module, bitcode_stream);
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto inserted = sources_.try_emplace(
+        llvm::StringRef{source_name.data(), source_name.size()},
+        std::move(bitcode));
+    if (!inserted.second)
+        return llvm::createStringError(std::error_code{},
+                                       "Source \"%s\" was already added",
+                                       std::string{source_name}.c_str());
+
+    return llvm::Error::success();
+}
+
+llvm::Expected<llvm::JITEvaluatedSymbol>
+FunctionSpecializer::specialize(std::string_view source_name,
+                                std::string_view function_name,
+                                llvm::ArrayRef<ArgumentBinding> bindings) {
+    auto module_name =
+        addSpecialization(source_name, function_name, bindings);
+    if (!module_name)
+        return module_name.takeError();
+
+    // Compilation happens here, outside of the lock: concurrent requests
+    // for the same values wait on the one materialization of the module,
+    // and later ones hit the symbol cache of the compiler.
+    return compiler_.lookup(
+        *module_name,
+        std::string{function_name} + SPECIALIZED_FUNCTION_SUFFIX);
+}
+
+template <typename FunctionT>
+llvm::Expected<FunctionT *>
+FunctionSpecializer::specializeFunction(
+    std::string_view source_name, std::string_view function_name,
+    llvm::ArrayRef<ArgumentBinding> bindings) {
+    auto symbol = specialize(source_name, function_name, bindings);
+    if (!symbol)
+        return symbol.takeError();
+
+    return reinterpret_cast<FunctionT *>(symbol->getAddress());
+}
+
+llvm::Error FunctionSpecializer::clear() {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    llvm::Error errors = llvm::Error::success();
+    for (const auto &specialization : specializations_)
+        errors = llvm::joinErrors(
+            std::move(errors),
+            compiler_.remove(specialization.getKey().str()));
+    specializations_.clear();
+
+    return errors;
+}
+
+// Adds the module of a specialization unless it already exists and returns
+// its name. The module is compiled on its first lookup.
+llvm::Expected<std::string> FunctionSpecializer::addSpecialization(
+    std::string_view source_name, std::string_view function_name,
+    llvm::ArrayRef<ArgumentBinding> bindings) {
+    llvm::StringRef function_name_ref{function_name.data(),
+                                      function_name.size()};
+    std::string module_name =
+        std::string{source_name} + ":" +
+        getSpecializationKey(function_name_ref, bindings);
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (specializations_.count(module_name)) {
+        cache_hits_.fetch_add(1, std::memory_order_relaxed);
+        return module_name;
+    }
+    cache_misses_.fetch_add(1, std::memory_order_relaxed);
+
+    auto source = sources_.find(
+        llvm::StringRef{source_name.data(), source_name.size()});
+    if (source == sources_.end())
+        return llvm::createStringError(std::error_code{},
+                                       "No source \"%s\"",
+                                       std::string{source_name}.c_str());
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = loadBitcodeModule(
+        llvm::MemoryBuffer::getMemBuffer(
+            llvm::StringRef{source->getValue().data(),
+                            source->getValue().size()},
+            source->getKey(), /*RequiresNullTerminator*/ false),
+        *context, {function_name_ref});
+    if (!module)
+        return module.takeError();
+
+    llvm::Function *function = (*module)->getFunction(function_name_ref);
+    auto specialized_func = defineSpecializedFunction(
+        *function, bindings, function_name_ref + SPECIALIZED_FUNCTION_SUFFIX);
+    if (!specialized_func)
+        return specialized_func.takeError();
+
+    // Only the specialization is exported, so that the optimizer can drop
+    // the source function once it is inlined, and fold constant variables
+    for (llvm::GlobalValue &global : (*module)->global_values()) {
+        if (&global != *specialized_func && !global.isDeclaration() &&
+            !global.hasAppendingLinkage())
+            global.setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+
+    llvm::Error err = compiler_.add(module_name, std::move(*module),
+                                    std::move(context), opt_level_);
+    if (err)
+        return {std::move(err)};
+
+    specializations_.insert(module_name);
+    return module_name;
+}
+
+#endif // INCLUDE_FUNCTION_SPECIALIZER_HPP_
@@ -0,0 +1,395 @@
+#ifndef INCLUDE_JIT_INSTRUMENTATION_HPP_
+#define INCLUDE_JIT_INSTRUMENTATION_HPP_
+
+#include "OptimizationPipeline.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Distribution of a repeatedly measured latency in power-of-two buckets of
+// nanoseconds: bucket b counts latencies in [2^(b-1), 2^b). Percentiles are
+// therefore accurate to a factor of two, which is enough to tell a 50 us
+// phase from a 5 ms one at a fixed 64 counters.
+class LatencyHistogram {
+  public:
+    static constexpr size_t BUCKET_COUNT = 64;
+
+    void record(std::chrono::nanoseconds latency) {
+        uint64_t nanoseconds =
+            static_cast<uint64_t>(std::max<int64_t>(0, latency.count()));
+
+        size_t bucket = 0;
+        while (bucket + 1 < BUCKET_COUNT && (nanoseconds >> bucket) != 0)
+            ++bucket;
+
+        ++buckets_[bucket];
+        ++count_;
+        total_ += std::chrono::nanoseconds(nanoseconds);
+        max_ = std::max(max_, std::chrono::nanoseconds(nanoseconds));
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket)
+            buckets_[bucket] += other.buckets_[bucket];
+        count_ += other.count_;
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t getCount() const { return count_; }
+    std::chrono::nanoseconds getTotal() const { return total_; }
+    std::chrono::nanoseconds getMax() const { return max_; }
+
+    std::chrono::nanoseconds getMean() const {
+        return count_ == 0 ? std::chrono::nanoseconds{0}
+                           : total_ / static_cast<int64_t>(count_);
+    }
+
+    // Upper bound of the bucket holding the `percentile`th (0..100) latency,
+    // capped by the largest latency seen.
+    std::chrono::nanoseconds getPercentile(double percentile) const {
+        if (count_ == 0)
+            return std::chrono::nanoseconds{0};
+
+        double rank = std::clamp(percentile, 0.0, 100.0) / 100.0 * count_;
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+            seen += buckets_[bucket];
+            if (seen > 0 && seen >= rank) {
+                auto upper_bound = std::chrono::nanoseconds(
+                    bucket == 0 ? 0 : (uint64_t{1} << bucket) - 1);
+                return std::min(upper_bound, max_);
+            }
+        }
+        return max_;
+    }
+
+  private:
+    std::array<uint64_t, BUCKET_COUNT> buckets_{};
+    uint64_t count_ = 0;
+    std::chrono::nanoseconds total_{0};
+    std::chrono::nanoseconds max_{0};
+};
+
+// Steps between adding a module to the JIT and calling into it.
+enum class JITPhase {
+    // Module verification before it is handed to the layers
+    Verify,
+    // The optimization pipeline
+    Optimize,
+    // Instruction selection and object emission, or the object cache lookup
+    Codegen,
+    // Loading, relocating and resolving the object, including finalization
+    Link,
+    // Applying the final page permissions (RuntimeDyld only)
+    Finalize,
+    // Symbol lookups that were not served from the symbol cache
+    Lookup,
+};
+
+constexpr size_t JIT_PHASE_COUNT = static_cast<size_t>(JITPhase::Lookup) + 1;
+
+llvm::StringRef getJITPhaseName(JITPhase phase) {
+    switch (phase) {
+    case JITPhase::Verify:
+        return "verify";
+    case JITPhase::Optimize:
+        return "optimize";
+    case JITPhase::Codegen:
+        return "codegen";
+    case JITPhase::Link:
+        return "link";
+    case JITPhase::Finalize:
+        return "finalize";
+    case JITPhase::Lookup:
+        return "lookup";
+    }
+    return "verify";
+}
+
+// Everything recorded for one module.
+struct ModuleInstrumentation {
+    OptLevel opt_level = OptLevel::O0;
+    std::array<LatencyHistogram, JIT_PHASE_COUNT> phases;
+    uint64_t object_count = 0;
+    uint64_t object_bytes = 0;
+    // Lookups resolved by the execution session, i.e. symbol cache misses
+    uint64_t symbol_resolutions = 0;
+
+    const LatencyHistogram &getPhase(JITPhase phase) const {
+        return phases[static_cast<size_t>(phase)];
+    }
+};
+
+// Adds a call counter to every function defined in `module`: an external
+// global `[N x i64]` named `counter_array_name` whose element i is atomically
+// incremented on entry to the i-th returned function. The array itself must
+// be defined by the JIT (see JITInstrumentation::createCallCounters).
+std::vector<std::string>
+instrumentCallCounts(llvm::Module &module,
+                     llvm::StringRef counter_array_name) {
+    std::vector<llvm::Function *> functions;
+    for (llvm::Function &function : module) {
+        if (!function.isDeclaration())
+            functions.push_back(&function);
+    }
+
+    std::vector<std::string> function_names;
+    if (functions.empty())
+        return function_names;
+
+    llvm::LLVMContext &context = module.getContext();
+    llvm::Type *counter_type = llvm::Type::getInt64Ty(context);
+    llvm::ArrayType *array_type =
+        llvm::ArrayType::get(counter_type, functions.size());
+
+    auto *counters = new llvm::GlobalVariable(
+        module, array_type, /*isConstant*/ false,
+        llvm::GlobalValue::ExternalLinkage, /*Initializer*/ nullptr,
+        counter_array_name);
+
+    llvm::IRBuilder<> ir_builder{context};
+    llvm::Constant *one = llvm::ConstantInt::get(counter_type, 1);
+
+    for (size_t index = 0; index < functions.size(); ++index) {
+        llvm::Function *function = functions[index];
+        function_names.push_back(function->getName().str());
+
+        llvm::BasicBlock &entry_block = function->getEntryBlock();
+        ir_builder.SetInsertPoint(&entry_block,
+                                  entry_block.getFirstInsertionPt());
+        llvm::Value *counter = ir_builder.CreateConstInBoundsGEP2_64(
+            array_type, counters, 0, index);
+        ir_builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, counter, one,
+                                   llvm::AtomicOrdering::Monotonic);
+    }
+
+    return function_names;
+}
+
+// Compile-time and runtime measurements of a JIT: per-phase latency
+// histograms over all modules and per module, object sizes, symbol
+// resolution counts and, optionally, call counts of JIT'd functions.
+// Thread-safe.
+class JITInstrumentation {
+  public:
+    void recordPhase(llvm::StringRef module_name, JITPhase phase,
+                     std::chrono::nanoseconds latency);
+    void recordOptLevel(llvm::StringRef module_name, OptLevel opt_level);
+    void recordObject(llvm::StringRef module_name, uint64_t object_bytes);
+    void recordSymbolResolution(llvm::StringRef module_name,
+                                std::chrono::nanoseconds latency);
+    void recordCachedLookup() {
+        cached_lookups_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Allocates one zeroed counter per function name for `module_name`,
+    // replacing earlier counters of that module. The returned array lives
+    // until the module is removed or its counters replaced.
+    std::atomic<uint64_t> *
+    createCallCounters(llvm::StringRef module_name,
+                       std::vector<std::string> function_names);
+
+    // Forgets a removed module. The histograms over all modules keep its
+    // measurements.
+    void removeModule(llvm::StringRef module_name);
+
+    LatencyHistogram getPhase(JITPhase phase) const;
+    std::vector<std::string> getModuleNames() const;
+    llvm::Optional<ModuleInstrumentation>
+    getModule(llvm::StringRef module_name) const;
+    uint64_t getCachedLookups() const {
+        return cached_lookups_.load(std::memory_order_relaxed);
+    }
+    // 0 for functions without a counter.
+    uint64_t getCallCount(llvm::StringRef module_name,
+                          llvm::StringRef function_name) const;
+
+    void print(llvm::raw_ostream &os) const;
+
+  private:
+    struct CallCounters {
+        std::vector<std::string> function_names;
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    };
+
+    mutable std::mutex mutex_;
+    std::array<LatencyHistogram, JIT_PHASE_COUNT> phases_;
+    llvm::StringMap<ModuleInstrumentation> modules_;
+    llvm::StringMap<CallCounters> call_counters_;
+    std::atomic<uint64_t> cached_lookups_{0};
+};
+
+void JITInstrumentation::recordPhase(llvm::StringRef module_name,
+                                     JITPhase phase,
+                                     std::chrono::nanoseconds latency) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    phases_[static_cast<size_t>(phase)].record(latency);
+    modules_[module_name].phases[static_cast<size_t>(phase)].record(latency);
+}
+
+void JITInstrumentation::recordOptLevel(llvm::StringRef module_name,
+                                        OptLevel opt_level) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    modules_[module_name].opt_level = opt_level;
+}
+
+void JITInstrumentation::recordObject(llvm::StringRef module_name,
+                                      uint64_t object_bytes) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    ModuleInstrumentation &module = modules_[module_name];
+    ++module.object_count;
+    module.object_bytes += object_bytes;
+}
+
+void JITInstrumentation::recordSymbolResolution(
+    llvm::StringRef module_name, std::chrono::nanoseconds latency) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    phases_[static_cast<size_t>(JITPhase::Lookup)].record(latency);
+    ModuleInstrumentation &module = modules_[module_name];
+    module.phases[static_cast<size_t>(JITPhase::Lookup)].record(latency);
+    ++module.symbol_resolutions;
+}
+
+std::atomic<uint64_t> *JITInstrumentation::createCallCounters(
+    llvm::StringRef module_name, std::vector<std::string> function_names) {
+    CallCounters counters;
+    counters.counts =
+        std::make_unique<std::atomic<uint64_t>[]>(function_names.size());
+    for (size_t index = 0; index < function_names.size(); ++index)
+        counters.counts[index].store(0, std::memory_order_relaxed);
+    counters.function_names = std::move(function_names);
+
+    std::atomic<uint64_t> *counts = counters.counts.get();
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    call_counters_[module_name] = std::move(counters);
+    return counts;
+}
+
+void JITInstrumentation::removeModule(llvm::StringRef module_name) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    modules_.erase(module_name);
+    call_counters_.erase(module_name);
+}
+
+LatencyHistogram JITInstrumentation::getPhase(JITPhase phase) const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return phases_[static_cast<size_t>(phase)];
+}
+
+std::vector<std::string> JITInstrumentation::getModuleNames() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    std::vector<std::string> module_names;
+    for (const auto &entry : modules_)
+        module_names.push_back(entry.first().str());
+    std::sort(module_names.begin(), module_names.end());
+    return module_names;
+}
+
+llvm::Optional<ModuleInstrumentation>
+JITInstrumentation::getModule(llvm::StringRef module_name) const {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto module = modules_.find(module_name);
+    if (module == modules_.end())
+        return llvm::None;
+
+    return module->second;
+}
+
+uint64_t JITInstrumentation::getCallCount(llvm::StringRef module_name,
+                                          llvm::StringRef function_name) const {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto counters = call_counters_.find(module_name);
+    if (counters == call_counters_.end())
+        return 0;
+
+    const std::vector<std::string> &names = counters->second.function_names;
+    auto name = std::find(names.begin(), names.end(), function_name);
+    if (name == names.end())
+        return 0;
+
+    return counters->second.counts[name - names.begin()].load(
+        std::memory_order_relaxed);
+}
+
+void JITInstrumentation::print(llvm::raw_ostream &os) const {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    os << "JIT phases          count      mean(us)       p50(us)"
+          "       p99(us)       max(us)\n";
+    for (size_t phase = 0; phase < JIT_PHASE_COUNT; ++phase) {
+        const LatencyHistogram &histogram = phases_[phase];
+        if (histogram.getCount() == 0)
+            continue;
+
+        os << llvm::format(
+            "  %-12s %10llu %13.1f %13.1f %13.1f %13.1f\n",
+            getJITPhaseName(static_cast<JITPhase>(phase)).str().c_str(),
+            static_cast<unsigned long long>(histogram.getCount()),
+            histogram.getMean().count() / 1e3,
+            histogram.getPercentile(50).count() / 1e3,
+            histogram.getPercentile(99).count() / 1e3,
+            histogram.getMax().count() / 1e3);
+    }
+    os << llvm::format("  cached lookups %llu\n",
+                       static_cast<unsigned long long>(
+                           cached_lookups_.load(std::memory_order_relaxed)));
+
+    os << "JIT modules                      Level Optimize(us)  Codegen(us)"
+          "     Link(us)  Objects        Bytes  Resolved\n";
+    for (const auto &entry : modules_) {
+        const ModuleInstrumentation &module = entry.second;
+        os << llvm::format(
+            "  %-30s %-5s %12.1f %12.1f %12.1f %8llu %12llu %9llu\n",
+            entry.first().str().c_str(),
+            getOptLevelName(module.opt_level).data(),
+            module.getPhase(JITPhase::Optimize).getTotal().count() / 1e3,
+            module.getPhase(JITPhase::Codegen).getTotal().count() / 1e3,
+            module.getPhase(JITPhase::Link).getTotal().count() / 1e3,
+            static_cast<unsigned long long>(module.object_count),
+            static_cast<unsigned long long>(module.object_bytes),
+            static_cast<unsigned long long>(module.symbol_resolutions));
+    }
+
+    if (call_counters_.empty())
+        return;
+
+    os << "JIT call counts\n";
+    for (const auto &entry : call_counters_) {
+        const CallCounters &counters = entry.second;
+        for (size_t index = 0; index < counters.function_names.size();
+             ++index) {
+            os << llvm::format(
+                "  %-30s %-30s %12llu\n", entry.first().str().c_str(),
+                counters.function_names[index].c_str(),
+                static_cast<unsigned long long>(counters.counts[index].load(
+                    std::memory_order_relaxed)));
+        }
+    }
+}
+
+#endif // INCLUDE_JIT_INSTRUMENTATION_HPP_
@@ -0,0 +1,268 @@
+#ifndef INCLUDE_KERNEL_CODEGEN_HPP_
+#define INCLUDE_KERNEL_CODEGEN_HPP_
+
+#include "DeclareFunction.hpp"
+#include "DefaultTarget.hpp"
+#include "KernelParser.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Lowers the functions of a kernel program to `double name(double, ...)`
+// functions of one module.
+//
+// Variables live in allocas of the entry block, which the optimizer promotes
+// to registers. Comparisons are ordered except '!=', matching C++ on NaNs.
+class KernelCodegen {
+  public:
+    KernelCodegen(const KernelProgram &program, llvm::Module &module)
+        : program_{program}, module_{module},
+          context_{module.getContext()}, ir_builder_{context_},
+          double_type_{llvm::Type::getDoubleTy(context_)} {}
+
+    void lower();
+
+  private:
+    void lowerFunction(const KernelFunction &function,
+                       llvm::Function *ir_function);
+    void lowerBlock(const std::vector<KernelStmt> &block);
+    llvm::Value *lowerExpr(const KernelExpr &expr);
+    llvm::Value *lowerCondition(const KernelExpr &expr);
+    llvm::Value *toDouble(llvm::Value *condition);
+
+    const KernelProgram &program_;
+    llvm::Module &module_;
+    llvm::LLVMContext &context_;
+    llvm::IRBuilder<> ir_builder_;
+    llvm::Type *double_type_;
+
+    std::vector<llvm::Function *> ir_functions_;
+    std::vector<llvm::AllocaInst *> slots_;
+};
+
+// Creates a module named `module_name` holding the functions of `program`.
+std::unique_ptr<llvm::Module> lowerKernelProgram(const KernelProgram &program,
+                                                 llvm::LLVMContext &context,
+                                                 llvm::StringRef module_name) {
+    auto module = std::make_unique<llvm::Module>(module_name, context);
+    module->setTargetTriple(GetDefaultTargetTriple().str());
+    module->setDataLayout(GetDefaultDataLayout());
+
+    KernelCodegen{program, *module}.lower();
+
+    assert(!llvm::verifyModule(*module, &llvm::errs()));
+    return module;
+}
+
+void KernelCodegen::lower() {
+    // Declare all functions first, calls may refer to any of them
+    for (const KernelFunction &function : program_.functions) {
+        llvm::SmallVector<llvm::Type *, SMALL_ARITY> arg_types(
+            function.param_count, double_type_);
+        ir_functions_.push_back(
+            DeclareFunction(module_, function.name, double_type_, arg_types));
+    }
+
+    for (size_t index = 0; index < program_.functions.size(); ++index)
+        lowerFunction(program_.functions[index], ir_functions_[index]);
+}
+
+void KernelCodegen::lowerFunction(const KernelFunction &function,
+                                  llvm::Function *ir_function) {
+    llvm::BasicBlock *entry_block =
+        llvm::BasicBlock::Create(context_, "entry", ir_function);
+    ir_builder_.SetInsertPoint(entry_block);
+
+    llvm::Constant *zero = llvm::ConstantFP::get(double_type_, 0.0);
+
+    slots_.clear();
+    for (size_t slot = 0; slot < function.slot_count; ++slot) {
+        slots_.push_back(ir_builder_.CreateAlloca(double_type_, nullptr,
+                                                  function.slot_names[slot]));
+        llvm::Value *initial_value = zero;
+        if (slot < function.param_count)
+            initial_value = ir_function->getArg(slot);
+        ir_builder_.CreateStore(initial_value, slots_.back());
+    }
+
+    lowerBlock(function.body);
+
+    // Falling off the end returns 0
+    if (ir_builder_.GetInsertBlock()->getTerminator() == nullptr)
+        ir_builder_.CreateRet(zero);
+}
+
+void KernelCodegen::lowerBlock(const std::vector<KernelStmt> &block) {
+    llvm::Function *ir_function = ir_builder_.GetInsertBlock()->getParent();
+
+    for (const KernelStmt &statement : block) {
+        switch (statement.kind) {
+        case KernelStmt::Kind::Assign:
+            ir_builder_.CreateStore(lowerExpr(*statement.value),
+                                    slots_[statement.slot]);
+            break;
+
+        case KernelStmt::Kind::If: {
+            llvm::BasicBlock *then_block =
+                llvm::BasicBlock::Create(context_, "then", ir_function);
+            llvm::BasicBlock *else_block =
+                llvm::BasicBlock::Create(context_, "else", ir_function);
+            llvm::BasicBlock *merge_block =
+                llvm::BasicBlock::Create(context_, "merge", ir_function);
+
+            ir_builder_.CreateCondBr(lowerCondition(*statement.value),
+                                     then_block, else_block);
+
+            for (auto branch : {std::make_pair(then_block, &statement.body),
+                                std::make_pair(else_block,
+                                               &statement.else_body)}) {
+                ir_builder_.SetInsertPoint(branch.first);
+                lowerBlock(*branch.second);
+                if (ir_builder_.GetInsertBlock()->getTerminator() == nullptr)
+                    ir_builder_.CreateBr(merge_block);
+            }
+
+            ir_builder_.SetInsertPoint(merge_block);
+            break;
+        }
+
+        case KernelStmt::Kind::While: {
+            llvm::BasicBlock *condition_block =
+                llvm::BasicBlock::Create(context_, "while", ir_function);
+            llvm::BasicBlock *body_block =
+                llvm::BasicBlock::Create(context_, "body", ir_function);
+            llvm::BasicBlock *exit_block =
+                llvm::BasicBlock::Create(context_, "exit", ir_function);
+
+            ir_builder_.CreateBr(condition_block);
+            ir_builder_.SetInsertPoint(condition_block);
+            ir_builder_.CreateCondBr(lowerCondition(*statement.value),
+                                     body_block, exit_block);
+
+            ir_builder_.SetInsertPoint(body_block);
+            lowerBlock(statement.body);
+            if (ir_builder_.GetInsertBlock()->getTerminator() == nullptr)
+                ir_builder_.CreateBr(condition_block);
+
+            ir_builder_.SetInsertPoint(exit_block);
+            break;
+        }
+
+        case KernelStmt::Kind::Return:
+            ir_builder_.CreateRet(lowerExpr(*statement.value));
+
+            // Statements after a return are unreachable but still lowered
+            ir_builder_.SetInsertPoint(llvm::BasicBlock::Create(
+                context_, "after_return", ir_function));
+            break;
+        }
+    }
+}
+
+llvm::Value *KernelCodegen::lowerExpr(const KernelExpr &expr) {
+    switch (expr.kind) {
+    case KernelExpr::Kind::Number:
+        return llvm::ConstantFP::get(double_type_, expr.number);
+
+    case KernelExpr::Kind::Variable:
+        return ir_builder_.CreateLoad(double_type_, slots_[expr.index]);
+
+    case KernelExpr::Kind::Call: {
+        llvm::SmallVector<llvm::Value *, SMALL_ARITY> arguments;
+        for (const auto &operand : expr.operands)
+            arguments.push_back(lowerExpr(*operand));
+        return ir_builder_.CreateCall(ir_functions_[expr.index], arguments);
+    }
+
+    case KernelExpr::Kind::Builtin: {
+        llvm::Value *lhs = lowerExpr(*expr.operands[0]);
+        switch (expr.builtin) {
+        case KernelBuiltin::Sqrt:
+            return ir_builder_.CreateUnaryIntrinsic(llvm::Intrinsic::sqrt,
+                                                    lhs);
+        case KernelBuiltin::Abs:
+            return ir_builder_.CreateUnaryIntrinsic(llvm::Intrinsic::fabs,
+                                                    lhs);
+        case KernelBuiltin::Min:
+            return ir_builder_.CreateMinNum(lhs,
+                                            lowerExpr(*expr.operands[1]));
+        case KernelBuiltin::Max:
+            return ir_builder_.CreateMaxNum(lhs,
+                                            lowerExpr(*expr.operands[1]));
+        }
+        return lhs;
+    }
+
+    case KernelExpr::Kind::Unary:
+        if (expr.op == KernelOperator::Neg)
+            return ir_builder_.CreateFNeg(lowerExpr(*expr.operands[0]));
+        return toDouble(
+            ir_builder_.CreateNot(lowerCondition(*expr.operands[0])));
+
+    case KernelExpr::Kind::Binary:
+        break;
+    }
+
+    if (expr.op == KernelOperator::And || expr.op == KernelOperator::Or) {
+        llvm::Value *lhs = lowerCondition(*expr.operands[0]);
+        llvm::Value *rhs = lowerCondition(*expr.operands[1]);
+        return toDouble(expr.op == KernelOperator::And
+                            ? ir_builder_.CreateAnd(lhs, rhs)
+                            : ir_builder_.CreateOr(lhs, rhs));
+    }
+
+    llvm::Value *lhs = lowerExpr(*expr.operands[0]);
+    llvm::Value *rhs = lowerExpr(*expr.operands[1]);
+
+    switch (expr.op) {
+    case KernelOperator::Add:
+        return ir_builder_.CreateFAdd(lhs, rhs);
+    case KernelOperator::Sub:
+        return ir_builder_.CreateFSub(lhs, rhs);
+    case KernelOperator::Mul:
+        return ir_builder_.CreateFMul(lhs, rhs);
+    case KernelOperator::Div:
+        return ir_builder_.CreateFDiv(lhs, rhs);
+    case KernelOperator::Rem:
+        return ir_builder_.CreateFRem(lhs, rhs);
+    case KernelOperator::Less:
+        return toDouble(ir_builder_.CreateFCmpOLT(lhs, rhs));
+    case KernelOperator::LessEqual:
+        return toDouble(ir_builder_.CreateFCmpOLE(lhs, rhs));
+    case KernelOperator::Greater:
+        return toDouble(ir_builder_.CreateFCmpOGT(lhs, rhs));
+    case KernelOperator::GreaterEqual:
+        return toDouble(ir_builder_.CreateFCmpOGE(lhs, rhs));
+    case KernelOperator::Equal:
+        return toDouble(ir_builder_.CreateFCmpOEQ(lhs, rhs));
+    case KernelOperator::NotEqual:
+        return toDouble(ir_builder_.CreateFCmpUNE(lhs, rhs));
+    default:
+        return lhs;
+    }
+}
+
+llvm::Value *KernelCodegen::lowerCondition(const KernelExpr &expr) {
+    return ir_builder_.CreateFCmpUNE(
+        lowerExpr(expr), llvm::ConstantFP::get(double_type_, 0.0));
+}
+
+llvm::Value *KernelCodegen::toDouble(llvm::Value *condition) {
+    return ir_builder_.CreateUIToFP(condition, double_type_);
+}
+
+#endif // INCLUDE_KERNEL_CODEGEN_HPP_
@@ -0,0 +1,151 @@
+#ifndef INCLUDE_KERNEL_INTERPRETER_HPP_
+#define INCLUDE_KERNEL_INTERPRETER_HPP_
+
+#include "KernelParser.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Runs kernel programs by walking their syntax tree, as the baseline the
+// JIT-compiled kernels are measured against. Variables are resolved to frame
+// slots by the parser, so the interpreter does no name lookups.
+class KernelInterpreter {
+  public:
+    // The program must outlive the interpreter.
+    explicit KernelInterpreter(const KernelProgram &program)
+        : program_{program} {}
+
+    // Calls function `function` of the program with `arguments`, one per
+    // parameter.
+    double call(size_t function, llvm::ArrayRef<double> arguments) const;
+
+  private:
+    using Frame = llvm::SmallVector<double, 8>;
+
+    // Returns true once a return statement has stored to `result`.
+    bool execute(const std::vector<KernelStmt> &block, Frame &frame,
+                 double &result) const;
+    double evaluate(const KernelExpr &expr, Frame &frame) const;
+
+    const KernelProgram &program_;
+};
+
+double KernelInterpreter::call(size_t function,
+                               llvm::ArrayRef<double> arguments) const {
+    const KernelFunction &callee = program_.functions[function];
+    assert(arguments.size() == callee.param_count);
+
+    Frame frame(callee.slot_count, 0.0);
+    std::copy(arguments.begin(), arguments.end(), frame.begin());
+
+    double result = 0.0;
+    execute(callee.body, frame, result);
+    return result;
+}
+
+bool KernelInterpreter::execute(const std::vector<KernelStmt> &block,
+                                Frame &frame, double &result) const {
+    for (const KernelStmt &statement : block) {
+        switch (statement.kind) {
+        case KernelStmt::Kind::Assign:
+            frame[statement.slot] = evaluate(*statement.value, frame);
+            break;
+        case KernelStmt::Kind::If: {
+            const auto &branch = evaluate(*statement.value, frame) != 0.0
+                                     ? statement.body
+                                     : statement.else_body;
+            if (execute(branch, frame, result))
+                return true;
+            break;
+        }
+        case KernelStmt::Kind::While:
+            while (evaluate(*statement.value, frame) != 0.0) {
+                if (execute(statement.body, frame, result))
+                    return true;
+            }
+            break;
+        case KernelStmt::Kind::Return:
+            result = evaluate(*statement.value, frame);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+double KernelInterpreter::evaluate(const KernelExpr &expr,
+                                   Frame &frame) const {
+    switch (expr.kind) {
+    case KernelExpr::Kind::Number:
+        return expr.number;
+    case KernelExpr::Kind::Variable:
+        return frame[expr.index];
+    case KernelExpr::Kind::Call: {
+        llvm::SmallVector<double, 4> arguments;
+        for (const auto &operand : expr.operands)
+            arguments.push_back(evaluate(*operand, frame));
+        return call(expr.index, arguments);
+    }
+    case KernelExpr::Kind::Builtin: {
+        double lhs = evaluate(*expr.operands[0], frame);
+        switch (expr.builtin) {
+        case KernelBuiltin::Sqrt:
+            return std::sqrt(lhs);
+        case KernelBuiltin::Abs:
+            return std::fabs(lhs);
+        case KernelBuiltin::Min:
+            return std::fmin(lhs, evaluate(*expr.operands[1], frame));
+        case KernelBuiltin::Max:
+            return std::fmax(lhs, evaluate(*expr.operands[1], frame));
+        }
+        return 0.0;
+    }
+    case KernelExpr::Kind::Unary: {
+        double operand = evaluate(*expr.operands[0], frame);
+        return expr.op == KernelOperator::Neg ? -operand
+                                              : (operand == 0.0 ? 1.0 : 0.0);
+    }
+    case KernelExpr::Kind::Binary:
+        break;
+    }
+
+    double lhs = evaluate(*expr.operands[0], frame);
+    double rhs = evaluate(*expr.operands[1], frame);
+
+    switch (expr.op) {
+    case KernelOperator::Add:
+        return lhs + rhs;
+    case KernelOperator::Sub:
+        return lhs - rhs;
+    case KernelOperator::Mul:
+        return lhs * rhs;
+    case KernelOperator::Div:
+        return lhs / rhs;
+    case KernelOperator::Rem:
+        return std::fmod(lhs, rhs);
+    case KernelOperator::Less:
+        return lhs < rhs;
+    case KernelOperator::LessEqual:
+        return lhs <= rhs;
+    case KernelOperator::Greater:
+        return lhs > rhs;
+    case KernelOperator::GreaterEqual:
+        return lhs >= rhs;
+    case KernelOperator::Equal:
+        return lhs == rhs;
+    case KernelOperator::NotEqual:
+        return lhs != rhs;
+    case KernelOperator::And:
+        return lhs != 0.0 && rhs != 0.0;
+    case KernelOperator::Or:
+        return lhs != 0.0 || rhs != 0.0;
+    default:
+        return 0.0;
+    }
+}
+
+#endif // INCLUDE_KERNEL_INTERPRETER_HPP_
@@ -0,0 +1,586 @@
+#ifndef INCLUDE_KERNEL_PARSER_HPP_
+#define INCLUDE_KERNEL_PARSER_HPP_
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/Error.h"
+#include <cctype>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// A small language for numeric kernels, which are JIT-compiled through
+// KernelCodegen.hpp or run by KernelInterpreter.hpp. Every value is a double.
+//
+//   program    := function*
+//   function   := 'def' name '(' [name (',' name)*] ')' block
+//   block      := '{' statement* '}'
+//   statement  := 'var' name '=' expression ';'
+//               | name '=' expression ';'
+//               | 'if' expression block ['else' (block | if-statement)]
+//               | 'while' expression block
+//               | 'return' expression ';'
+//   expression := binary expressions over unary ('-', '!') and primary
+//                 expressions: numbers, variables, calls and '(' expression ')'
+//
+// Binary operators, loosest first: '||', '&&', '==' '!=', '<' '<=' '>' '>=',
+// '+' '-', '*' '/' '%'. Comparisons and logic operators yield 1 or 0 and a
+// condition holds when it is not 0; '&&' and '||' evaluate both operands.
+// Functions may call each other in any order and the builtins sqrt(x),
+// abs(x), min(x, y) and max(x, y). Variables are scoped to their function,
+// and a function without return statement on some path returns 0.
+//
+//   def poly(x) { return ((0.5 * x + 1.5) * x - 2) * x + 3; }
+
+enum class KernelOperator {
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Rem,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Equal,
+    NotEqual,
+    And,
+    Or,
+    Neg,
+    Not,
+};
+
+enum class KernelBuiltin { Sqrt, Abs, Min, Max };
+
+struct KernelExpr {
+    enum class Kind { Number, Variable, Unary, Binary, Call, Builtin };
+
+    Kind kind = Kind::Number;
+    double number = 0.0;
+    // Variable: slot of the variable in its function's frame
+    // Call: index of the called function in its program
+    size_t index = 0;
+    KernelOperator op = KernelOperator::Add;
+    KernelBuiltin builtin = KernelBuiltin::Sqrt;
+    std::vector<std::unique_ptr<KernelExpr>> operands;
+};
+
+struct KernelStmt {
+    enum class Kind { Assign, If, While, Return };
+
+    Kind kind = Kind::Assign;
+    // Assign: slot of the assigned variable
+    size_t slot = 0;
+    // Assign and Return: the value, If and While: the condition
+    std::unique_ptr<KernelExpr> value;
+    std::vector<KernelStmt> body;
+    std::vector<KernelStmt> else_body;
+};
+
+struct KernelFunction {
+    std::string name;
+    // The parameters take the first slots of a frame
+    size_t param_count = 0;
+    size_t slot_count = 0;
+    std::vector<std::string> slot_names;
+    std::vector<KernelStmt> body;
+};
+
+struct KernelProgram {
+    std::vector<KernelFunction> functions;
+
+    // Index of the function named `name`, functions.size() if there is none.
+    size_t find(llvm::StringRef name) const {
+        for (size_t index = 0; index < functions.size(); ++index) {
+            if (functions[index].name == name)
+                return index;
+        }
+        return functions.size();
+    }
+};
+
+class KernelParser {
+  public:
+    explicit KernelParser(llvm::StringRef source) : source_{source} {}
+
+    // Parses the whole source. Errors are reported as "line:column: message".
+    llvm::Expected<KernelProgram> parse();
+
+  private:
+    enum class TokenKind { End, Number, Name, Keyword, Symbol };
+
+    struct Token {
+        TokenKind kind = TokenKind::End;
+        llvm::StringRef text;
+        size_t line = 1;
+        size_t column = 1;
+    };
+
+    // A call seen before all function names are known.
+    struct PendingCall {
+        KernelExpr *call;
+        std::string name;
+        Token token;
+    };
+
+    void next();
+    bool consume(llvm::StringRef text);
+    llvm::Error expect(llvm::StringRef text);
+    llvm::Error error(const Token &token, const llvm::Twine &message) const;
+
+    llvm::Error parseFunction();
+    llvm::Error parseBlock(std::vector<KernelStmt> &block);
+    llvm::Error parseStatement(std::vector<KernelStmt> &block);
+    llvm::Error parseIf(std::vector<KernelStmt> &block);
+    llvm::Expected<std::unique_ptr<KernelExpr>> parseExpression(int level = 0);
+    llvm::Expected<std::unique_ptr<KernelExpr>> parseUnary();
+    llvm::Expected<std::unique_ptr<KernelExpr>> parsePrimary();
+    llvm::Error parseArguments(KernelExpr &call);
+    llvm::Error resolveCalls();
+
+    llvm::StringRef source_;
+    size_t position_ = 0;
+    size_t line_ = 1;
+    size_t line_start_ = 0;
+    Token token_;
+
+    KernelProgram program_;
+    KernelFunction *function_ = nullptr;
+    llvm::StringMap<size_t> slots_;
+    std::vector<PendingCall> pending_calls_;
+};
+
+// Parses `source` into a program.
+llvm::Expected<KernelProgram> parseKernelProgram(llvm::StringRef source) {
+    return KernelParser{source}.parse();
+}
+
+llvm::Expected<KernelProgram> KernelParser::parse() {
+    next();
+    while (token_.kind != TokenKind::End) {
+        if (auto err = parseFunction())
+            return {std::move(err)};
+    }
+
+    if (auto err = resolveCalls())
+        return {std::move(err)};
+
+    return {std::move(program_)};
+}
+
+void KernelParser::next() {
+    // Skip white space and '#' comments
+    while (position_ < source_.size()) {
+        char character = source_[position_];
+        if (character == '#') {
+            while (position_ < source_.size() && source_[position_] != '\n')
+                ++position_;
+        } else if (std::isspace(static_cast<unsigned char>(character))) {
+            if (character == '\n') {
+                ++line_;
+                line_start_ = position_ + 1;
+            }
+            ++position_;
+        } else {
+            break;
+        }
+    }
+
+    token_.line = line_;
+    token_.column = position_ - line_start_ + 1;
+
+    if (position_ == source_.size()) {
+        token_.kind = TokenKind::End;
+        token_.text = {};
+        return;
+    }
+
+    size_t start = position_;
+    auto is_name_char = [](char character) {
+        return std::isalnum(static_cast<unsigned char>(character)) ||
+               character == '_';
+    };
+
+    char character = source_[position_];
+    if (std::isdigit(static_cast<unsigned char>(character)) ||
+        character == '.') {
+        token_.kind = TokenKind::Number;
+        while (position_ < source_.size() &&
+               (std::isdigit(static_cast<unsigned char>(source_[position_])) ||
+                source_[position_] == '.'))
+            ++position_;
+    } else if (is_name_char(character)) {
+        while (position_ < source_.size() && is_name_char(source_[position_]))
+            ++position_;
+
+        llvm::StringRef word = source_.slice(start, position_);
+        bool keyword = llvm::StringSwitch<bool>(word)
+                           .Cases("def", "var", "if", "else", true)
+                           .Cases("while", "return", true)
+                           .Default(false);
+        token_.kind = keyword ? TokenKind::Keyword : TokenKind::Name;
+    } else {
+        token_.kind = TokenKind::Symbol;
+        llvm::StringRef rest = source_.substr(position_);
+        bool two_chars = rest.startswith("<=") || rest.startswith(">=") ||
+                         rest.startswith("==") || rest.startswith("!=") ||
+                         rest.startswith("&&") || rest.startswith("||");
+        position_ += two_chars ? 2 : 1;
+    }
+
+    token_.text = source_.slice(start, position_);
+}
+
+bool KernelParser::consume(llvm::StringRef text) {
+    if ((token_.kind != TokenKind::Symbol &&
+         token_.kind != TokenKind::Keyword) ||
+        token_.text != text)
+        return false;
+
+    next();
+    return true;
+}
+
+llvm::Error KernelParser::expect(llvm::StringRef text) {
+    if (consume(text))
+        return llvm::Error::success();
+
+    return error(token_, "expected '" + text + "'");
+}
+
+llvm::Error KernelParser::error(const Token &token,
+                                const llvm::Twine &message) const {
+    std::string found = token.kind == TokenKind::End
+                            ? std::string{"end of input"}
+                            : "'" + token.text.str() + "'";
+
+    return llvm::createStringError(
+        std::error_code{}, "%zu:%zu: %s, found %s", token.line, token.column,
+        message.str().c_str(), found.c_str());
+}
+
+llvm::Error KernelParser::parseFunction() {
+    if (auto err = expect("def"))
+        return err;
+
+    if (token_.kind != TokenKind::Name)
+        return error(token_, "expected a function name");
+    if (program_.find(token_.text) != program_.functions.size())
+        return error(token_, "function defined twice");
+
+    program_.functions.emplace_back();
+    function_ = &program_.functions.back();
+    function_->name = token_.text.str();
+    slots_.clear();
+    next();
+
+    if (auto err = expect("("))
+        return err;
+
+    while (token_.kind == TokenKind::Name) {
+        if (!slots_.try_emplace(token_.text, function_->slot_names.size())
+                 .second)
+            return error(token_, "parameter declared twice");
+
+        function_->slot_names.push_back(token_.text.str());
+        next();
+
+        if (!consume(","))
+            break;
+    }
+    function_->param_count = function_->slot_names.size();
+
+    if (auto err = expect(")"))
+        return err;
+
+    if (auto err = parseBlock(function_->body))
+        return err;
+
+    function_->slot_count = function_->slot_names.size();
+    return llvm::Error::success();
+}
+
+llvm::Error KernelParser::parseBlock(std::vector<KernelStmt> &block) {
+    if (auto err = expect("{"))
+        return err;
+
+    while (!consume("}")) {
+        if (token_.kind == TokenKind::End)
+            return error(token_, "expected '}'");
+
+        if (auto err = parseStatement(block))
+            return err;
+    }
+
+    return llvm::Error::success();
+}
+
+llvm::Error KernelParser::parseStatement(std::vector<KernelStmt> &block) {
+    if (consume("if"))
+        return parseIf(block);
+
+    if (consume("while")) {
+        KernelStmt statement;
+        statement.kind = KernelStmt::Kind::While;
+
+        auto condition = parseExpression();
+        if (!condition)
+            return condition.takeError();
+        statement.value = std::move(*condition);
+
+        if (auto err = parseBlock(statement.body))
+            return err;
+
+        block.push_back(std::move(statement));
+        return llvm::Error::success();
+    }
+
+    if (consume("return")) {
+        KernelStmt statement;
+        statement.kind = KernelStmt::Kind::Return;
+
+        auto value = parseExpression();
+        if (!value)
+            return value.takeError();
+        statement.value = std::move(*value);
+
+        block.push_back(std::move(statement));
+        return expect(";");
+    }
+
+    // Declaration or assignment
+    bool declaration = consume("var");
+
+    Token name = token_;
+    if (name.kind != TokenKind::Name)
+        return error(name, "expected a statement");
+    next();
+
+    auto slot = slots_.find(name.text);
+    if (declaration) {
+        if (slot != slots_.end())
+            return error(name, "variable declared twice");
+
+        slot = slots_.try_emplace(name.text, function_->slot_names.size())
+                   .first;
+        function_->slot_names.push_back(name.text.str());
+    } else if (slot == slots_.end()) {
+        return error(name, "undeclared variable");
+    }
+
+    if (auto err = expect("="))
+        return err;
+
+    KernelStmt statement;
+    statement.kind = KernelStmt::Kind::Assign;
+    statement.slot = slot->second;
+
+    auto value = parseExpression();
+    if (!value)
+        return value.takeError();
+    statement.value = std::move(*value);
+
+    block.push_back(std::move(statement));
+    return expect(";");
+}
+
+llvm::Error KernelParser::parseIf(std::vector<KernelStmt> &block) {
+    KernelStmt statement;
+    statement.kind = KernelStmt::Kind::If;
+
+    auto condition = parseExpression();
+    if (!condition)
+        return condition.takeError();
+    statement.value = std::move(*condition);
+
+    if (auto err = parseBlock(statement.body))
+        return err;
+
+    if (consume("else")) {
+        llvm::Error err = consume("if") ? parseIf(statement.else_body)
+                                        : parseBlock(statement.else_body);
+        if (err)
+            return err;
+    }
+
+    block.push_back(std::move(statement));
+    return llvm::Error::success();
+}
+
+llvm::Expected<std::unique_ptr<KernelExpr>>
+KernelParser::parseExpression(int level) {
+    struct BinaryOperator {
+        llvm::StringRef text;
+        KernelOperator op;
+        int level;
+    };
+    static const BinaryOperator binary_operators[] = {
+        {"||", KernelOperator::Or, 0},
+        {"&&", KernelOperator::And, 1},
+        {"==", KernelOperator::Equal, 2},
+        {"!=", KernelOperator::NotEqual, 2},
+        {"<", KernelOperator::Less, 3},
+        {"<=", KernelOperator::LessEqual, 3},
+        {">", KernelOperator::Greater, 3},
+        {">=", KernelOperator::GreaterEqual, 3},
+        {"+", KernelOperator::Add, 4},
+        {"-", KernelOperator::Sub, 4},
+        {"*", KernelOperator::Mul, 5},
+        {"/", KernelOperator::Div, 5},
+        {"%", KernelOperator::Rem, 5},
+    };
+    constexpr int UNARY_LEVEL = 6;
+
+    if (level == UNARY_LEVEL)
+        return parseUnary();
+
+    auto lhs = parseExpression(level + 1);
+    if (!lhs)
+        return lhs.takeError();
+
+    // Operators of one level are left-associative
+    while (token_.kind == TokenKind::Symbol) {
+        const BinaryOperator *matched = nullptr;
+        for (const BinaryOperator &binary_operator : binary_operators) {
+            if (binary_operator.level == level &&
+                binary_operator.text == token_.text)
+                matched = &binary_operator;
+        }
+        if (matched == nullptr)
+            break;
+        next();
+
+        auto rhs = parseExpression(level + 1);
+        if (!rhs)
+            return rhs.takeError();
+
+        auto binary = std::make_unique<KernelExpr>();
+        binary->kind = KernelExpr::Kind::Binary;
+        binary->op = matched->op;
+        binary->operands.push_back(std::move(*lhs));
+        binary->operands.push_back(std::move(*rhs));
+        *lhs = std::move(binary);
+    }
+
+    return lhs;
+}
+
+llvm::Expected<std::unique_ptr<KernelExpr>> KernelParser::parseUnary() {
+    KernelOperator op;
+    if (consume("-"))
+        op = KernelOperator::Neg;
+    else if (consume("!"))
+        op = KernelOperator::Not;
+    else
+        return parsePrimary();
+
+    auto operand = parseUnary();
+    if (!operand)
+        return operand.takeError();
+
+    auto unary = std::make_unique<KernelExpr>();
+    unary->kind = KernelExpr::Kind::Unary;
+    unary->op = op;
+    unary->operands.push_back(std::move(*operand));
+    return {std::move(unary)};
+}
+
+llvm::Expected<std::unique_ptr<KernelExpr>> KernelParser::parsePrimary() {
+    Token token = token_;
+
+    if (consume("(")) {
+        auto inner = parseExpression();
+        if (!inner)
+            return inner.takeError();
+        if (auto err = expect(")"))
+            return {std::move(err)};
+        return inner;
+    }
+
+    auto expr = std::make_unique<KernelExpr>();
+
+    if (token.kind == TokenKind::Number) {
+        if (token.text.getAsDouble(expr->number))
+            return error(token, "invalid number");
+
+        next();
+        expr->kind = KernelExpr::Kind::Number;
+        return {std::move(expr)};
+    }
+
+    if (token.kind != TokenKind::Name)
+        return error(token, "expected an expression");
+    next();
+
+    if (consume("(")) {
+        if (auto err = parseArguments(*expr))
+            return {std::move(err)};
+
+        auto builtin =
+            llvm::StringSwitch<std::pair<int, KernelBuiltin>>(token.text)
+                .Case("sqrt", {1, KernelBuiltin::Sqrt})
+                .Case("abs", {1, KernelBuiltin::Abs})
+                .Case("min", {2, KernelBuiltin::Min})
+                .Case("max", {2, KernelBuiltin::Max})
+                .Default({-1, KernelBuiltin::Sqrt});
+
+        if (builtin.first < 0) {
+            // Resolved once all functions have been parsed
+            expr->kind = KernelExpr::Kind::Call;
+            pending_calls_.push_back({expr.get(), token.text.str(), token});
+            return {std::move(expr)};
+        }
+
+        if (expr->operands.size() != static_cast<size_t>(builtin.first))
+            return error(token, "wrong number of arguments");
+
+        expr->kind = KernelExpr::Kind::Builtin;
+        expr->builtin = builtin.second;
+        return {std::move(expr)};
+    }
+
+    auto slot = slots_.find(token.text);
+    if (slot == slots_.end())
+        return error(token, "undeclared variable");
+
+    expr->kind = KernelExpr::Kind::Variable;
+    expr->index = slot->second;
+    return {std::move(expr)};
+}
+
+llvm::Error KernelParser::parseArguments(KernelExpr &call) {
+    if (consume(")"))
+        return llvm::Error::success();
+
+    do {
+        auto argument = parseExpression();
+        if (!argument)
+            return argument.takeError();
+        call.operands.push_back(std::move(*argument));
+    } while (consume(","));
+
+    return expect(")");
+}
+
+llvm::Error KernelParser::resolveCalls() {
+    for (PendingCall &pending_call : pending_calls_) {
+        size_t index = program_.find(pending_call.name);
+        if (index == program_.functions.size())
+            return error(pending_call.token, "undefined function");
+
+        if (program_.functions[index].param_count !=
+            pending_call.call->operands.size())
+            return error(pending_call.token, "wrong number of arguments");
+
+        pending_call.call->index = index;
+    }
+
+    return llvm::Error::success();
+}
+
+#endif // INCLUDE_KERNEL_PARSER_HPP_
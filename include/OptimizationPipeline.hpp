@@ -0,0 +1,113 @@
+#ifndef INCLUDE_OPTIMIZATION_PIPELINE_HPP_
+#define INCLUDE_OPTIMIZATION_PIPELINE_HPP_
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Target/TargetMachine.h"
+#include <cstdint>
+
+enum class OptLevel : uint32_t { O0, O1, O2, O3 };
+
+// Named metadata carrying the OptLevel a module should be compiled at. It
+// travels with the module (and its bitcode) so that layers running later, on
+// whatever thread materializes the module, can pick the right pipeline.
+constexpr const char *OPT_LEVEL_METADATA = "simple-jit.opt-level";
+
+void setModuleOptLevel(llvm::Module &module, OptLevel level) {
+    llvm::LLVMContext &context = module.getContext();
+    llvm::Constant *level_value = llvm::ConstantInt::get(
+        llvm::Type::getInt32Ty(context), static_cast<uint32_t>(level));
+
+    llvm::NamedMDNode *node =
+        module.getOrInsertNamedMetadata(OPT_LEVEL_METADATA);
+    node->clearOperands();
+    node->addOperand(llvm::MDNode::get(
+        context, {llvm::ConstantAsMetadata::get(level_value)}));
+}
+
+OptLevel getModuleOptLevel(const llvm::Module &module) {
+    llvm::NamedMDNode *node = module.getNamedMetadata(OPT_LEVEL_METADATA);
+    if (node == nullptr || node->getNumOperands() == 0)
+        return OptLevel::O0;
+
+    auto *level_value = llvm::mdconst::dyn_extract<llvm::ConstantInt>(
+        node->getOperand(0)->getOperand(0));
+    if (level_value == nullptr || level_value->getZExtValue() > 3)
+        return OptLevel::O0;
+
+    return static_cast<OptLevel>(level_value->getZExtValue());
+}
+
+llvm::StringRef getOptLevelName(OptLevel level) {
+    switch (level) {
+    case OptLevel::O0:
+        return "O0";
+    case OptLevel::O1:
+        return "O1";
+    case OptLevel::O2:
+        return "O2";
+    case OptLevel::O3:
+        return "O3";
+    }
+    return "O0";
+}
+
+// Parses "O0" to "O3".
+llvm::Optional<OptLevel> parseOptLevel(llvm::StringRef name) {
+    return llvm::StringSwitch<llvm::Optional<OptLevel>>(name)
+        .Case("O0", OptLevel::O0)
+        .Case("O1", OptLevel::O1)
+        .Case("O2", OptLevel::O2)
+        .Case("O3", OptLevel::O3)
+        .Default(llvm::None);
+}
+
+// Runs the new pass manager's default per-module pipeline for `level`.
+// Passing the TargetMachine lets the cost models (inliner, vectorizers)
+// query the real TargetTransformInfo instead of a conservative default.
+void optimizeModule(llvm::Module &module, OptLevel level,
+                    llvm::TargetMachine *target_machine) {
+    if (level == OptLevel::O0)
+        return;
+
+    llvm::LoopAnalysisManager loop_analysis_manager;
+    llvm::FunctionAnalysisManager function_analysis_manager;
+    llvm::CGSCCAnalysisManager cgscc_analysis_manager;
+    llvm::ModuleAnalysisManager module_analysis_manager;
+
+    llvm::PassBuilder pass_builder{/*DebugLogging*/ false, target_machine};
+
+    pass_builder.registerModuleAnalyses(module_analysis_manager);
+    pass_builder.registerCGSCCAnalyses(cgscc_analysis_manager);
+    pass_builder.registerFunctionAnalyses(function_analysis_manager);
+    pass_builder.registerLoopAnalyses(loop_analysis_manager);
+    pass_builder.crossRegisterProxies(
+        loop_analysis_manager, function_analysis_manager,
+        cgscc_analysis_manager, module_analysis_manager);
+
+    llvm::PassBuilder::OptimizationLevel pipeline_level =
+        llvm::PassBuilder::OptimizationLevel::O2;
+    switch (level) {
+    case OptLevel::O1:
+        pipeline_level = llvm::PassBuilder::OptimizationLevel::O1;
+        break;
+    case OptLevel::O3:
+        pipeline_level = llvm::PassBuilder::OptimizationLevel::O3;
+        break;
+    default:
+        break;
+    }
+
+    llvm::ModulePassManager module_pass_manager =
+        pass_builder.buildPerModuleDefaultPipeline(pipeline_level);
+    module_pass_manager.run(module, module_analysis_manager);
+}
+
+#endif // INCLUDE_OPTIMIZATION_PIPELINE_HPP_
@@ -0,0 +1,158 @@
+#ifndef INCLUDE_PERF_MAP_HPP_
+#define INCLUDE_PERF_MAP_HPP_
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/JITLink/JITLink.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/RuntimeDyld.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+
+// Appends the address ranges of JIT'd functions to a perf map, the
+// `<start> <size> <name>` text file `perf report` reads to name samples in
+// anonymous executable memory. Perf maps have no removal records, so the
+// code of removed modules keeps its names. Thread-safe.
+class PerfMapWriter {
+  public:
+    // Where perf looks for the map of this process.
+    static std::string getDefaultPath() {
+        return ("/tmp/perf-" + llvm::Twine(llvm::sys::Process::getProcessId()) +
+                ".map")
+            .str();
+    }
+
+    // Appends to the map at `path`, so that several JITs of one process
+    // share it.
+    static llvm::Expected<std::unique_ptr<PerfMapWriter>>
+    create(llvm::StringRef path = getDefaultPath()) {
+        std::error_code ec;
+        auto output = std::make_unique<llvm::raw_fd_ostream>(
+            path, ec, llvm::sys::fs::OF_Append | llvm::sys::fs::OF_Text);
+        if (ec)
+            return llvm::createFileError(path, ec);
+
+        return std::unique_ptr<PerfMapWriter>{
+            new PerfMapWriter{std::move(output)}};
+    }
+
+    // Records are buffered until flush(), which writes them at once.
+    void addFunction(uint64_t address, uint64_t size, llvm::StringRef name) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        *output_ << llvm::format("%llx %llx ",
+                                 static_cast<unsigned long long>(address),
+                                 static_cast<unsigned long long>(size))
+                 << name << '\n';
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        output_->flush();
+    }
+
+  private:
+    explicit PerfMapWriter(std::unique_ptr<llvm::raw_fd_ostream> output)
+        : output_{std::move(output)} {}
+
+    std::mutex mutex_;
+    std::unique_ptr<llvm::raw_fd_ostream> output_;
+};
+
+// Adds the functions of every object RuntimeDyld loads to a perf map.
+class PerfMapEventListener : public llvm::JITEventListener {
+  public:
+    explicit PerfMapEventListener(PerfMapWriter &perf_map)
+        : perf_map_{perf_map} {}
+
+    void notifyObjectLoaded(
+        ObjectKey, const llvm::object::ObjectFile &object,
+        const llvm::RuntimeDyld::LoadedObjectInfo &info) override {
+        // The debug copy of the object has sections at their load addresses
+        llvm::object::OwningBinary<llvm::object::ObjectFile> loaded_object =
+            info.getObjectForDebug(object);
+        if (loaded_object.getBinary() == nullptr)
+            return;
+
+        for (const auto &[symbol, size] :
+             llvm::object::computeSymbolSizes(*loaded_object.getBinary())) {
+            auto type = symbol.getType();
+            if (!type) {
+                llvm::consumeError(type.takeError());
+                continue;
+            }
+            if (*type != llvm::object::SymbolRef::ST_Function || size == 0)
+                continue;
+
+            auto name = symbol.getName();
+            auto address = symbol.getAddress();
+            if (!name || !address) {
+                llvm::consumeError(name.takeError());
+                llvm::consumeError(address.takeError());
+                continue;
+            }
+
+            perf_map_.addFunction(*address, size, *name);
+        }
+
+        perf_map_.flush();
+    }
+
+  private:
+    PerfMapWriter &perf_map_;
+};
+
+// Adds the functions of every graph JITLink links to a perf map, once they
+// have their final addresses.
+class PerfMapLinkPlugin : public llvm::orc::ObjectLinkingLayer::Plugin {
+  public:
+    explicit PerfMapLinkPlugin(PerfMapWriter &perf_map)
+        : perf_map_{perf_map} {}
+
+    void modifyPassConfig(llvm::orc::MaterializationResponsibility &,
+                          const llvm::Triple &,
+                          llvm::jitlink::PassConfiguration &config) override {
+        config.PostFixupPasses.push_back(
+            [this](llvm::jitlink::LinkGraph &graph) {
+                for (llvm::jitlink::Symbol *symbol : graph.defined_symbols()) {
+                    if (symbol->isCallable() && symbol->hasName() &&
+                        symbol->getSize() != 0)
+                        perf_map_.addFunction(symbol->getAddress(),
+                                              symbol->getSize(),
+                                              symbol->getName());
+                }
+
+                perf_map_.flush();
+                return llvm::Error::success();
+            });
+    }
+
+    llvm::Error
+    notifyFailed(llvm::orc::MaterializationResponsibility &) override {
+        return llvm::Error::success();
+    }
+
+    llvm::Error notifyRemovingResources(llvm::orc::ResourceKey) override {
+        return llvm::Error::success();
+    }
+
+    void notifyTransferringResources(llvm::orc::ResourceKey,
+                                     llvm::orc::ResourceKey) override {}
+
+  private:
+    PerfMapWriter &perf_map_;
+};
+
+#endif // INCLUDE_PERF_MAP_HPP_
@@ -0,0 +1,201 @@
+#ifndef INCLUDE_RECORD_WRITER_HPP_
+#define INCLUDE_RECORD_WRITER_HPP_
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+
+// How the dump tools print symbols and relocations. Text is the colored
+// human-readable listing, the other formats are meant for tools.
+enum class OutputFormat { Text, NDJSON, Binary };
+
+llvm::Optional<OutputFormat> parseOutputFormat(llvm::StringRef name) {
+    return llvm::StringSwitch<llvm::Optional<OutputFormat>>(name)
+        .Case("text", OutputFormat::Text)
+        .Case("ndjson", OutputFormat::NDJSON)
+        .Case("binary", OutputFormat::Binary)
+        .Default(llvm::None);
+}
+
+// Buffer size of record sinks. Large enough that writing a dump costs few
+// system calls, small enough not to matter next to the mapped input files.
+constexpr size_t RECORD_SINK_BUFFER_SIZE = 4 * 1024 * 1024;
+
+// Opens `path` ("-" for stdout) for writing records through a large buffer.
+llvm::Expected<std::unique_ptr<llvm::raw_fd_ostream>>
+openRecordSink(llvm::StringRef path) {
+    std::error_code ec;
+    auto sink = std::make_unique<llvm::raw_fd_ostream>(path, ec,
+                                                       llvm::sys::fs::OF_None);
+    if (ec)
+        return llvm::errorCodeToError(ec);
+
+    sink->SetBufferSize(RECORD_SINK_BUFFER_SIZE);
+    return {std::move(sink)};
+}
+
+// Writes symbol and relocation records in one of the machine-readable
+// formats.
+//
+// NDJSON: one self-contained object per line,
+//   {"record":"symbol","file":F,"name":N,"address":A,"flags":X}
+//   {"record":"relocation","file":F,"section":S,"offset":O,"type":T,
+//    "type_name":TN,"symbol":N}
+//
+// Binary: the 8 byte magic "LLEXREC1" followed by records, all integers
+// little-endian, every string as a u32 length and its bytes:
+//   file:       u8 kind = 0, u8[3] zero, string path
+//   symbol:     u8 kind = 1, u8[3] zero, u32 flags, u64 address, string name
+//   relocation: u8 kind = 2, u8[3] zero, u32 type, u64 offset,
+//               string section, string type name, string symbol
+// Symbol and relocation records belong to the file record before them.
+//
+// Symbol flags are llvm::object::SymbolRef flags, and addresses are 0 where
+// the file format has none.
+class RecordWriter {
+  public:
+    static constexpr const char BINARY_MAGIC[] = "LLEXREC1";
+
+    // `file_path` continues the records of a file begun on another writer,
+    // e.g. when sections are formatted into separate buffers.
+    RecordWriter(llvm::raw_ostream &os, OutputFormat format,
+                 llvm::StringRef file_path = "")
+        : os_{os}, format_{format}, binary_{os, llvm::support::little},
+          file_path_{file_path.str()} {}
+
+    // Starts the stream, writes the binary magic.
+    void writeHeader();
+
+    // Sets the file the following records belong to.
+    void beginFile(llvm::StringRef file_path);
+
+    void writeSymbol(llvm::StringRef name, uint64_t address, uint32_t flags);
+
+    void writeRelocation(llvm::StringRef section, uint64_t offset,
+                         uint32_t type, llvm::StringRef type_name,
+                         llvm::StringRef symbol);
+
+  private:
+    enum RecordKind : uint8_t { FILE = 0, SYMBOL = 1, RELOCATION = 2 };
+
+    void writeKind(RecordKind kind);
+    void writeBinaryString(llvm::StringRef value);
+    void writeJSONString(llvm::StringRef value);
+
+    llvm::raw_ostream &os_;
+    OutputFormat format_;
+    llvm::support::endian::Writer binary_;
+    std::string file_path_;
+};
+
+void RecordWriter::writeHeader() {
+    if (format_ == OutputFormat::Binary)
+        os_.write(BINARY_MAGIC, sizeof(BINARY_MAGIC) - 1);
+}
+
+void RecordWriter::beginFile(llvm::StringRef file_path) {
+    file_path_ = file_path.str();
+
+    if (format_ == OutputFormat::Binary) {
+        writeKind(FILE);
+        writeBinaryString(file_path);
+    }
+}
+
+void RecordWriter::writeSymbol(llvm::StringRef name, uint64_t address,
+                               uint32_t flags) {
+    if (format_ == OutputFormat::Binary) {
+        writeKind(SYMBOL);
+        binary_.write<uint32_t>(flags);
+        binary_.write<uint64_t>(address);
+        writeBinaryString(name);
+        return;
+    }
+
+    os_ << "{\"record\":\"symbol\",\"file\":";
+    writeJSONString(file_path_);
+    os_ << ",\"name\":";
+    writeJSONString(name);
+    os_ << ",\"address\":" << address << ",\"flags\":" << flags << "}\n";
+}
+
+void RecordWriter::writeRelocation(llvm::StringRef section, uint64_t offset,
+                                   uint32_t type, llvm::StringRef type_name,
+                                   llvm::StringRef symbol) {
+    if (format_ == OutputFormat::Binary) {
+        writeKind(RELOCATION);
+        binary_.write<uint32_t>(type);
+        binary_.write<uint64_t>(offset);
+        writeBinaryString(section);
+        writeBinaryString(type_name);
+        writeBinaryString(symbol);
+        return;
+    }
+
+    os_ << "{\"record\":\"relocation\",\"file\":";
+    writeJSONString(file_path_);
+    os_ << ",\"section\":";
+    writeJSONString(section);
+    os_ << ",\"offset\":" << offset << ",\"type\":" << type
+        << ",\"type_name\":";
+    writeJSONString(type_name);
+    os_ << ",\"symbol\":";
+    writeJSONString(symbol);
+    os_ << "}\n";
+}
+
+void RecordWriter::writeKind(RecordKind kind) {
+    // The kind byte followed by three zero bytes
+    binary_.write<uint32_t>(kind);
+}
+
+void RecordWriter::writeBinaryString(llvm::StringRef value) {
+    binary_.write<uint32_t>(static_cast<uint32_t>(value.size()));
+    os_ << value;
+}
+
+void RecordWriter::writeJSONString(llvm::StringRef value) {
+    // Names are almost always plain ASCII, which needs no conversion
+    std::string fixed_value;
+    if (!llvm::json::isUTF8(value)) {
+        fixed_value = llvm::json::fixUTF8(value);
+        value = fixed_value;
+    }
+
+    os_ << '"';
+    for (char character : value) {
+        switch (character) {
+        case '"':
+            os_ << "\\\"";
+            break;
+        case '\\':
+            os_ << "\\\\";
+            break;
+        case '\n':
+            os_ << "\\n";
+            break;
+        case '\t':
+            os_ << "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(character) < 0x20)
+                os_ << llvm::format("\\u%04x", character);
+            else
+                os_ << character;
+        }
+    }
+    os_ << '"';
+}
+
+#endif // INCLUDE_RECORD_WRITER_HPP_
@@ -1,52 +1,500 @@
 #ifndef SIMPLE_JIT_COMPILER_HPP_
 #define SIMPLE_JIT_COMPILER_HPP_
 
+#include "BatchFunction.hpp"
 #include "DefaultTarget.hpp"
+#include "DiskObjectCache.hpp"
+#include "JITInstrumentation.hpp"
+#include "OptimizationPipeline.hpp"
+#include "PerfMap.hpp"
+#include "SlabMemoryManager.hpp"
+#include "TieredCompilation.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/JITLink/EHFrameSupport.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/JITLink/JITLinkMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
 #include "llvm/ExecutionEngine/Orc/Mangling.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
-#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Verifier.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 class SimpleJITCompiler
 {
   public:
-    SimpleJITCompiler();
+    // Wall-clock time spent in each compilation stage of one module, keyed
+    // by the name it was added under.
+    struct StageTimings
+    {
+        OptLevel opt_level = OptLevel::O0;
+        std::chrono::nanoseconds optimize{0};
+        std::chrono::nanoseconds codegen{0};
+    };
+
+    enum class Linker
+    {
+        // RuntimeDyld with objects packed into the shared JITMemoryPool.
+        RuntimeDyld,
+        // JITLink's ObjectLinkingLayer, which can be extended with plugins.
+        // Eh-frames are registered by a plugin.
+        JITLink,
+    };
+
+    struct Options
+    {
+        TargetCPU cpu = TargetCPU::Generic;
+
+        Linker linker = Linker::RuntimeDyld;
+
+        // Number of threads materializing modules in the background. With 0
+        // every module is compiled on the thread that first looks it up.
+        unsigned compile_threads = 0;
+
+        // Compile each function on its first call instead of the whole
+        // module on the first lookup. Looked up symbols then resolve to
+        // lazy call-through stubs. Each function is optimized on its own,
+        // so the inliner only sees the bodies of functions in its partition.
+        bool lazy = false;
+
+        // Define `void f_batch(const T *in, T *out, int64_t n)` for every
+        // scalar function `T f(T)` of added modules (see BatchFunction.hpp).
+        // Use TargetCPU::Host and O2 or above to vectorize them for the host
+        // SIMD width.
+        bool batch_functions = false;
+
+        // Directory of a persistent DiskObjectCache. Modules whose object is
+        // already cached skip both optimization and codegen. Empty disables
+        // the cache.
+        std::string object_cache_directory;
+
+        // Verify added modules and reject broken ones instead of crashing
+        // in a later layer. The time taken is the JITPhase::Verify phase.
+        bool verify_modules = false;
+
+        // Count calls to every function defined in added modules (see
+        // JITInstrumentation::getCallCount). Costs one atomic increment per
+        // call.
+        bool count_calls = false;
+
+        // Print the instrumentation to this file when the compiler is
+        // destroyed, "-" for stderr. Empty disables the dump.
+        std::string instrumentation_dump_path;
+
+        // Name JIT'd functions in `perf report` through the perf map
+        // /tmp/perf-<pid>.map.
+        bool perf_map = false;
+
+        // Write a jitdump (to $JITDUMPDIR or ~/.debug/jit) with the code
+        // and any debug line info of JIT'd functions, for `perf inject
+        // --jit`. Needs Linker::RuntimeDyld and an LLVM built with
+        // LLVM_USE_PERF.
+        bool perf_jitdump = false;
+
+        // Compile each module at O0 first, with counters on calls and
+        // branches, and recompile each function called
+        // `tier_up_threshold` times at O3 on a background thread, with the
+        // counts as its profile. Looked up functions resolve to stubs that
+        // switch to the optimized code once it is linked. The opt level
+        // given to add() only applies to modules with aliases, which are
+        // not tiered. O0 modules are compiled with fast instruction
+        // selection. Takes precedence over lazy.
+        bool tiered = false;
+        uint64_t tier_up_threshold = 1000;
+    };
+
+    // Name of the call counter array in modules added with
+    // Options::count_calls.
+    static constexpr const char *CALL_COUNTS_SYMBOL = "__jit_call_counts";
+
+    explicit SimpleJITCompiler(TargetCPU cpu = TargetCPU::Generic);
+    explicit SimpleJITCompiler(const Options &options);
     ~SimpleJITCompiler();
 
     llvm::Error add(std::string_view module_name,
                     std::unique_ptr<llvm::Module> module,
-                    std::unique_ptr<llvm::LLVMContext> context);
+                    std::unique_ptr<llvm::LLVMContext> context,
+                    OptLevel opt_level = OptLevel::O0);
+
+    // Frees the code and data of a module. Pointers previously looked up
+    // in it must no longer be called. The name can be added again.
+    llvm::Error remove(std::string_view module_name);
+
+    // Removes `module_name` if it has been added, then adds `module` under
+    // the same name.
+    llvm::Error replace(std::string_view module_name,
+                        std::unique_ptr<llvm::Module> module,
+                        std::unique_ptr<llvm::LLVMContext> context,
+                        OptLevel opt_level = OptLevel::O0);
 
     llvm::Expected<llvm::JITEvaluatedSymbol>
     lookup(std::string_view module_name, std::string_view symbol_name);
 
+    // Issues all lookups before waiting on any of them, so that with
+    // compile threads the modules behind them are compiled in parallel.
+    // Symbols are returned in request order.
+    llvm::Expected<std::vector<llvm::JITEvaluatedSymbol>>
+    lookup(llvm::ArrayRef<std::pair<std::string_view, std::string_view>>
+               module_symbols);
+
+    // Typed lookup of a function, e.g. lookupFunction<double(double)>().
+    template <typename FunctionT>
+    llvm::Expected<FunctionT *> lookupFunction(std::string_view module_name,
+                                               std::string_view symbol_name);
+
+    StageTimings getStageTimings(std::string_view module_name) const;
+    void printStageTimings(llvm::raw_ostream &os) const;
+
+    // Phase latencies, object sizes, symbol resolutions and call counts of
+    // all modules, keyed by the name they were added under.
+    const JITInstrumentation &getInstrumentation() const
+    {
+        return instrumentation_;
+    }
+
+    // Null unless Options::object_cache_directory was set.
+    const DiskObjectCache *getObjectCache() const
+    {
+        return object_cache_.get();
+    }
+
+    // Only allocated from with Linker::RuntimeDyld.
+    const JITMemoryPool &getMemoryPool() const
+    {
+        return memory_pool_;
+    }
+
+    // Number of functions switched to optimized code with Options::tiered.
+    uint64_t getTierUpCount() const
+    {
+        return tier_ups_.load(std::memory_order_relaxed);
+    }
+
+    // Blocks until every function that reached the tier-up threshold so far
+    // runs optimized code.
+    void waitForTierUps();
+
   private:
+    class TimedCompiler;
+    class TieredCompiler;
+    class TimedObjectLayer;
+    struct TieredModule;
+
+    llvm::Expected<llvm::orc::ThreadSafeModule>
+    optimize(llvm::orc::ThreadSafeModule module,
+             llvm::orc::MaterializationResponsibility &responsibility);
+
+    // Name the module materialized by `responsibility` was added under.
+    llvm::StringRef getModuleName(
+        const llvm::orc::MaterializationResponsibility &responsibility) const;
+
+    void dumpInstrumentation() const;
+
+    llvm::Expected<llvm::orc::ResourceTrackerSP>
+    getModule(std::string_view module_name);
+
+    std::unique_ptr<llvm::orc::ObjectLayer> createObjectLayer();
+    std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> createCompiler();
+    llvm::CodeGenOpt::Level
+    getCodeGenOptLevel(const llvm::Module &module) const;
+
+    llvm::Optional<llvm::JITEvaluatedSymbol>
+    findCachedSymbol(std::string_view module_name,
+                     std::string_view symbol_name) const;
+    void cacheSymbol(std::string_view module_name,
+                     const llvm::orc::ResourceTrackerSP &tracker,
+                     std::string_view symbol_name,
+                     llvm::JITEvaluatedSymbol symbol);
+    void invalidateSymbolCache(std::string_view module_name);
+
+    llvm::Expected<llvm::orc::IRLayer &> getAddLayer();
+    llvm::Error createLazyCallThrough();
+    static void handleLazyCompileFailure();
+
+    llvm::Error addToLayer(llvm::orc::IRLayer &add_layer,
+                           llvm::StringRef module_name,
+                           llvm::orc::ResourceTrackerSP tracker,
+                           std::unique_ptr<llvm::Module> module,
+                           std::unique_ptr<llvm::LLVMContext> context,
+                           OptLevel opt_level);
+    llvm::Error addTiered(llvm::StringRef module_name,
+                          llvm::orc::ResourceTrackerSP tracker,
+                          std::unique_ptr<llvm::Module> module,
+                          std::unique_ptr<llvm::LLVMContext> context);
+    // Defined as TIER_UP_SYMBOL for tier-0 code to call.
+    static void requestTierUp(TieredModule *module, uint64_t function_index);
+    void tierUp(TieredModule &module, uint64_t function_index);
+
+    Options options_;
+    std::unique_ptr<DiskObjectCache> object_cache_;
+    // Declared before the session so that it outlives the memory managers
+    // of the object linking layer.
+    JITMemoryPool memory_pool_;
+    // Set up by createObjectLayer() and used by the object linking layer.
+    std::unique_ptr<PerfMapWriter> perf_map_;
+    std::unique_ptr<PerfMapEventListener> perf_map_listener_;
     llvm::orc::ExecutionSession execution_session_;
-    llvm::orc::RTDyldObjectLinkingLayer object_layer_;
+    std::unique_ptr<llvm::orc::ObjectLayer> object_layer_;
     llvm::orc::IRCompileLayer compile_layer_;
+    llvm::orc::IRTransformLayer optimize_layer_;
     llvm::orc::MangleAndInterner mangler_;
+
+    // Tracks everything materialized for each added module. JITDylibs
+    // cannot be destroyed, so a removed module leaves its empty JITDylib
+    // behind to be reused when the name is added again.
+    mutable std::mutex modules_mutex_;
+    llvm::StringMap<llvm::orc::ResourceTrackerSP> modules_;
+
+    // Resolved symbols per module. Once materialized a symbol's address
+    // never changes until its module is removed, so repeated lookups are
+    // served from here without interning names or taking the session lock.
+    // Locked before modules_mutex_ when both are held.
+    mutable std::shared_mutex symbol_cache_mutex_;
+    llvm::StringMap<llvm::StringMap<llvm::JITEvaluatedSymbol>> symbol_cache_;
+
+    JITInstrumentation instrumentation_;
+
+    // Module being materialized on this thread. A module is optimized,
+    // compiled and linked on one thread, but only the optimize and link
+    // layers are told which module they work on.
+    static thread_local std::string materializing_module_;
+
+    std::mutex lazy_layer_mutex_;
+    std::unique_ptr<llvm::orc::LazyCallThroughManager> lazy_call_through_;
+    std::unique_ptr<llvm::orc::CompileOnDemandLayer> lazy_layer_;
+
+    // Counters, stubs and IR of tiered modules, keyed by module name.
+    std::mutex tiered_modules_mutex_;
+    llvm::StringMap<std::shared_ptr<TieredModule>> tiered_modules_;
+    std::atomic<uint64_t> tier_ups_{0};
+
+    std::unique_ptr<llvm::ThreadPool> compile_threads_;
+    std::unique_ptr<llvm::ThreadPool> tier_up_thread_;
+};
+
+thread_local std::string SimpleJITCompiler::materializing_module_;
+
+struct SimpleJITCompiler::TieredModule
+    : std::enable_shared_from_this<TieredModule>
+{
+    TieredModule(SimpleJITCompiler &jit, std::string name,
+                 llvm::orc::ResourceTrackerSP tracker,
+                 std::unique_ptr<llvm::orc::IndirectStubsManager> stubs)
+        : jit(jit), name(std::move(name)), tracker(std::move(tracker)),
+          stubs(std::move(stubs))
+    {
+    }
+
+    SimpleJITCompiler &jit;
+    std::string name;
+    llvm::orc::ResourceTrackerSP tracker;
+    // The module as added, before instrumentation, to be optimized again
+    // for each hot function.
+    llvm::SmallVector<char, 0> bitcode;
+    std::vector<std::string> function_names;
+    std::vector<std::atomic<uint64_t>> call_counts;
+    std::vector<std::atomic<uint64_t>> branch_counts;
+    TierStubsManager stubs;
+
+    // Held for the whole of a tier-up, as ORC cannot remove a tracker
+    // while code is being linked for it.
+    std::mutex tier_up_mutex;
+    bool removed = false;
+};
+
+// Forwards to the wrapped IRCompiler and reports how long codegen took and
+// how large the object is.
+class SimpleJITCompiler::TimedCompiler
+    : public llvm::orc::IRCompileLayer::IRCompiler
+{
+  public:
+    TimedCompiler(SimpleJITCompiler &jit,
+                  std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> base)
+        : IRCompiler(base->getManglingOptions()), jit_(jit),
+          base_(std::move(base))
+    {
+    }
+
+    llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+    operator()(llvm::Module &module) override
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto object_buffer = (*base_)(module);
+        jit_.instrumentation_.recordPhase(
+            materializing_module_, JITPhase::Codegen,
+            std::chrono::steady_clock::now() - start);
+        if (object_buffer)
+            jit_.instrumentation_.recordObject(
+                materializing_module_, (*object_buffer)->getBufferSize());
+        return object_buffer;
+    }
+
+  private:
+    SimpleJITCompiler &jit_;
+    std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> base_;
+};
+
+// Compiles tier-0 modules, which are at O0, with fast instruction selection
+// and register allocation, and other modules with the default code
+// generator.
+class SimpleJITCompiler::TieredCompiler
+    : public llvm::orc::IRCompileLayer::IRCompiler
+{
+  public:
+    TieredCompiler(
+        std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> tier_zero,
+        std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> optimizing)
+        : IRCompiler(optimizing->getManglingOptions()),
+          tier_zero_(std::move(tier_zero)), optimizing_(std::move(optimizing))
+    {
+    }
+
+    llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+    operator()(llvm::Module &module) override
+    {
+        if (getModuleOptLevel(module) == OptLevel::O0)
+            return (*tier_zero_)(module);
+        return (*optimizing_)(module);
+    }
+
+  private:
+    std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> tier_zero_;
+    std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> optimizing_;
+};
+
+// Forwards to the wrapped object layer and reports how long linking took.
+// With RuntimeDyld, memory finalization is reported on its own as well.
+class SimpleJITCompiler::TimedObjectLayer : public llvm::orc::ObjectLayer
+{
+  public:
+    TimedObjectLayer(SimpleJITCompiler &jit,
+                     std::unique_ptr<llvm::orc::ObjectLayer> base)
+        : ObjectLayer(jit.execution_session_), jit_(jit),
+          base_(std::move(base))
+    {
+    }
+
+    void emit(std::unique_ptr<llvm::orc::MaterializationResponsibility>
+                  responsibility,
+              std::unique_ptr<llvm::MemoryBuffer> object_buffer) override
+    {
+        std::string module_name = jit_.getModuleName(*responsibility).str();
+
+        auto start = std::chrono::steady_clock::now();
+        base_->emit(std::move(responsibility), std::move(object_buffer));
+        jit_.instrumentation_.recordPhase(
+            module_name, JITPhase::Link,
+            std::chrono::steady_clock::now() - start);
+    }
+
+  private:
+    SimpleJITCompiler &jit_;
+    std::unique_ptr<llvm::orc::ObjectLayer> base_;
 };
 
-SimpleJITCompiler::SimpleJITCompiler()
-    : execution_session_{},
-      object_layer_{execution_session_, []()
-                    { return std::make_unique<llvm::SectionMemoryManager>(); }},
-      compile_layer_{execution_session_, object_layer_,
-                     std::make_unique<llvm::orc::SimpleCompiler>(
-                         *GetDefaultTargetMachine())},
+SimpleJITCompiler::SimpleJITCompiler(TargetCPU cpu)
+    : SimpleJITCompiler{[cpu]()
+                        {
+                            Options options{};
+                            options.cpu = cpu;
+                            return options;
+                        }()}
+{
+}
+
+SimpleJITCompiler::SimpleJITCompiler(const Options &options)
+    : options_{options},
+      object_cache_{options.object_cache_directory.empty()
+                        ? nullptr
+                        : std::make_unique<DiskObjectCache>(
+                              options.object_cache_directory,
+                              *GetDefaultTargetMachine(options.cpu))},
+      memory_pool_{},
+      execution_session_{},
+      object_layer_{createObjectLayer()},
+      compile_layer_{execution_session_, *object_layer_,
+                     std::make_unique<TimedCompiler>(*this, createCompiler())},
+      optimize_layer_{execution_session_, compile_layer_,
+                      [this](llvm::orc::ThreadSafeModule module,
+                             llvm::orc::MaterializationResponsibility
+                                 &responsibility)
+                      { return optimize(std::move(module), responsibility); }},
       mangler_{execution_session_, GetDefaultDataLayout()}
 {
+    // A single thread, so that hot functions are optimized one at a time
+    // next to the application instead of competing with it
+    if (options_.tiered)
+        tier_up_thread_ =
+            std::make_unique<llvm::ThreadPool>(llvm::hardware_concurrency(1));
+
+    if (options_.compile_threads == 0)
+        return;
+
+    compile_threads_ = std::make_unique<llvm::ThreadPool>(
+        llvm::hardware_concurrency(options_.compile_threads));
+
+    execution_session_.setDispatchMaterialization(
+        [this](std::unique_ptr<llvm::orc::MaterializationUnit> unit,
+               std::unique_ptr<llvm::orc::MaterializationResponsibility>
+                   responsibility)
+        {
+            // ThreadPool tasks must be copyable, so the move-only arguments
+            // are released here and re-owned on the compile thread.
+            compile_threads_->async(
+                [unit = unit.release(),
+                 responsibility = responsibility.release()]()
+                {
+                    std::unique_ptr<llvm::orc::MaterializationUnit>
+                        owned_unit{unit};
+                    owned_unit->materialize(
+                        std::unique_ptr<
+                            llvm::orc::MaterializationResponsibility>{
+                            responsibility});
+                });
+        });
 }
 
 SimpleJITCompiler::~SimpleJITCompiler()
 {
+    // Tier-ups wait on compile threads, so they finish first
+    if (tier_up_thread_)
+        tier_up_thread_->wait();
+    if (compile_threads_)
+        compile_threads_->wait();
+
+    if (!options_.instrumentation_dump_path.empty())
+        dumpInstrumentation();
+
     auto err = execution_session_.endSession();
     if (err)
         execution_session_.reportError(std::move(err));
@@ -55,23 +503,782 @@ SimpleJITCompiler::~SimpleJITCompiler()
 llvm::Error
 SimpleJITCompiler::add(std::string_view module_name,
                        std::unique_ptr<llvm::Module> module,
-                       std::unique_ptr<llvm::LLVMContext> context)
+                       std::unique_ptr<llvm::LLVMContext> context,
+                       OptLevel opt_level)
+{
+    llvm::StringRef module_name_ref{module_name.data(), module_name.size()};
+
+    auto add_layer = getAddLayer();
+    if (!add_layer)
+        return add_layer.takeError();
+
+    llvm::orc::ResourceTrackerSP tracker;
+    {
+        std::lock_guard<std::mutex> lock{modules_mutex_};
+
+        if (modules_.count(module_name) != 0)
+            return llvm::createStringError(
+                std::error_code{}, "Module \"%s\" has already been added",
+                std::string{module_name}.c_str());
+
+        llvm::orc::JITDylib *added_module =
+            execution_session_.getJITDylibByName(module_name);
+        if (added_module == nullptr) {
+            // Resolve calls to the C library, e.g. the fmod libcall frem
+            // lowers to, from the symbols of the host process
+            auto process_symbols = llvm::orc::DynamicLibrarySearchGenerator::
+                GetForCurrentProcess(GetDefaultDataLayout().getGlobalPrefix());
+            if (!process_symbols)
+                return process_symbols.takeError();
+
+            added_module = &execution_session_.createBareJITDylib(
+                std::string{module_name});
+            added_module->addGenerator(std::move(*process_symbols));
+        }
+
+        tracker = added_module->createResourceTracker();
+        modules_[module_name] = tracker;
+    }
+
+    llvm::Error err =
+        addToLayer(*add_layer, module_name_ref, std::move(tracker),
+                   std::move(module), std::move(context), opt_level);
+    if (err) {
+        // Drops whatever was registered or defined for the module, so that
+        // the name can be added again
+        if (auto remove_err = remove(module_name))
+            err = llvm::joinErrors(std::move(err), std::move(remove_err));
+    }
+
+    return err;
+}
+
+// Verifies, instruments and adds `module` to `add_layer` under `tracker`,
+// which add() has registered for `module_name`.
+llvm::Error SimpleJITCompiler::addToLayer(
+    llvm::orc::IRLayer &add_layer, llvm::StringRef module_name,
+    llvm::orc::ResourceTrackerSP tracker, std::unique_ptr<llvm::Module> module,
+    std::unique_ptr<llvm::LLVMContext> context, OptLevel opt_level)
 {
-    llvm::orc::JITDylib &added_module =
-        execution_session_.createBareJITDylib(std::string{module_name});
+    if (options_.verify_modules) {
+        std::string message;
+        llvm::raw_string_ostream message_stream{message};
+
+        auto start = std::chrono::steady_clock::now();
+        bool broken = llvm::verifyModule(*module, &message_stream);
+        instrumentation_.recordPhase(module_name, JITPhase::Verify,
+                                     std::chrono::steady_clock::now() - start);
+
+        if (broken)
+            return llvm::createStringError(
+                std::error_code{}, "Module \"%s\" is broken: %s",
+                module_name.str().c_str(), message_stream.str().c_str());
+    }
+
+    if (options_.batch_functions)
+        defineBatchFunctions(*module);
+
+    if (options_.count_calls) {
+        std::vector<std::string> function_names =
+            instrumentCallCounts(*module, CALL_COUNTS_SYMBOL);
+
+        if (!function_names.empty()) {
+            std::atomic<uint64_t> *counts = instrumentation_.createCallCounters(
+                module_name, std::move(function_names));
+
+            if (auto err = tracker->getJITDylib().define(
+                    llvm::orc::absoluteSymbols(
+                        {{mangler_(CALL_COUNTS_SYMBOL),
+                          llvm::JITEvaluatedSymbol(
+                              llvm::pointerToJITTargetAddress(counts),
+                              llvm::JITSymbolFlags::Exported)}}),
+                    tracker))
+                return err;
+        }
+    }
+
+    if (options_.tiered && module->alias_size() == 0 &&
+        module->ifunc_size() == 0)
+        return addTiered(module_name, std::move(tracker),
+                         std::move(module), std::move(context));
 
-    return compile_layer_.add(
-        added_module,
+    instrumentation_.recordOptLevel(module_name, opt_level);
+
+    setModuleOptLevel(*module, opt_level);
+
+    return add_layer.add(
+        std::move(tracker),
         llvm::orc::ThreadSafeModule{std::move(module), std::move(context)});
 }
 
+llvm::Error SimpleJITCompiler::remove(std::string_view module_name)
+{
+    llvm::orc::ResourceTrackerSP tracker;
+    {
+        std::lock_guard<std::mutex> lock{modules_mutex_};
+
+        auto module = modules_.find(module_name);
+        if (module == modules_.end())
+            return llvm::createStringError(std::error_code{},
+                                           "Module \"%s\" has not been added",
+                                           std::string{module_name}.c_str());
+
+        tracker = std::move(module->second);
+        modules_.erase(module);
+    }
+
+    invalidateSymbolCache(module_name);
+
+    std::shared_ptr<TieredModule> tiered;
+    {
+        std::lock_guard<std::mutex> lock{tiered_modules_mutex_};
+        auto tiered_module = tiered_modules_.find(module_name);
+        if (tiered_module != tiered_modules_.end()) {
+            tiered = std::move(tiered_module->second);
+            tiered_modules_.erase(tiered_module);
+        }
+    }
+    if (tiered) {
+        // Waits for a tier-up in progress and cancels queued ones
+        std::lock_guard<std::mutex> lock{tiered->tier_up_mutex};
+        tiered->removed = true;
+    }
+
+    // Drops the object linking layer's memory managers, which releases the
+    // code and data pages of the module.
+    llvm::Error err = tracker->remove();
+
+    // The call counters are only freed along with the code incrementing them
+    instrumentation_.removeModule(
+        llvm::StringRef{module_name.data(), module_name.size()});
+
+    // The lazy layer compiles function bodies in a separate implementation
+    // JITDylib that is not covered by the module's tracker.
+    if (options_.lazy) {
+        std::string implementation_name = std::string{module_name} + ".impl";
+        if (llvm::orc::JITDylib *implementation =
+                execution_session_.getJITDylibByName(implementation_name))
+            err = llvm::joinErrors(std::move(err), implementation->clear());
+    }
+
+    return err;
+}
+
+llvm::Error
+SimpleJITCompiler::replace(std::string_view module_name,
+                           std::unique_ptr<llvm::Module> module,
+                           std::unique_ptr<llvm::LLVMContext> context,
+                           OptLevel opt_level)
+{
+    bool added = false;
+    {
+        std::lock_guard<std::mutex> lock{modules_mutex_};
+        added = modules_.count(module_name) != 0;
+    }
+
+    if (added) {
+        if (auto err = remove(module_name))
+            return err;
+    }
+
+    return add(module_name, std::move(module), std::move(context), opt_level);
+}
+
 llvm::Expected<llvm::JITEvaluatedSymbol>
 SimpleJITCompiler::lookup(std::string_view module_name,
                           std::string_view symbol_name)
 {
-    llvm::orc::JITDylib *dylib =
-        execution_session_.getJITDylibByName(module_name);
-    return execution_session_.lookup({dylib}, mangler_(symbol_name));
+    if (auto cached_symbol = findCachedSymbol(module_name, symbol_name)) {
+        instrumentation_.recordCachedLookup();
+        return *cached_symbol;
+    }
+
+    auto tracker = getModule(module_name);
+    if (!tracker)
+        return tracker.takeError();
+
+    auto start = std::chrono::steady_clock::now();
+    auto symbol = execution_session_.lookup({&(*tracker)->getJITDylib()},
+                                            mangler_(symbol_name));
+    if (symbol) {
+        instrumentation_.recordSymbolResolution(
+            llvm::StringRef{module_name.data(), module_name.size()},
+            std::chrono::steady_clock::now() - start);
+        cacheSymbol(module_name, *tracker, symbol_name, *symbol);
+    }
+
+    return symbol;
+}
+
+llvm::Expected<std::vector<llvm::JITEvaluatedSymbol>>
+SimpleJITCompiler::lookup(
+    llvm::ArrayRef<std::pair<std::string_view, std::string_view>>
+        module_symbols)
+{
+    using LookupResult = llvm::Expected<llvm::orc::SymbolMap>;
+
+    std::vector<std::future<LookupResult>> pending_lookups;
+    pending_lookups.reserve(module_symbols.size());
+    std::vector<llvm::orc::ResourceTrackerSP> trackers;
+    trackers.reserve(module_symbols.size());
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (const auto &[module_name, symbol_name] : module_symbols) {
+        std::promise<LookupResult> lookup_promise;
+        pending_lookups.push_back(lookup_promise.get_future());
+
+        auto tracker = getModule(module_name);
+        if (!tracker) {
+            trackers.emplace_back();
+            lookup_promise.set_value(tracker.takeError());
+            continue;
+        }
+        trackers.push_back(*tracker);
+
+        execution_session_.lookup(
+            llvm::orc::LookupKind::Static,
+            llvm::orc::makeJITDylibSearchOrder(&(*tracker)->getJITDylib()),
+            llvm::orc::SymbolLookupSet{mangler_(symbol_name)},
+            llvm::orc::SymbolState::Ready,
+            [lookup_promise = std::move(lookup_promise)](
+                LookupResult result) mutable
+            { lookup_promise.set_value(std::move(result)); },
+            llvm::orc::NoDependenciesToRegister);
+    }
+
+    std::vector<llvm::JITEvaluatedSymbol> symbols;
+    symbols.reserve(module_symbols.size());
+    llvm::Error err = llvm::Error::success();
+
+    for (size_t index = 0; index < pending_lookups.size(); ++index) {
+        LookupResult result = pending_lookups[index].get();
+        if (!result) {
+            err = llvm::joinErrors(std::move(err), result.takeError());
+            continue;
+        }
+
+        // Resolutions overlap, so each one counts from the first request
+        std::string_view module_name = module_symbols[index].first;
+        instrumentation_.recordSymbolResolution(
+            llvm::StringRef{module_name.data(), module_name.size()},
+            std::chrono::steady_clock::now() - start);
+
+        llvm::JITEvaluatedSymbol symbol = result->begin()->second;
+        cacheSymbol(module_name, trackers[index],
+                    module_symbols[index].second, symbol);
+        symbols.push_back(symbol);
+    }
+
+    if (err)
+        return {std::move(err)};
+
+    return {std::move(symbols)};
+}
+
+template <typename FunctionT>
+llvm::Expected<FunctionT *>
+SimpleJITCompiler::lookupFunction(std::string_view module_name,
+                                  std::string_view symbol_name)
+{
+    auto symbol = lookup(module_name, symbol_name);
+    if (!symbol)
+        return symbol.takeError();
+
+    return llvm::jitTargetAddressToFunction<FunctionT *>(symbol->getAddress());
+}
+
+SimpleJITCompiler::StageTimings
+SimpleJITCompiler::getStageTimings(std::string_view module_name) const
+{
+    auto module = instrumentation_.getModule(
+        llvm::StringRef{module_name.data(), module_name.size()});
+    if (!module)
+        return StageTimings{};
+
+    StageTimings timings;
+    timings.opt_level = module->opt_level;
+    timings.optimize = module->getPhase(JITPhase::Optimize).getTotal();
+    timings.codegen = module->getPhase(JITPhase::Codegen).getTotal();
+    return timings;
+}
+
+void SimpleJITCompiler::printStageTimings(llvm::raw_ostream &os) const
+{
+    os << "Module                           Level   Optimize(us)"
+          "    Codegen(us)\n";
+
+    for (const std::string &module_name : instrumentation_.getModuleNames()) {
+        StageTimings timings = getStageTimings(module_name);
+        os << llvm::format("%-32s %-5s %14.1f %14.1f\n", module_name.c_str(),
+                           getOptLevelName(timings.opt_level).data(),
+                           timings.optimize.count() / 1e3,
+                           timings.codegen.count() / 1e3);
+    }
+}
+
+void SimpleJITCompiler::dumpInstrumentation() const
+{
+    if (options_.instrumentation_dump_path == "-") {
+        instrumentation_.print(llvm::errs());
+        return;
+    }
+
+    std::error_code ec;
+    llvm::raw_fd_ostream output{options_.instrumentation_dump_path, ec,
+                                llvm::sys::fs::OF_Text};
+    if (ec) {
+        llvm::errs() << "Failed to dump JIT instrumentation to "
+                     << options_.instrumentation_dump_path << ": "
+                     << ec.message() << "\n";
+        return;
+    }
+
+    instrumentation_.print(output);
+}
+
+llvm::Expected<llvm::orc::ResourceTrackerSP>
+SimpleJITCompiler::getModule(std::string_view module_name)
+{
+    std::lock_guard<std::mutex> lock{modules_mutex_};
+
+    auto module = modules_.find(module_name);
+    if (module == modules_.end())
+        return llvm::createStringError(std::error_code{},
+                                       "Module \"%s\" has not been added",
+                                       std::string{module_name}.c_str());
+
+    return module->second;
+}
+
+std::unique_ptr<llvm::orc::ObjectLayer> SimpleJITCompiler::createObjectLayer()
+{
+    if (options_.perf_map) {
+        auto perf_map = PerfMapWriter::create();
+        if (perf_map)
+            perf_map_ = std::move(*perf_map);
+        else
+            execution_session_.reportError(perf_map.takeError());
+    }
+
+    if (options_.linker == Linker::JITLink) {
+        auto object_layer = std::make_unique<llvm::orc::ObjectLinkingLayer>(
+            execution_session_,
+            std::make_unique<llvm::jitlink::InProcessMemoryManager>());
+        object_layer->addPlugin(
+            std::make_unique<llvm::orc::EHFrameRegistrationPlugin>(
+                execution_session_,
+                std::make_unique<llvm::jitlink::InProcessEHFrameRegistrar>()));
+        if (perf_map_)
+            object_layer->addPlugin(
+                std::make_unique<PerfMapLinkPlugin>(*perf_map_));
+        if (options_.perf_jitdump)
+            execution_session_.reportError(llvm::createStringError(
+                std::error_code{}, "jitdump needs Linker::RuntimeDyld"));
+        return std::make_unique<TimedObjectLayer>(*this,
+                                                  std::move(object_layer));
+    }
+
+    // Memory managers are created while their object is emitted, but may
+    // finalize on whichever thread resolves its last symbol
+    auto object_layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+        execution_session_,
+        [this]()
+        {
+            return std::make_unique<SlabMemoryManager>(
+                memory_pool_,
+                [this, module_name = materializing_module_](
+                    std::chrono::nanoseconds latency)
+                {
+                    instrumentation_.recordPhase(
+                        module_name, JITPhase::Finalize, latency);
+                });
+        });
+
+    if (perf_map_) {
+        perf_map_listener_ = std::make_unique<PerfMapEventListener>(*perf_map_);
+        object_layer->registerJITEventListener(*perf_map_listener_);
+    }
+
+    if (options_.perf_jitdump) {
+        // Owned by LLVM, and null unless it was built with LLVM_USE_PERF
+        if (llvm::JITEventListener *jitdump =
+                llvm::JITEventListener::createPerfJITEventListener())
+            object_layer->registerJITEventListener(*jitdump);
+        else
+            execution_session_.reportError(llvm::createStringError(
+                std::error_code{},
+                "jitdump needs an LLVM built with LLVM_USE_PERF"));
+    }
+
+    return std::make_unique<TimedObjectLayer>(*this, std::move(object_layer));
+}
+
+std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>
+SimpleJITCompiler::createCompiler()
+{
+    // A TargetMachine is not thread-safe, so compile threads need the
+    // concurrent compiler which builds one per compiled module. So do
+    // tier-ups, which compile next to the application's lookups.
+    if (options_.tiered) {
+        llvm::orc::JITTargetMachineBuilder tier_zero_builder =
+            CreateJITTargetMachineBuilder(options_.cpu);
+        tier_zero_builder.setCodeGenOptLevel(llvm::CodeGenOpt::None);
+
+        return std::make_unique<TieredCompiler>(
+            std::make_unique<llvm::orc::ConcurrentIRCompiler>(
+                std::move(tier_zero_builder), object_cache_.get()),
+            std::make_unique<llvm::orc::ConcurrentIRCompiler>(
+                CreateJITTargetMachineBuilder(options_.cpu),
+                object_cache_.get()));
+    }
+
+    if (options_.compile_threads > 0)
+        return std::make_unique<llvm::orc::ConcurrentIRCompiler>(
+            CreateJITTargetMachineBuilder(options_.cpu), object_cache_.get());
+
+    return std::make_unique<llvm::orc::SimpleCompiler>(
+        *GetDefaultTargetMachine(options_.cpu), object_cache_.get());
+}
+
+// The level createCompiler() compiles `module` at, as TieredCompiler picks it
+llvm::CodeGenOpt::Level
+SimpleJITCompiler::getCodeGenOptLevel(const llvm::Module &module) const
+{
+    if (options_.tiered && getModuleOptLevel(module) == OptLevel::O0)
+        return llvm::CodeGenOpt::None;
+    return GetDefaultTargetMachine(options_.cpu)->getOptLevel();
+}
+
+llvm::Optional<llvm::JITEvaluatedSymbol>
+SimpleJITCompiler::findCachedSymbol(std::string_view module_name,
+                                    std::string_view symbol_name) const
+{
+    std::shared_lock<std::shared_mutex> lock{symbol_cache_mutex_};
+
+    auto module_symbols = symbol_cache_.find(module_name);
+    if (module_symbols == symbol_cache_.end())
+        return llvm::None;
+
+    auto symbol = module_symbols->second.find(symbol_name);
+    if (symbol == module_symbols->second.end())
+        return llvm::None;
+
+    return symbol->second;
+}
+
+// `tracker` is the tracker of `module_name` the symbol was looked up in. A
+// lookup can finish after the module has been removed, or removed and added
+// again, and invalidated its symbols; the symbol is dropped then instead of
+// caching an address that may already be freed.
+void SimpleJITCompiler::cacheSymbol(std::string_view module_name,
+                                    const llvm::orc::ResourceTrackerSP &tracker,
+                                    std::string_view symbol_name,
+                                    llvm::JITEvaluatedSymbol symbol)
+{
+    std::unique_lock<std::shared_mutex> lock{symbol_cache_mutex_};
+    {
+        // remove() unregisters the module before invalidating its symbols
+        std::lock_guard<std::mutex> modules_lock{modules_mutex_};
+        auto module = modules_.find(module_name);
+        if (module == modules_.end() || module->second != tracker)
+            return;
+    }
+    symbol_cache_[module_name].try_emplace(symbol_name, symbol);
+}
+
+void SimpleJITCompiler::invalidateSymbolCache(std::string_view module_name)
+{
+    std::unique_lock<std::shared_mutex> lock{symbol_cache_mutex_};
+    symbol_cache_.erase(module_name);
+}
+
+llvm::Expected<llvm::orc::IRLayer &> SimpleJITCompiler::getAddLayer()
+{
+    if (!options_.lazy || options_.tiered)
+        return optimize_layer_;
+
+    // Building the call-through manager can fail on unsupported targets,
+    // so the lazy layer is set up on first use where the error can be
+    // returned.
+    std::lock_guard<std::mutex> lock{lazy_layer_mutex_};
+
+    if (lazy_layer_)
+        return *lazy_layer_;
+
+    const llvm::Triple &triple = GetDefaultTargetTriple();
+
+    if (auto err = createLazyCallThrough())
+        return {std::move(err)};
+
+    auto stubs_builder =
+        llvm::orc::createLocalIndirectStubsManagerBuilder(triple);
+    if (!stubs_builder)
+        return llvm::createStringError(
+            std::error_code{}, "No indirect stubs manager for target %s",
+            triple.str().c_str());
+
+    lazy_layer_ = std::make_unique<llvm::orc::CompileOnDemandLayer>(
+        execution_session_, optimize_layer_, *lazy_call_through_,
+        std::move(stubs_builder));
+    lazy_layer_->setPartitionFunction(
+        llvm::orc::CompileOnDemandLayer::compileRequested);
+
+    return *lazy_layer_;
+}
+
+// Sets up the call-through manager behind the stubs of lazy and tiered
+// modules. Expects lazy_layer_mutex_ to be held.
+llvm::Error SimpleJITCompiler::createLazyCallThrough()
+{
+    if (lazy_call_through_)
+        return llvm::Error::success();
+
+    auto lazy_call_through = llvm::orc::createLocalLazyCallThroughManager(
+        GetDefaultTargetTriple(), execution_session_,
+        llvm::pointerToJITTargetAddress(&handleLazyCompileFailure));
+    if (!lazy_call_through)
+        return lazy_call_through.takeError();
+
+    lazy_call_through_ = std::move(*lazy_call_through);
+    return llvm::Error::success();
+}
+
+// Runs in place of a lazily compiled function whose body failed to compile.
+// The execution session has reported the error by then; returning to the
+// caller without a result is not an option.
+void SimpleJITCompiler::handleLazyCompileFailure()
+{
+    llvm::report_fatal_error("Lazy compilation of a JIT'd function failed",
+                             /*gen_crash_diag*/ false);
+}
+
+llvm::Error
+SimpleJITCompiler::addTiered(llvm::StringRef module_name,
+                             llvm::orc::ResourceTrackerSP tracker,
+                             std::unique_ptr<llvm::Module> module,
+                             std::unique_ptr<llvm::LLVMContext> context)
+{
+    const llvm::Triple &triple = GetDefaultTargetTriple();
+
+    auto stubs_builder =
+        llvm::orc::createLocalIndirectStubsManagerBuilder(triple);
+    if (!stubs_builder)
+        return llvm::createStringError(
+            std::error_code{}, "No indirect stubs manager for target %s",
+            triple.str().c_str());
+
+    {
+        std::lock_guard<std::mutex> lock{lazy_layer_mutex_};
+        if (auto err = createLazyCallThrough())
+            return err;
+    }
+
+    auto tiered = std::make_shared<TieredModule>(
+        *this, module_name.str(), tracker, stubs_builder());
+
+    {
+        llvm::raw_svector_ostream bitcode_stream{tiered->bitcode};
+        llvm::WriteBitcodeToFile(*module, bitcode_stream);
+    }
+
+    TierZeroFunctions functions =
+        instrumentTierZero(*module, options_.tier_up_threshold);
+    tiered->function_names = functions.names;
+    tiered->call_counts =
+        std::vector<std::atomic<uint64_t>>(functions.names.size());
+    tiered->branch_counts =
+        std::vector<std::atomic<uint64_t>>(2 * functions.branch_count);
+
+    llvm::orc::JITDylib &dylib = tracker->getJITDylib();
+
+    llvm::orc::SymbolMap runtime_symbols;
+    auto add_runtime_symbol =
+        [&](const char *name, llvm::JITTargetAddress address)
+    {
+        runtime_symbols[mangler_(name)] = llvm::JITEvaluatedSymbol(
+            address, llvm::JITSymbolFlags::Exported);
+    };
+    if (!tiered->call_counts.empty()) {
+        add_runtime_symbol(
+            TIER_CALL_COUNTS_SYMBOL,
+            llvm::pointerToJITTargetAddress(tiered->call_counts.data()));
+        add_runtime_symbol(TIER_UP_CONTEXT_SYMBOL,
+                           llvm::pointerToJITTargetAddress(tiered.get()));
+        add_runtime_symbol(TIER_UP_SYMBOL,
+                           llvm::pointerToJITTargetAddress(&requestTierUp));
+    }
+    if (!tiered->branch_counts.empty())
+        add_runtime_symbol(
+            TIER_BRANCH_COUNTS_SYMBOL,
+            llvm::pointerToJITTargetAddress(tiered->branch_counts.data()));
+
+    if (!runtime_symbols.empty()) {
+        if (auto err = dylib.define(
+                llvm::orc::absoluteSymbols(std::move(runtime_symbols)),
+                tracker))
+            return err;
+    }
+
+    // Each function is called through a stub, which the first call points
+    // at the tier-0 body and a tier-up at the optimized one
+    llvm::orc::SymbolAliasMap stubs;
+    for (size_t index = 0; index < functions.names.size(); ++index) {
+        stubs[mangler_(functions.names[index])] =
+            llvm::orc::SymbolAliasMapEntry(
+                mangler_(functions.body_names[index]),
+                llvm::JITSymbolFlags::Exported |
+                    llvm::JITSymbolFlags::Callable);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{tiered_modules_mutex_};
+        tiered_modules_[module_name] = tiered;
+    }
+
+    instrumentation_.recordOptLevel(module_name, OptLevel::O0);
+    setModuleOptLevel(*module, OptLevel::O0);
+
+    if (auto err = optimize_layer_.add(
+            tracker,
+            llvm::orc::ThreadSafeModule{std::move(module), std::move(context)}))
+        return err;
+
+    if (stubs.empty())
+        return llvm::Error::success();
+
+    return dylib.define(llvm::orc::lazyReexports(*lazy_call_through_,
+                                                 tiered->stubs, dylib,
+                                                 std::move(stubs)),
+                        std::move(tracker));
+}
+
+void SimpleJITCompiler::requestTierUp(TieredModule *module,
+                                      uint64_t function_index)
+{
+    // Called from tier-0 code, which must not wait for the compile
+    module->jit.tier_up_thread_->async(
+        [weak_module = module->weak_from_this(), function_index]()
+        {
+            if (std::shared_ptr<TieredModule> module = weak_module.lock())
+                module->jit.tierUp(*module, function_index);
+        });
+}
+
+void SimpleJITCompiler::tierUp(TieredModule &module, uint64_t function_index)
+{
+    std::lock_guard<std::mutex> lock{module.tier_up_mutex};
+    if (module.removed)
+        return;
+
+    const std::string &function_name = module.function_names[function_index];
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto optimized_module = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef{
+            llvm::StringRef{module.bitcode.data(), module.bitcode.size()},
+            module.name},
+        *context);
+    if (!optimized_module) {
+        execution_session_.reportError(optimized_module.takeError());
+        return;
+    }
+
+    auto body_name =
+        prepareTierOne(**optimized_module, function_name, module.call_counts,
+                       module.branch_counts);
+    if (!body_name) {
+        execution_session_.reportError(body_name.takeError());
+        return;
+    }
+
+    setModuleOptLevel(**optimized_module, OptLevel::O3);
+
+    if (auto err = optimize_layer_.add(
+            module.tracker,
+            llvm::orc::ThreadSafeModule{std::move(*optimized_module),
+                                        std::move(context)})) {
+        execution_session_.reportError(std::move(err));
+        return;
+    }
+
+    auto body = execution_session_.lookup({&module.tracker->getJITDylib()},
+                                          mangler_(*body_name));
+    if (!body) {
+        execution_session_.reportError(body.takeError());
+        return;
+    }
+
+    if (auto err = module.stubs.promote(*mangler_(function_name),
+                                        body->getAddress())) {
+        execution_session_.reportError(std::move(err));
+        return;
+    }
+
+    tier_ups_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SimpleJITCompiler::waitForTierUps()
+{
+    if (tier_up_thread_)
+        tier_up_thread_->wait();
+}
+
+llvm::StringRef SimpleJITCompiler::getModuleName(
+    const llvm::orc::MaterializationResponsibility &responsibility) const
+{
+    llvm::StringRef module_name =
+        responsibility.getTargetJITDylib().getName();
+
+    // Function bodies of lazy modules live in "<name>.impl"
+    if (options_.lazy)
+        module_name.consume_back(".impl");
+
+    return module_name;
+}
+
+llvm::Expected<llvm::orc::ThreadSafeModule>
+SimpleJITCompiler::optimize(
+    llvm::orc::ThreadSafeModule module,
+    llvm::orc::MaterializationResponsibility &responsibility)
+{
+    materializing_module_ = getModuleName(responsibility).str();
+
+    module.withModuleDo(
+        [this](llvm::Module &ir_module)
+        {
+            OptLevel opt_level = getModuleOptLevel(ir_module);
+
+            // Key the cached object by the IR as it was added, so that a
+            // warm start finds it before spending time on optimization. The
+            // object is loaded right away: were it only checked for, it
+            // could be gone by codegen, which would then file unoptimized
+            // code under the key.
+            if (object_cache_) {
+                object_cache_->tagModule(ir_module,
+                                         getCodeGenOptLevel(ir_module));
+                if (object_cache_->prefetchObject(ir_module))
+                    return;
+            }
+
+            // The shared TargetMachine caches subtargets without locking, so
+            // compile threads and tier-ups hand the pipeline a private one.
+            std::unique_ptr<llvm::TargetMachine> private_target_machine;
+            llvm::TargetMachine *target_machine =
+                GetDefaultTargetMachine(options_.cpu);
+            if (options_.compile_threads > 0 || options_.tiered) {
+                private_target_machine = CreateTargetMachine(options_.cpu);
+                target_machine = private_target_machine.get();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            optimizeModule(ir_module, opt_level, target_machine);
+            instrumentation_.recordPhase(
+                materializing_module_, JITPhase::Optimize,
+                std::chrono::steady_clock::now() - start);
+        });
+
+    return {std::move(module)};
 }
 
 #endif // SIMPLE_JIT_COMPILER_HPP_
@@ -0,0 +1,456 @@
+#ifndef INCLUDE_SLAB_MEMORY_MANAGER_HPP_
+#define INCLUDE_SLAB_MEMORY_MANAGER_HPP_
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/Support/Alignment.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// Count, total and worst case of a repeatedly measured operation.
+struct LatencyStatistics {
+    uint64_t count = 0;
+    std::chrono::nanoseconds total{0};
+    std::chrono::nanoseconds max{0};
+
+    void record(std::chrono::nanoseconds latency) {
+        ++count;
+        total += latency;
+        max = std::max(max, latency);
+    }
+
+    double meanMicroseconds() const {
+        return count == 0 ? 0.0 : total.count() / 1e3 / count;
+    }
+};
+
+// Large read-write mappings ("slabs") shared by the memory managers of many
+// JIT'd objects.
+//
+// Code chunks are page-aligned and a whole number of pages, so each object can
+// change the permissions of its own pages. Data chunks of different objects
+// are packed next to each other and stay read-write. A slab is unmapped once
+// every chunk carved from it has been released. Thread-safe.
+class JITMemoryPool {
+  public:
+    static constexpr size_t DEFAULT_SLAB_SIZE = 4 * 1024 * 1024;
+
+    enum class ChunkKind { Code, Data };
+
+    struct Chunk {
+        void *slab = nullptr;
+        uint8_t *address = nullptr;
+        size_t size = 0;
+    };
+
+    struct Statistics {
+        uint64_t slabs_mapped = 0;
+        uint64_t slabs_unmapped = 0;
+        uint64_t live_chunks = 0;
+        uint64_t protect_calls = 0;
+        LatencyStatistics allocation;
+        LatencyStatistics finalization;
+    };
+
+    explicit JITMemoryPool(size_t slab_size = DEFAULT_SLAB_SIZE);
+    ~JITMemoryPool();
+
+    JITMemoryPool(const JITMemoryPool &) = delete;
+    JITMemoryPool &operator=(const JITMemoryPool &) = delete;
+
+    size_t getPageSize() const { return page_size_; }
+
+    // Returns a chunk of at least `size` bytes aligned to `alignment`, or a
+    // null address if no memory could be mapped.
+    Chunk allocate(ChunkKind kind, size_t size, size_t alignment);
+    void release(const Chunk &chunk);
+
+    void recordAllocation(std::chrono::nanoseconds latency);
+    void recordFinalization(std::chrono::nanoseconds latency,
+                            uint64_t protect_calls);
+
+    Statistics getStatistics() const;
+    void printStatistics(llvm::raw_ostream &os) const;
+
+  private:
+    struct Slab {
+        llvm::sys::MemoryBlock block;
+        ChunkKind kind;
+        size_t used = 0;
+        size_t live_chunks = 0;
+    };
+
+    Slab *mapSlab(ChunkKind kind, size_t size);
+
+    size_t page_size_;
+    size_t slab_size_;
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Slab>> slabs_;
+    Slab *current_code_slab_ = nullptr;
+    Slab *current_data_slab_ = nullptr;
+    Statistics statistics_;
+};
+
+JITMemoryPool::JITMemoryPool(size_t slab_size)
+    : page_size_{llvm::sys::Process::getPageSizeEstimate()},
+      slab_size_{llvm::alignTo(slab_size, page_size_)} {}
+
+JITMemoryPool::~JITMemoryPool() {
+    for (auto &slab : slabs_)
+        llvm::sys::Memory::releaseMappedMemory(slab->block);
+}
+
+JITMemoryPool::Chunk JITMemoryPool::allocate(ChunkKind kind, size_t size,
+                                             size_t alignment) {
+    if (kind == ChunkKind::Code) {
+        alignment = std::max(alignment, page_size_);
+        size = llvm::alignTo(size, page_size_);
+    }
+    alignment = std::max<size_t>(alignment, 1);
+
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    Slab *&current =
+        kind == ChunkKind::Code ? current_code_slab_ : current_data_slab_;
+
+    auto fits = [&](const Slab *slab) {
+        return slab != nullptr &&
+               llvm::alignTo(slab->used, alignment) + size <=
+                   slab->block.allocatedSize();
+    };
+
+    Slab *slab = current;
+    if (!fits(slab)) {
+        // Oversized requests get a slab of their own and leave the current
+        // one to the small objects that follow.
+        size_t needed = llvm::alignTo(size + alignment, page_size_);
+        slab = mapSlab(kind, std::max(needed, slab_size_));
+        if (slab == nullptr)
+            return Chunk{};
+        if (needed <= slab_size_)
+            current = slab;
+    }
+
+    size_t offset = llvm::alignTo(slab->used, alignment);
+    slab->used = offset + size;
+    ++slab->live_chunks;
+    ++statistics_.live_chunks;
+
+    return Chunk{slab, static_cast<uint8_t *>(slab->block.base()) + offset,
+                 size};
+}
+
+void JITMemoryPool::release(const Chunk &chunk) {
+    if (chunk.slab == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto *slab = static_cast<Slab *>(chunk.slab);
+    --statistics_.live_chunks;
+    if (--slab->live_chunks != 0)
+        return;
+
+    if (slab == current_code_slab_ || slab == current_data_slab_) {
+        // Keep the slab mapped for the next objects. Code pages may have
+        // been made executable and must become writable again.
+        if (slab->kind == ChunkKind::Code && slab->used != 0) {
+            llvm::sys::MemoryBlock used_pages{
+                slab->block.base(), llvm::alignTo(slab->used, page_size_)};
+            llvm::sys::Memory::protectMappedMemory(
+                used_pages, llvm::sys::Memory::MF_READ |
+                                llvm::sys::Memory::MF_WRITE);
+            ++statistics_.protect_calls;
+        }
+        slab->used = 0;
+        return;
+    }
+
+    llvm::sys::Memory::releaseMappedMemory(slab->block);
+    ++statistics_.slabs_unmapped;
+    slabs_.erase(std::find_if(
+        slabs_.begin(), slabs_.end(),
+        [slab](const std::unique_ptr<Slab> &owned) {
+            return owned.get() == slab;
+        }));
+}
+
+void JITMemoryPool::recordAllocation(std::chrono::nanoseconds latency) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    statistics_.allocation.record(latency);
+}
+
+void JITMemoryPool::recordFinalization(std::chrono::nanoseconds latency,
+                                       uint64_t protect_calls) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    statistics_.finalization.record(latency);
+    statistics_.protect_calls += protect_calls;
+}
+
+JITMemoryPool::Statistics JITMemoryPool::getStatistics() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return statistics_;
+}
+
+void JITMemoryPool::printStatistics(llvm::raw_ostream &os) const {
+    Statistics statistics = getStatistics();
+
+    os << llvm::format("JIT memory pool (%llu KiB slabs)\n",
+                       static_cast<unsigned long long>(slab_size_ / 1024))
+       << llvm::format("  slabs mapped %llu, unmapped %llu, live chunks %llu, "
+                       "mprotect calls %llu\n",
+                       static_cast<unsigned long long>(statistics.slabs_mapped),
+                       static_cast<unsigned long long>(
+                           statistics.slabs_unmapped),
+                       static_cast<unsigned long long>(statistics.live_chunks),
+                       static_cast<unsigned long long>(
+                           statistics.protect_calls))
+       << llvm::format(
+              "  allocation   %8llu objects, mean %8.2f us, max %8.2f us\n",
+              static_cast<unsigned long long>(statistics.allocation.count),
+              statistics.allocation.meanMicroseconds(),
+              statistics.allocation.max.count() / 1e3)
+       << llvm::format(
+              "  finalization %8llu objects, mean %8.2f us, max %8.2f us\n",
+              static_cast<unsigned long long>(statistics.finalization.count),
+              statistics.finalization.meanMicroseconds(),
+              statistics.finalization.max.count() / 1e3);
+}
+
+JITMemoryPool::Slab *JITMemoryPool::mapSlab(ChunkKind kind, size_t size) {
+    // Keep slabs close to each other so that code can reach the data of its
+    // object with 32-bit PC-relative relocations.
+    const llvm::sys::MemoryBlock *near_block =
+        slabs_.empty() ? nullptr : &slabs_.back()->block;
+
+    std::error_code ec;
+    llvm::sys::MemoryBlock block = llvm::sys::Memory::allocateMappedMemory(
+        size, near_block,
+        llvm::sys::Memory::MF_READ | llvm::sys::Memory::MF_WRITE, ec);
+    if (ec)
+        return nullptr;
+
+    auto slab = std::make_unique<Slab>();
+    slab->block = block;
+    slab->kind = kind;
+
+    slabs_.push_back(std::move(slab));
+    ++statistics_.slabs_mapped;
+    return slabs_.back().get();
+}
+
+// RuntimeDyld memory manager of a single object, allocating from a shared
+// JITMemoryPool.
+//
+// RuntimeDyld reports the total section sizes up front, so all code and
+// read-only data of the object is laid out in one run of pages: code first,
+// read-only data from the next page boundary. Finalization then takes at
+// most two mprotect calls per object, independent of its section count.
+// Destroying the manager (e.g. when its module is removed) returns the
+// memory to the pool.
+class SlabMemoryManager : public llvm::RTDyldMemoryManager {
+  public:
+    // Called with the latency of every finalizeMemory().
+    using FinalizeCallback = std::function<void(std::chrono::nanoseconds)>;
+
+    explicit SlabMemoryManager(JITMemoryPool &pool,
+                               FinalizeCallback on_finalize = nullptr)
+        : pool_{pool}, on_finalize_{std::move(on_finalize)} {}
+    ~SlabMemoryManager() override;
+
+    bool needsToReserveAllocationSpace() override { return true; }
+
+    void reserveAllocationSpace(uintptr_t code_size, uint32_t code_align,
+                                uintptr_t rodata_size, uint32_t rodata_align,
+                                uintptr_t rwdata_size,
+                                uint32_t rwdata_align) override;
+
+    uint8_t *allocateCodeSection(uintptr_t size, unsigned alignment,
+                                 unsigned section_id,
+                                 llvm::StringRef section_name) override;
+
+    uint8_t *allocateDataSection(uintptr_t size, unsigned alignment,
+                                 unsigned section_id,
+                                 llvm::StringRef section_name,
+                                 bool is_read_only) override;
+
+    bool finalizeMemory(std::string *error_message) override;
+
+  private:
+    // Bump allocator over (part of) a pool chunk.
+    struct Arena {
+        uint8_t *begin = nullptr;
+        size_t size = 0;
+        size_t used = 0;
+    };
+
+    uint8_t *allocateFrom(Arena &arena, size_t size, size_t alignment,
+                          unsigned protection);
+
+    // Takes a chunk from the pool that is freed with this manager.
+    uint8_t *takeChunk(JITMemoryPool::ChunkKind kind, size_t size,
+                       size_t alignment);
+
+    void addProtection(uint8_t *begin, size_t size, unsigned protection);
+
+    JITMemoryPool &pool_;
+    FinalizeCallback on_finalize_;
+
+    Arena code_;
+    Arena rodata_;
+    Arena rwdata_;
+
+    std::vector<JITMemoryPool::Chunk> chunks_;
+    std::vector<std::pair<llvm::sys::MemoryBlock, unsigned>> protections_;
+};
+
+SlabMemoryManager::~SlabMemoryManager() {
+    for (const JITMemoryPool::Chunk &chunk : chunks_)
+        pool_.release(chunk);
+}
+
+void SlabMemoryManager::reserveAllocationSpace(
+    uintptr_t code_size, uint32_t code_align, uintptr_t rodata_size,
+    uint32_t rodata_align, uintptr_t rwdata_size, uint32_t rwdata_align) {
+    auto start = std::chrono::steady_clock::now();
+
+    size_t page_size = pool_.getPageSize();
+    size_t code_pages = llvm::alignTo(code_size, page_size);
+    size_t rodata_pages = llvm::alignTo(rodata_size, page_size);
+
+    if (code_pages + rodata_pages != 0) {
+        if (uint8_t *pages = takeChunk(JITMemoryPool::ChunkKind::Code,
+                                       code_pages + rodata_pages,
+                                       std::max(code_align, rodata_align))) {
+            code_ = Arena{pages, code_pages};
+            rodata_ = Arena{pages + code_pages, rodata_pages};
+            addProtection(code_.begin, code_.size,
+                          llvm::sys::Memory::MF_READ |
+                              llvm::sys::Memory::MF_EXEC);
+            addProtection(rodata_.begin, rodata_.size,
+                          llvm::sys::Memory::MF_READ);
+        }
+    }
+
+    if (rwdata_size != 0) {
+        if (uint8_t *data = takeChunk(JITMemoryPool::ChunkKind::Data,
+                                      rwdata_size, rwdata_align))
+            rwdata_ = Arena{data, rwdata_size};
+    }
+
+    pool_.recordAllocation(std::chrono::steady_clock::now() - start);
+}
+
+uint8_t *SlabMemoryManager::allocateCodeSection(uintptr_t size,
+                                                unsigned alignment,
+                                                unsigned /*section_id*/,
+                                                llvm::StringRef) {
+    return allocateFrom(code_, size, alignment,
+                        llvm::sys::Memory::MF_READ |
+                            llvm::sys::Memory::MF_EXEC);
+}
+
+uint8_t *SlabMemoryManager::allocateDataSection(uintptr_t size,
+                                                unsigned alignment,
+                                                unsigned /*section_id*/,
+                                                llvm::StringRef,
+                                                bool is_read_only) {
+    if (is_read_only)
+        return allocateFrom(rodata_, size, alignment,
+                            llvm::sys::Memory::MF_READ);
+
+    return allocateFrom(rwdata_, size, alignment,
+                        llvm::sys::Memory::MF_READ |
+                            llvm::sys::Memory::MF_WRITE);
+}
+
+bool SlabMemoryManager::finalizeMemory(std::string *error_message) {
+    auto start = std::chrono::steady_clock::now();
+
+    uint64_t protect_calls = 0;
+    for (const auto &[block, protection] : protections_) {
+        std::error_code ec =
+            llvm::sys::Memory::protectMappedMemory(block, protection);
+        ++protect_calls;
+        if (ec) {
+            if (error_message != nullptr)
+                *error_message = ec.message();
+            return true;
+        }
+
+        if (protection & llvm::sys::Memory::MF_EXEC)
+            llvm::sys::Memory::InvalidateInstructionCache(
+                block.base(), block.allocatedSize());
+    }
+    protections_.clear();
+
+    std::chrono::nanoseconds latency = std::chrono::steady_clock::now() - start;
+    pool_.recordFinalization(latency, protect_calls);
+    if (on_finalize_)
+        on_finalize_(latency);
+    return false;
+}
+
+uint8_t *SlabMemoryManager::allocateFrom(Arena &arena, size_t size,
+                                         size_t alignment,
+                                         unsigned protection) {
+    alignment = std::max<size_t>(alignment, 1);
+
+    size_t offset = llvm::alignTo(
+        reinterpret_cast<uintptr_t>(arena.begin) + arena.used, alignment) -
+                    reinterpret_cast<uintptr_t>(arena.begin);
+    if (arena.begin != nullptr && offset + size <= arena.size) {
+        arena.used = offset + size;
+        return arena.begin + offset;
+    }
+
+    // The reservation was too small or missing: fall back to a chunk of
+    // its own.
+    auto start = std::chrono::steady_clock::now();
+
+    bool is_writable = protection & llvm::sys::Memory::MF_WRITE;
+    auto kind = is_writable ? JITMemoryPool::ChunkKind::Data
+                            : JITMemoryPool::ChunkKind::Code;
+
+    uint8_t *chunk = takeChunk(kind, size, alignment);
+    if (chunk != nullptr && !is_writable)
+        addProtection(chunk, llvm::alignTo(size, pool_.getPageSize()),
+                      protection);
+
+    pool_.recordAllocation(std::chrono::steady_clock::now() - start);
+    return chunk;
+}
+
+uint8_t *SlabMemoryManager::takeChunk(JITMemoryPool::ChunkKind kind,
+                                      size_t size, size_t alignment) {
+    JITMemoryPool::Chunk chunk = pool_.allocate(kind, size, alignment);
+    if (chunk.address == nullptr)
+        return nullptr;
+
+    chunks_.push_back(chunk);
+    return chunk.address;
+}
+
+void SlabMemoryManager::addProtection(uint8_t *begin, size_t size,
+                                      unsigned protection) {
+    if (size != 0)
+        protections_.emplace_back(llvm::sys::MemoryBlock{begin, size},
+                                  protection);
+}
+
+#endif // INCLUDE_SLAB_MEMORY_MANAGER_HPP_
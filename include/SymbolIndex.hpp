@@ -0,0 +1,315 @@
+#ifndef INCLUDE_SYMBOL_INDEX_HPP_
+#define INCLUDE_SYMBOL_INDEX_HPP_
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/BinaryFormat/ELF.h"
+#include "llvm/Object/ELF.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Object/SymbolicFile.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/Error.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Name to address index over the defined symbols of an ObjectFile, built
+// once and answering lookups in constant time.
+//
+// ELF files carrying a .gnu.hash or .hash section (executables and shared
+// libraries) look up their dynamic symbols through that section, which costs
+// nothing to build. The remaining symbols, i.e. all symbols of every other
+// file and the static .symtab symbols missing from the dynamic table, are
+// hashed once. Names are looked up exactly as stored, i.e. already mangled.
+// The ObjectFile must outlive the index.
+class SymbolIndex {
+  public:
+    static llvm::Expected<SymbolIndex>
+    create(const llvm::object::ObjectFile &object_file);
+
+    llvm::Optional<uint64_t> lookup(llvm::StringRef name) const;
+
+    // True if dynamic symbols are looked up through an ELF hash section.
+    bool usesHashSection() const { return hash_table_ != nullptr; }
+
+    // Number of symbols in the index.
+    size_t size() const {
+        return (hash_table_ ? hash_table_->size() : 0) + addresses_.size();
+    }
+
+  private:
+    class HashTable {
+      public:
+        virtual ~HashTable() = default;
+        virtual llvm::Optional<uint64_t> lookup(llvm::StringRef name) const = 0;
+        virtual size_t size() const = 0;
+    };
+
+    template <typename ELFT> class ELFHashTable;
+
+    template <typename ELFT>
+    static llvm::Expected<std::unique_ptr<HashTable>>
+    createELFHashTable(const llvm::object::ELFObjectFile<ELFT> &object_file);
+
+    static llvm::Expected<std::unique_ptr<HashTable>>
+    createHashTable(const llvm::object::ObjectFile &object_file);
+
+    std::unique_ptr<HashTable> hash_table_;
+    // Symbols hash_table_ does not cover
+    llvm::StringMap<uint64_t> addresses_;
+};
+
+// Lookups through the .gnu.hash or SysV .hash section of an ELF file and the
+// dynamic symbol table it indexes.
+template <typename ELFT>
+class SymbolIndex::ELFHashTable : public SymbolIndex::HashTable {
+  public:
+    using Elf_GnuHash = typename ELFT::GnuHash;
+    using Elf_Hash = typename ELFT::Hash;
+    using Elf_Sym = typename ELFT::Sym;
+
+    ELFHashTable(const Elf_GnuHash *gnu_hash, const Elf_Hash *sysv_hash,
+                 llvm::ArrayRef<Elf_Sym> symbols, llvm::StringRef string_table)
+        : gnu_hash_{gnu_hash}, sysv_hash_{sysv_hash}, symbols_{symbols},
+          string_table_{string_table} {}
+
+    llvm::Optional<uint64_t> lookup(llvm::StringRef name) const override {
+        return gnu_hash_ ? lookupGnu(name) : lookupSysV(name);
+    }
+
+    size_t size() const override { return symbols_.size(); }
+
+  private:
+    static uint32_t hashGnu(llvm::StringRef name) {
+        uint32_t hash = 5381;
+        for (unsigned char character : name)
+            hash = hash * 33 + character;
+        return hash;
+    }
+
+    llvm::Optional<uint64_t> lookupGnu(llvm::StringRef name) const {
+        constexpr uint32_t FILTER_BITS = ELFT::Is64Bits ? 64 : 32;
+
+        uint32_t hash = hashGnu(name);
+
+        // The Bloom filter rejects most absent names with one load
+        auto filter = gnu_hash_->filter();
+        uint64_t filter_word = filter[(hash / FILTER_BITS) % filter.size()];
+        uint64_t filter_mask =
+            (uint64_t{1} << (hash % FILTER_BITS)) |
+            (uint64_t{1} << ((hash >> gnu_hash_->shift2) % FILTER_BITS));
+        if ((filter_word & filter_mask) != filter_mask)
+            return llvm::None;
+
+        uint32_t first_symbol = gnu_hash_->symndx;
+        uint32_t index = gnu_hash_->buckets()[hash % gnu_hash_->nbuckets];
+        if (index < first_symbol)
+            return llvm::None;
+
+        auto chain = gnu_hash_->values(symbols_.size());
+        for (; index - first_symbol < chain.size(); ++index) {
+            uint32_t chain_hash = chain[index - first_symbol];
+            if ((chain_hash | 1) == (hash | 1)) {
+                if (auto address = matchSymbol(index, name))
+                    return address;
+            }
+
+            // The low bit marks the end of the bucket's chain
+            if (chain_hash & 1)
+                break;
+        }
+
+        return llvm::None;
+    }
+
+    llvm::Optional<uint64_t> lookupSysV(llvm::StringRef name) const {
+        auto buckets = sysv_hash_->buckets();
+        auto chains = sysv_hash_->chains();
+
+        uint32_t index = buckets[llvm::object::hashSysV(name) % buckets.size()];
+        for (size_t visited = 0; index != llvm::ELF::STN_UNDEF &&
+                                 index < chains.size() &&
+                                 visited < chains.size();
+             index = chains[index], ++visited) {
+            if (auto address = matchSymbol(index, name))
+                return address;
+        }
+
+        return llvm::None;
+    }
+
+    llvm::Optional<uint64_t> matchSymbol(uint32_t index,
+                                         llvm::StringRef name) const {
+        if (index >= symbols_.size())
+            return llvm::None;
+
+        const Elf_Sym &symbol = symbols_[index];
+        if (symbol.st_shndx == llvm::ELF::SHN_UNDEF ||
+            symbol.st_name >= string_table_.size())
+            return llvm::None;
+
+        llvm::StringRef symbol_name =
+            string_table_.drop_front(symbol.st_name).split('\0').first;
+        if (symbol_name != name)
+            return llvm::None;
+
+        return static_cast<uint64_t>(symbol.st_value);
+    }
+
+    const Elf_GnuHash *gnu_hash_;
+    const Elf_Hash *sysv_hash_;
+    llvm::ArrayRef<Elf_Sym> symbols_;
+    llvm::StringRef string_table_;
+};
+
+llvm::Expected<SymbolIndex>
+SymbolIndex::create(const llvm::object::ObjectFile &object_file) {
+    SymbolIndex index;
+
+    auto hash_table = createHashTable(object_file);
+    if (!hash_table)
+        return hash_table.takeError();
+
+    index.hash_table_ = std::move(*hash_table);
+
+    for (const auto &symbol : object_file.symbols()) {
+        auto flags = symbol.getFlags();
+        if (!flags)
+            return flags.takeError();
+        if (*flags & llvm::object::SymbolRef::SF_Undefined)
+            continue;
+
+        auto name = symbol.getName();
+        if (!name)
+            return name.takeError();
+
+        // Exported symbols are already found through the hash section
+        if (index.hash_table_ && index.hash_table_->lookup(*name))
+            continue;
+
+        auto address = symbol.getAddress();
+        if (!address)
+            return address.takeError();
+
+        // Keep the first definition, as a linear scan would find it
+        index.addresses_.try_emplace(*name, *address);
+    }
+
+    return {std::move(index)};
+}
+
+llvm::Optional<uint64_t> SymbolIndex::lookup(llvm::StringRef name) const {
+    if (hash_table_) {
+        if (auto address = hash_table_->lookup(name))
+            return address;
+    }
+
+    auto address = addresses_.find(name);
+    if (address == addresses_.end())
+        return llvm::None;
+
+    return address->second;
+}
+
+template <typename ELFT>
+llvm::Expected<std::unique_ptr<SymbolIndex::HashTable>>
+SymbolIndex::createELFHashTable(
+    const llvm::object::ELFObjectFile<ELFT> &object_file) {
+    using Elf_GnuHash = typename ELFT::GnuHash;
+    using Elf_Hash = typename ELFT::Hash;
+    using Elf_Word = typename ELFT::Word;
+
+    const llvm::object::ELFFile<ELFT> &elf_file = object_file.getELFFile();
+
+    auto sections = elf_file.sections();
+    if (!sections)
+        return sections.takeError();
+
+    const typename ELFT::Shdr *hash_section = nullptr;
+    for (const auto &section : *sections) {
+        if (section.sh_type == llvm::ELF::SHT_GNU_HASH) {
+            hash_section = &section;
+            break;
+        }
+        if (section.sh_type == llvm::ELF::SHT_HASH)
+            hash_section = &section;
+    }
+
+    if (hash_section == nullptr)
+        return nullptr;
+
+    auto symbol_table = elf_file.getSection(hash_section->sh_link);
+    if (!symbol_table)
+        return symbol_table.takeError();
+
+    auto symbols = elf_file.symbols(*symbol_table);
+    if (!symbols)
+        return symbols.takeError();
+
+    auto string_table = elf_file.getStringTableForSymtab(**symbol_table);
+    if (!string_table)
+        return string_table.takeError();
+
+    auto contents = elf_file.getSectionContents(*hash_section);
+    if (!contents)
+        return contents.takeError();
+
+    auto malformed = []() {
+        return llvm::createStringError(std::error_code{},
+                                       "Malformed ELF hash section");
+    };
+
+    const Elf_GnuHash *gnu_hash = nullptr;
+    const Elf_Hash *sysv_hash = nullptr;
+
+    if (hash_section->sh_type == llvm::ELF::SHT_GNU_HASH) {
+        if (contents->size() < sizeof(Elf_GnuHash))
+            return malformed();
+
+        gnu_hash = reinterpret_cast<const Elf_GnuHash *>(contents->data());
+        size_t table_size =
+            sizeof(Elf_GnuHash) +
+            gnu_hash->maskwords * sizeof(typename ELFT::Off) +
+            (gnu_hash->nbuckets + symbols->size() - gnu_hash->symndx) *
+                sizeof(Elf_Word);
+        if (gnu_hash->nbuckets == 0 || gnu_hash->maskwords == 0 ||
+            gnu_hash->symndx > symbols->size() ||
+            contents->size() < table_size)
+            return malformed();
+    } else {
+        if (contents->size() < sizeof(Elf_Hash))
+            return malformed();
+
+        sysv_hash = reinterpret_cast<const Elf_Hash *>(contents->data());
+        size_t table_size = sizeof(Elf_Hash) + (sysv_hash->nbucket +
+                                                sysv_hash->nchain) *
+                                                   sizeof(Elf_Word);
+        if (sysv_hash->nbucket == 0 || contents->size() < table_size)
+            return malformed();
+    }
+
+    return std::make_unique<ELFHashTable<ELFT>>(gnu_hash, sysv_hash, *symbols,
+                                                *string_table);
+}
+
+llvm::Expected<std::unique_ptr<SymbolIndex::HashTable>>
+SymbolIndex::createHashTable(const llvm::object::ObjectFile &object_file) {
+    using namespace llvm::object;
+
+    if (const auto *elf = llvm::dyn_cast<ELF64LEObjectFile>(&object_file))
+        return createELFHashTable(*elf);
+    if (const auto *elf = llvm::dyn_cast<ELF64BEObjectFile>(&object_file))
+        return createELFHashTable(*elf);
+    if (const auto *elf = llvm::dyn_cast<ELF32LEObjectFile>(&object_file))
+        return createELFHashTable(*elf);
+    if (const auto *elf = llvm::dyn_cast<ELF32BEObjectFile>(&object_file))
+        return createELFHashTable(*elf);
+
+    return nullptr;
+}
+
+#endif // INCLUDE_SYMBOL_INDEX_HPP_
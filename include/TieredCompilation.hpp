@@ -0,0 +1,363 @@
+#ifndef INCLUDE_TIERED_COMPILATION_HPP_
+#define INCLUDE_TIERED_COMPILATION_HPP_
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// Symbols the tier-0 code of a module refers to. The JIT defines them as
+// absolute symbols in the module's JITDylib.
+constexpr const char *TIER_CALL_COUNTS_SYMBOL = "__jit_tier_call_counts";
+constexpr const char *TIER_BRANCH_COUNTS_SYMBOL = "__jit_tier_branch_counts";
+constexpr const char *TIER_UP_CONTEXT_SYMBOL = "__jit_tier_up_context";
+// `void (i8 *context, i64 function_index)`
+constexpr const char *TIER_UP_SYMBOL = "__jit_tier_up";
+
+// Names the tier-0 and the optimized body of tiered function `f` are
+// defined under; `f` itself is the stub calls go through.
+constexpr const char *TIER_ZERO_SUFFIX = ".tier0";
+constexpr const char *TIER_ONE_SUFFIX = ".tier1";
+
+// Functions of `module` that are compiled in tiers: its external
+// definitions, in module order. A function's index is that of its call
+// counter.
+std::vector<llvm::Function *> getTieredFunctions(llvm::Module &module) {
+    std::vector<llvm::Function *> functions;
+    for (llvm::Function &function : module) {
+        if (!function.isDeclarationForLinker() && !function.hasLocalLinkage())
+            functions.push_back(&function);
+    }
+    return functions;
+}
+
+// Conditional branches of `module`, in module order. Branch `i` counts its
+// true edge in counter 2i and its false edge in counter 2i + 1.
+std::vector<llvm::BranchInst *> getCountedBranches(llvm::Module &module) {
+    std::vector<llvm::BranchInst *> branches;
+    for (llvm::Function &function : module) {
+        for (llvm::BasicBlock &block : function) {
+            auto *branch =
+                llvm::dyn_cast<llvm::BranchInst>(block.getTerminator());
+            if (branch != nullptr && branch->isConditional())
+                branches.push_back(branch);
+        }
+    }
+    return branches;
+}
+
+// Gives variables with local linkage external linkage, so that code
+// compiled from another copy of the module can refer to them by name.
+void exportLocalVariables(llvm::Module &module) {
+    for (llvm::GlobalVariable &variable : module.globals()) {
+        if (!variable.hasLocalLinkage())
+            continue;
+
+        if (!variable.hasName())
+            variable.setName("tier.variable");
+        variable.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+}
+
+struct TierZeroFunctions {
+    // Names of the tiered functions, indexed like their call counters
+    std::vector<std::string> names;
+    // Names their instrumented bodies were renamed to
+    std::vector<std::string> body_names;
+    size_t branch_count = 0;
+};
+
+// Turns `module` into the tier-0 code of tiered compilation:
+//  - each tiered function `f` is renamed to `f.tier0`, and every use of it
+//    now refers to a declaration of `f`, which the JIT defines as a stub;
+//  - entering `f.tier0` increments its call counter, and the call that
+//    brings it to `threshold` passes its index to TIER_UP_SYMBOL;
+//  - each conditional branch increments the counter of the edge it takes.
+//    Unlike call counters these are not atomic, as fast instruction
+//    selection cannot lower atomics and would hand the whole block to the
+//    slower selector; concurrent calls can lose counts;
+//  - local variables are exported for the optimized code to share.
+TierZeroFunctions instrumentTierZero(llvm::Module &module,
+                                     uint64_t threshold) {
+    exportLocalVariables(module);
+
+    std::vector<llvm::Function *> functions = getTieredFunctions(module);
+    // Collected first, as the tier-up check adds branches of its own
+    std::vector<llvm::BranchInst *> branches = getCountedBranches(module);
+
+    TierZeroFunctions tiered;
+    tiered.branch_count = branches.size();
+
+    llvm::LLVMContext &context = module.getContext();
+    llvm::IRBuilder<> ir_builder{context};
+    llvm::IntegerType *counter_type = ir_builder.getInt64Ty();
+    llvm::Constant *one = llvm::ConstantInt::get(counter_type, 1);
+
+    if (!branches.empty()) {
+        llvm::ArrayType *array_type =
+            llvm::ArrayType::get(counter_type, 2 * branches.size());
+        auto *counters = new llvm::GlobalVariable(
+            module, array_type, /*isConstant*/ false,
+            llvm::GlobalValue::ExternalLinkage, /*Initializer*/ nullptr,
+            TIER_BRANCH_COUNTS_SYMBOL);
+
+        for (size_t index = 0; index < branches.size(); ++index) {
+            llvm::BranchInst *branch = branches[index];
+            ir_builder.SetInsertPoint(branch);
+
+            llvm::Value *edge = ir_builder.CreateSelect(
+                branch->getCondition(), ir_builder.getInt64(2 * index),
+                ir_builder.getInt64(2 * index + 1));
+            llvm::Value *counter = ir_builder.CreateInBoundsGEP(
+                array_type, counters, {ir_builder.getInt64(0), edge});
+            ir_builder.CreateStore(
+                ir_builder.CreateAdd(
+                    ir_builder.CreateLoad(counter_type, counter), one),
+                counter);
+        }
+    }
+
+    if (functions.empty())
+        return tiered;
+
+    llvm::ArrayType *array_type =
+        llvm::ArrayType::get(counter_type, functions.size());
+    auto *counters = new llvm::GlobalVariable(
+        module, array_type, /*isConstant*/ false,
+        llvm::GlobalValue::ExternalLinkage, /*Initializer*/ nullptr,
+        TIER_CALL_COUNTS_SYMBOL);
+
+    // Only the address of the context is used
+    auto *tier_up_context = new llvm::GlobalVariable(
+        module, ir_builder.getInt8Ty(), /*isConstant*/ false,
+        llvm::GlobalValue::ExternalLinkage, /*Initializer*/ nullptr,
+        TIER_UP_CONTEXT_SYMBOL);
+    llvm::FunctionCallee tier_up = module.getOrInsertFunction(
+        TIER_UP_SYMBOL, ir_builder.getVoidTy(), tier_up_context->getType(),
+        counter_type);
+
+    llvm::Constant *last_cold_count = llvm::ConstantInt::get(
+        counter_type, std::max<uint64_t>(threshold, 1) - 1);
+
+    for (size_t index = 0; index < functions.size(); ++index) {
+        llvm::Function *function = functions[index];
+
+        // Allocas stay in the entry block, ahead of the check
+        llvm::BasicBlock &entry_block = function->getEntryBlock();
+        llvm::BasicBlock::iterator insert_point =
+            entry_block.getFirstInsertionPt();
+        while (llvm::isa<llvm::AllocaInst>(*insert_point))
+            ++insert_point;
+
+        ir_builder.SetInsertPoint(&*insert_point);
+        llvm::Value *counter = ir_builder.CreateConstInBoundsGEP2_64(
+            array_type, counters, 0, index);
+        llvm::Value *count = ir_builder.CreateAtomicRMW(
+            llvm::AtomicRMWInst::Add, counter, one,
+            llvm::AtomicOrdering::Monotonic);
+        llvm::Value *is_hot = ir_builder.CreateICmpEQ(count, last_cold_count);
+
+        llvm::Instruction *tier_up_end = llvm::SplitBlockAndInsertIfThen(
+            is_hot, &*insert_point, /*Unreachable*/ false);
+        ir_builder.SetInsertPoint(tier_up_end);
+        ir_builder.CreateCall(tier_up, {tier_up_context,
+                                        ir_builder.getInt64(index)});
+    }
+
+    for (llvm::Function *function : functions) {
+        std::string name = function->getName().str();
+        function->setName(name + TIER_ZERO_SUFFIX);
+
+        llvm::Function *stub = llvm::Function::Create(
+            function->getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+            name, module);
+        stub->setAttributes(function->getAttributes());
+        stub->setCallingConv(function->getCallingConv());
+        function->replaceAllUsesWith(stub);
+
+        tiered.names.push_back(std::move(name));
+        tiered.body_names.push_back(function->getName().str());
+    }
+
+    return tiered;
+}
+
+// Turns `module`, parsed from the IR the tier-0 code was built from, into
+// the optimized code of the tiered function `function_name` and returns
+// the name its body is defined under:
+//  - the counts gathered by the tier-0 code become the entry counts of the
+//    tiered functions and the weights of the conditional branches;
+//  - other external functions and constant variables become
+//    available_externally, so that they can be inlined and folded without
+//    being defined again;
+//  - other variables become declarations of those of the tier-0 code.
+// Direct calls to the function itself, e.g. recursive ones, bind to the
+// new body; every other use still refers to the stub.
+llvm::Expected<std::string>
+prepareTierOne(llvm::Module &module, llvm::StringRef function_name,
+               llvm::ArrayRef<std::atomic<uint64_t>> call_counts,
+               llvm::ArrayRef<std::atomic<uint64_t>> branch_counts) {
+    exportLocalVariables(module);
+
+    std::vector<llvm::Function *> functions = getTieredFunctions(module);
+    std::vector<llvm::BranchInst *> branches = getCountedBranches(module);
+    if (functions.size() != call_counts.size() ||
+        2 * branches.size() != branch_counts.size())
+        return llvm::createStringError(
+            std::error_code{}, "Profile does not match module %s",
+            module.getModuleIdentifier().c_str());
+
+    for (size_t index = 0; index < functions.size(); ++index)
+        functions[index]->setEntryCount(
+            call_counts[index].load(std::memory_order_relaxed));
+
+    llvm::MDBuilder md_builder{module.getContext()};
+    for (size_t index = 0; index < branches.size(); ++index) {
+        uint64_t taken =
+            branch_counts[2 * index].load(std::memory_order_relaxed);
+        uint64_t not_taken =
+            branch_counts[2 * index + 1].load(std::memory_order_relaxed);
+        if (taken == 0 && not_taken == 0)
+            continue;
+
+        // Branch weights are 32-bit
+        uint64_t scale = std::max(taken, not_taken) /
+                             std::numeric_limits<uint32_t>::max() +
+                         1;
+        branches[index]->setMetadata(
+            llvm::LLVMContext::MD_prof,
+            md_builder.createBranchWeights(
+                static_cast<uint32_t>(taken / scale),
+                static_cast<uint32_t>(not_taken / scale)));
+    }
+
+    llvm::Function *hot_function = module.getFunction(function_name);
+    if (hot_function == nullptr ||
+        llvm::find(functions, hot_function) == functions.end())
+        return llvm::createStringError(
+            std::error_code{}, "No tiered function \"%s\" in %s",
+            function_name.str().c_str(),
+            module.getModuleIdentifier().c_str());
+
+    for (llvm::Function *function : functions) {
+        if (function != hot_function) {
+            function->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+            function->setComdat(nullptr);
+        }
+    }
+
+    // Static constructors already ran with the tier-0 code
+    for (llvm::GlobalVariable &variable :
+         llvm::make_early_inc_range(module.globals())) {
+        if (variable.hasAppendingLinkage()) {
+            variable.eraseFromParent();
+            continue;
+        }
+        if (variable.isDeclaration())
+            continue;
+
+        variable.setComdat(nullptr);
+        if (variable.isConstant()) {
+            variable.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+        } else {
+            variable.setInitializer(nullptr);
+            variable.setLinkage(llvm::GlobalValue::ExternalLinkage);
+        }
+    }
+
+    hot_function->setName(function_name + TIER_ONE_SUFFIX);
+    hot_function->setComdat(nullptr);
+
+    llvm::Function *stub = llvm::Function::Create(
+        hot_function->getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+        function_name, module);
+    stub->setAttributes(hot_function->getAttributes());
+    stub->setCallingConv(hot_function->getCallingConv());
+    hot_function->replaceAllUsesWith(stub);
+
+    for (llvm::User *user : llvm::make_early_inc_range(stub->users())) {
+        auto *call = llvm::dyn_cast<llvm::CallBase>(user);
+        if (call != nullptr && call->getCalledOperand() == stub)
+            call->setCalledOperand(hot_function);
+    }
+
+    return hot_function->getName().str();
+}
+
+// Indirect stubs whose targets only move up the tiers. The lazy reexports
+// that create the stubs point them at the tier-0 code on the first call,
+// which may land after a concurrent promotion to optimized code; such late
+// updates are ignored. A stub's pointer is replaced with a single atomic
+// store, so calls in flight finish in the code they entered.
+class TierStubsManager : public llvm::orc::IndirectStubsManager {
+  public:
+    explicit TierStubsManager(
+        std::unique_ptr<llvm::orc::IndirectStubsManager> base)
+        : base_{std::move(base)} {}
+
+    llvm::Error createStub(llvm::StringRef stub_name,
+                           llvm::JITTargetAddress stub_address,
+                           llvm::JITSymbolFlags stub_flags) override {
+        return base_->createStub(stub_name, stub_address, stub_flags);
+    }
+
+    llvm::Error createStubs(const StubInitsMap &stub_inits) override {
+        return base_->createStubs(stub_inits);
+    }
+
+    llvm::JITEvaluatedSymbol findStub(llvm::StringRef name,
+                                      bool exported_stubs_only) override {
+        return base_->findStub(name, exported_stubs_only);
+    }
+
+    llvm::JITEvaluatedSymbol findPointer(llvm::StringRef name) override {
+        return base_->findPointer(name);
+    }
+
+    llvm::Error updatePointer(llvm::StringRef name,
+                              llvm::JITTargetAddress new_address) override {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (promoted_.count(name) != 0)
+            return llvm::Error::success();
+        return base_->updatePointer(name, new_address);
+    }
+
+    // Points stub `name` at optimized code for good.
+    llvm::Error promote(llvm::StringRef name,
+                        llvm::JITTargetAddress optimized_address) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        promoted_.insert(name);
+        return base_->updatePointer(name, optimized_address);
+    }
+
+  private:
+    std::mutex mutex_;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> base_;
+    llvm::StringSet<> promoted_;
+};
+
+#endif // INCLUDE_TIERED_COMPILATION_HPP_
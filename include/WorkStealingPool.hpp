@@ -0,0 +1,179 @@
+#ifndef INCLUDE_WORK_STEALING_POOL_HPP_
+#define INCLUDE_WORK_STEALING_POOL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Runs tasks of type `Task` on a fixed set of workers, each owning a deque.
+//
+// A worker takes its newest task first and, once its own deque is empty,
+// steals the oldest task of another worker. Tasks may push further tasks
+// (e.g. the members of an archive) onto the deque of the worker running
+// them, where idle workers can steal them. A worker finding nothing to take
+// sleeps until a task is pushed. run() returns once every task, including
+// those pushed while running, has completed.
+template <typename Task> class WorkStealingPool {
+  public:
+    // Called with the index of the worker running `task`.
+    using Handler = std::function<void(unsigned worker, Task task)>;
+
+    // `thread_count` 0 uses one worker per hardware thread.
+    explicit WorkStealingPool(unsigned thread_count = 0);
+
+    unsigned getWorkerCount() const { return queues_.size(); }
+
+    // Queues `task` on `worker`, which must be < getWorkerCount(). Tasks
+    // pushed before run() are best spread over all workers.
+    void push(unsigned worker, Task task);
+
+    void run(const Handler &handler);
+
+  private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool popOwn(unsigned worker, Task &task);
+    bool steal(unsigned thief, Task &task);
+    void work(unsigned worker, const Handler &handler);
+    void waitForTasks();
+    void wakeIdleWorkers(bool all);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    // Tasks pushed and not completed yet, including those running
+    std::atomic<size_t> pending_tasks_{0};
+    // Tasks waiting in a deque
+    std::atomic<size_t> queued_tasks_{0};
+
+    std::mutex idle_mutex_;
+    std::condition_variable idle_condition_;
+    std::atomic<unsigned> idle_workers_{0};
+};
+
+template <typename Task>
+WorkStealingPool<Task>::WorkStealingPool(unsigned thread_count) {
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned worker = 0; worker < thread_count; ++worker)
+        queues_.push_back(std::make_unique<Queue>());
+}
+
+template <typename Task>
+void WorkStealingPool<Task>::push(unsigned worker, Task task) {
+    ++pending_tasks_;
+
+    {
+        Queue &queue = *queues_[worker];
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        queue.tasks.push_back(std::move(task));
+    }
+
+    ++queued_tasks_;
+    wakeIdleWorkers(/*all*/ false);
+}
+
+template <typename Task>
+void WorkStealingPool<Task>::run(const Handler &handler) {
+    std::vector<std::thread> threads;
+    for (unsigned worker = 1; worker < queues_.size(); ++worker)
+        threads.emplace_back([this, worker, &handler]() {
+            work(worker, handler);
+        });
+
+    // The calling thread is the first worker
+    work(0, handler);
+
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+template <typename Task>
+bool WorkStealingPool<Task>::popOwn(unsigned worker, Task &task) {
+    Queue &queue = *queues_[worker];
+    std::lock_guard<std::mutex> lock{queue.mutex};
+
+    if (queue.tasks.empty())
+        return false;
+
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    --queued_tasks_;
+    return true;
+}
+
+template <typename Task>
+bool WorkStealingPool<Task>::steal(unsigned thief, Task &task) {
+    for (size_t offset = 1; offset < queues_.size(); ++offset) {
+        Queue &victim = *queues_[(thief + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock{victim.mutex};
+
+        if (victim.tasks.empty())
+            continue;
+
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        --queued_tasks_;
+        return true;
+    }
+
+    return false;
+}
+
+template <typename Task>
+void WorkStealingPool<Task>::work(unsigned worker, const Handler &handler) {
+    Task task;
+
+    // A task in flight may still push more work, so only stop once
+    // nothing is pending anywhere
+    while (pending_tasks_.load() != 0) {
+        if (!popOwn(worker, task) && !steal(worker, task)) {
+            waitForTasks();
+            continue;
+        }
+
+        handler(worker, std::move(task));
+        if (--pending_tasks_ == 0)
+            wakeIdleWorkers(/*all*/ true);
+    }
+}
+
+// Sleeps until a task is queued or the last pending task has completed,
+// instead of sweeping the deques while another worker runs a long task.
+template <typename Task> void WorkStealingPool<Task>::waitForTasks() {
+    std::unique_lock<std::mutex> lock{idle_mutex_};
+
+    // Announced before checking for tasks, so that push() either sees this
+    // worker idle or has queued its task before the check
+    ++idle_workers_;
+    idle_condition_.wait(lock, [this]() {
+        return queued_tasks_.load() != 0 || pending_tasks_.load() == 0;
+    });
+    --idle_workers_;
+}
+
+template <typename Task>
+void WorkStealingPool<Task>::wakeIdleWorkers(bool all) {
+    if (idle_workers_.load() == 0)
+        return;
+
+    // Taking the lock orders the notification after a sleeping worker's
+    // check for tasks
+    std::lock_guard<std::mutex> lock{idle_mutex_};
+    if (all)
+        idle_condition_.notify_all();
+    else
+        idle_condition_.notify_one();
+}
+
+#endif // INCLUDE_WORK_STEALING_POOL_HPP_
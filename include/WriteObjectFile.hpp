@@ -0,0 +1,51 @@
+#ifndef INCLUDE_WRITE_OBJECT_FILE_HPP_
+#define INCLUDE_WRITE_OBJECT_FILE_HPP_
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/ArchiveWriter.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <system_error>
+#include <vector>
+
+// Writes the contents of an object to `path`.
+llvm::Error writeObjectFile(llvm::StringRef path,
+                            llvm::MemoryBufferRef object_buffer) {
+    std::error_code ec;
+    llvm::raw_fd_ostream output{path, ec, llvm::sys::fs::OF_None};
+    if (ec)
+        return llvm::errorCodeToError(ec);
+
+    output << object_buffer.getBuffer();
+    output.close();
+
+    if (output.has_error()) {
+        std::error_code write_error = output.error();
+        output.clear_error();
+        return llvm::errorCodeToError(write_error);
+    }
+
+    return llvm::Error::success();
+}
+
+// Bundles objects into a static archive at `path` with a symbol table, as
+// `ar rcs` would. Member names are the buffer identifiers. The archive is
+// deterministic (zero timestamps and owners), so rebuilding unchanged
+// objects yields an identical file.
+llvm::Error writeStaticArchive(llvm::StringRef path,
+                               llvm::ArrayRef<llvm::MemoryBufferRef> members) {
+    std::vector<llvm::NewArchiveMember> archive_members;
+    archive_members.reserve(members.size());
+    for (llvm::MemoryBufferRef member : members)
+        archive_members.emplace_back(member);
+
+    return llvm::writeArchive(path, archive_members, /*WriteSymtab*/ true,
+                              llvm::object::Archive::K_GNU,
+                              /*Deterministic*/ true, /*Thin*/ false);
+}
+
+#endif // INCLUDE_WRITE_OBJECT_FILE_HPP_
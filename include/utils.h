@@ -1,15 +1,23 @@
 #ifndef INCLUDE_UTILS_H_
 #define INCLUDE_UTILS_H_
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/raw_ostream.h"
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 #define PRINT_EXPR(expr)                                                       \
     llvm::outs() << llvm::raw_ostream::GREEN << #expr                          \
@@ -25,31 +33,113 @@ bool has_reloc_symbols(const llvm::object::SectionRef &section) {
     return (section.relocation_begin() != section.relocation_end());
 };
 
-void print_reloc_symbols(const llvm::object::SectionRef &section) {
-    auto section_name = llvm::cantFail(section.getName());
+// Caches the name of every relocation type seen, so that each name is only
+// formatted once. Not thread-safe; use one per thread.
+class RelocationTypeNames {
+  public:
+    llvm::StringRef get(const llvm::object::RelocationRef &reloc) {
+        auto name = names_.try_emplace(reloc.getType());
+        if (name.second) {
+            llvm::SmallVector<char> type_name;
+            reloc.getTypeName(type_name);
+            name.first->second.assign(type_name.begin(), type_name.end());
+        }
+        return name.first->second;
+    }
 
-    llvm::outs() << llvm::raw_ostream::GREEN << "RELOCATION RECORDS FOR ["
-                 << section_name << "]\n"
-                 << llvm::raw_ostream::RESET;
+  private:
+    llvm::DenseMap<uint64_t, std::string> names_;
+};
 
-    llvm::outs() << "Offset          \tType          \tSymbol\n";
+// Name of `section`, empty if it cannot be read.
+llvm::StringRef get_section_name(const llvm::object::SectionRef &section) {
+    auto name = section.getName();
+    if (!name) {
+        llvm::consumeError(name.takeError());
+        return {};
+    }
+    return *name;
+}
 
-    for (const auto &reloc_symbol : section.relocations()) {
+// Name of the symbol `reloc` refers to, empty if it has none.
+llvm::StringRef
+get_reloc_symbol_name(const llvm::object::RelocationRef &reloc) {
+    auto symbol = reloc.getSymbol();
+    if (symbol == reloc.getObject()->symbol_end())
+        return {};
+
+    auto name = symbol->getName();
+    if (!name) {
+        llvm::consumeError(name.takeError());
+        return {};
+    }
+    return *name;
+}
 
-        llvm::SmallVector<char> symbol_type;
-        reloc_symbol.getTypeName(symbol_type);
+void write_reloc_symbols(llvm::raw_ostream &os,
+                         const llvm::object::SectionRef &section,
+                         RelocationTypeNames &type_names) {
+    llvm::StringRef section_name = get_section_name(section);
 
-        auto symbol_name = llvm::cantFail(reloc_symbol.getSymbol()->getName());
+    os << llvm::raw_ostream::GREEN << "RELOCATION RECORDS FOR ["
+       << section_name << "]\n"
+       << llvm::raw_ostream::RESET;
 
-        auto symbol_address = format_address(reloc_symbol.getOffset());
+    os << "Offset          \tType          \tSymbol\n";
 
-        llvm::outs() << symbol_address << '\t' << symbol_type << '\t'
-                     << symbol_name << '\n';
+    for (const auto &reloc_symbol : section.relocations()) {
+        os << format_address(reloc_symbol.getOffset()) << '\t'
+           << type_names.get(reloc_symbol) << '\t'
+           << get_reloc_symbol_name(reloc_symbol) << '\n';
     }
 
-    llvm::outs() << '\n';
+    os << '\n';
+}
+
+void print_reloc_symbols(const llvm::object::SectionRef &section) {
+    RelocationTypeNames type_names;
+    write_reloc_symbols(llvm::outs(), section, type_names);
 };
 
+using RelocationFormatter =
+    std::function<void(llvm::raw_ostream &, const llvm::object::SectionRef &,
+                       RelocationTypeNames &)>;
+
+// Formats the relocations of `sections` on `thread_count` threads (0: one per
+// hardware thread), each section into a buffer of its own, and writes the
+// buffers to `os` in the order of `sections`, each with a single write.
+void print_reloc_symbols_parallel(
+    llvm::raw_ostream &os,
+    llvm::ArrayRef<llvm::object::SectionRef> sections,
+    unsigned thread_count = 0,
+    const RelocationFormatter &format_section = write_reloc_symbols) {
+    llvm::ThreadPool thread_pool{llvm::hardware_concurrency(thread_count)};
+
+    std::vector<std::string> buffers(sections.size());
+    std::vector<std::shared_future<void>> formatted;
+    formatted.reserve(sections.size());
+
+    bool colors = os.colors_enabled();
+
+    for (size_t index = 0; index < sections.size(); ++index) {
+        formatted.push_back(thread_pool.async([&, index]() {
+            thread_local RelocationTypeNames type_names;
+
+            llvm::raw_string_ostream buffer_stream{buffers[index]};
+            buffer_stream.enable_colors(colors);
+            format_section(buffer_stream, sections[index], type_names);
+            buffer_stream.flush();
+        }));
+    }
+
+    // Sections are written as soon as they and all before them are done
+    for (size_t index = 0; index < sections.size(); ++index) {
+        formatted[index].wait();
+        os.write(buffers[index].data(), buffers[index].size());
+        std::string{}.swap(buffers[index]);
+    }
+}
+
 [[maybe_unused]] static const char disable_colors_if_piped = []() {
     if (!llvm::outs().has_colors()) {
         llvm::outs().enable_colors(false);